@@ -13,117 +13,111 @@
 #include<fcntl.h>
 #include<string.h>
 #include<unistd.h>
+#include<sys/ioctl.h>
+
+#include "periodic.h"
+#include "encoder.h"
+#include "pid.h"
+#include "pid_abi.h"
+#include "motor.h"
+#include "pwm_abi.h"
+#include "uring.h"
 
-/** @brief define clockwise direction */
-#define CLOCKWISE 1
-/** @brief define counterclockwise direction */
-#define COUNTERCLOCK 2
 /** @brief define speed max */
 #define SPEED 50
-/** @brief define write buffer length */
-#define writeLen 4
-/** @brief define read buffer length */
-#define readLen 64
-/** @brief define the time interval */
-#define FREQ    5000000
-/** @brief define the mox speed */
-#define SHIGH   70
-/** @brief define the low speed upper bound */
-#define SLOW1   20
-/** @brief define the low speed lower bound */
-#define SLOW2   5
-/** @brief define the full round degree */
-#define FULLROUND 360
-/** @brief define the half round degree */
-#define HALFROUND 180
-
-/** @brief write buffer */
-static char writeString[writeLen];
-/** @brief read buffer */
-static char readString[readLen] = {0};
-/** @brief define Kp */
-static float Kp = 0.23;
-/** @brief define Kd */
-static float Kd = 0.1;
-/** @brief define ki */
-static float Ki = 0.0001;
-
-/** @brief prototype for device write function 
-    @param fd is the file descripture of the target device
-    @param num is the number of bits write
+/** @brief define the default control loop rate in Hz */
+#define CONTROL_HZ 100
+/** @brief define the io_uring operations one period may queue */
+#define URING_ENTRIES 8
+
+/** @brief follows the rotary encoder with the in-kernel controller, only
+           forwarding the target angle to /dev/motor_pid
+    @param rotary_encoder is the open rotary encoder
+    @param task is the periodic task pacing the updates
+    @return 1 if the controller device could not be opened
 */
-void writeToDevice(int fd, int num);
+int kernelFollow(struct encoder *rotary_encoder, struct periodic_task *task);
 
 /** @brief main function runs in a loop, continuously checking encoder outputs and set 
      motor positions according to that 
+    @param argc is the number of arguments
+    @param argv optionally holds the control loop rate in Hz, and "kernel"
+           to run the loop in the pid_driver module instead or "uring" to
+           submit the motor write and the sleep of each period in one
+           io_uring system call
 */
-int main() {
-	int fd_motor, fd_pwm, fd_wheel_encoder, fd_rotary_encoder, rotary_pos, motor_pos, err, speed, i;
-	int err_sum = 0, last_err = 0, dir = 0;
-
-	fd_motor = open("/dev/motor_char", O_RDWR);
-	fd_pwm = open("/dev/motor_pwm", O_RDWR);
-	fd_wheel_encoder = open("/dev/wheel_encoder", O_RDWR);
-	fd_rotary_encoder = open("/dev/rot_encoder", O_RDWR);
+int main(int argc, char **argv) {
+	int rotary_pos, motor_pos;
+	struct motor motor;
+	struct pid_ctrl pid;
+	q16_t out;
+	struct periodic_task task;
+	struct encoder wheel_encoder, rotary_encoder;
+	struct uring ring;
+	int uring = 0;
+
+	// the environment picks the LKM devices or gpio lines, see gpio_line.h
+	motor_open(&motor, gpio_device("MOTOR_DIR", "/dev/motor_char"),
+	           gpio_device("MOTOR_PWM", "/dev/motor_pwm"), PWM_PERIOD_DEFAULT_NS);
+	encoder_open(&wheel_encoder, gpio_device("WHEEL_ENCODER", "/dev/wheel_encoder"), WHEEL_COUNTS,
+	             ENC_MODE_MMAP);
+	encoder_open(&rotary_encoder, gpio_device("ROT_ENCODER", "/dev/rot_encoder"), ROT_COUNTS,
+	             ENC_MODE_MMAP);
+	// the LKM driver filters with its module parameters, the gpio lines here
+	encoder_set_filter(&wheel_encoder, WHEEL_MIN_PULSE_NS, WHEEL_MAX_RATE);
+	encoder_set_filter(&rotary_encoder, ROT_MIN_PULSE_NS, ROT_MAX_RATE);
+
+	pid_init(&pid, PID_KP_DEFAULT, PID_KI_DEFAULT, PID_KD_DEFAULT, Q16_FROM_INT(PID_FULLROUND));
+	periodic_init(&task, "pid", periodic_parse_hz(argc > 1 ? argv[1] : NULL, CONTROL_HZ));
+
+	if (argc > 2 && strcmp(argv[2], "kernel") == 0)
+		return kernelFollow(&rotary_encoder, &task);
+	if (argc > 2 && strcmp(argv[2], "uring") == 0) {
+		uring = uring_init(&ring, URING_ENTRIES) == 0;
+		if (!uring) perror("io_uring, using blocking calls");
+	}
 
 	while(1) {
-		rotary_pos = readEncoder(fd_rotary_encoder);
-		motor_pos = readEncoder(fd_wheel_encoder);
+		rotary_pos = encoder_read_degree(&rotary_encoder);
+		motor_pos = encoder_read_degree(&wheel_encoder);
 
 		printf("rotary_pos: %d\n", rotary_pos);
 		printf("motor_pos: %d\n", motor_pos);
 
+		out = pid_update(&pid, Q16_FROM_INT(rotary_pos), Q16_FROM_INT(motor_pos));
+		printf("output: %d\n", Q16_TO_INT(out));
 
-		err = rotary_pos-motor_pos;
-
-		printf("Difference before: %d\n", err);
-
-		if (err < 0 && err >= -HALFROUND) {
-			dir = COUNTERCLOCK;
-		} else if (err < -HALFROUND) {
-			dir = CLOCKWISE;
-			err = -FULLROUND-err;
-		} else if (err >= 0 && err < HALFROUND) {
-			dir = CLOCKWISE;
+		if (uring) {
+			motor_queue(&motor, &ring, pid_motor_speed(out, motor.period_ns));
+			uring_periodic_wait(&ring, &task);
 		} else {
-			dir = COUNTERCLOCK;
-			err = FULLROUND-err;
+			motor_set(&motor, pid_motor_speed(out, motor.period_ns));
+			periodic_wait(&task);
 		}
+		periodic_report(&task);
+	}
 
-		printf("Difference after: %d\n", err);
-
-		speed = (int)(Kp*err+Kd*(err-last_err)+Ki*err_sum);
-
-		
-		if (speed < 0) speed = -speed;
-		if (speed > SHIGH) speed = SHIGH;
-                else if (speed < SLOW1 && speed >= SLOW2) speed = SLOW1;
-		
-		last_err = err;
-		err_sum += err;
+}
 
-		writeToDevice(fd_motor, dir);
-		writeToDevice(fd_pwm, speed);
+int kernelFollow(struct encoder *rotary_encoder, struct periodic_task *task) {
+	int fd_pid, target, enable = 1;
+	struct pid_status status;
 
-		
-		for (i = 0; i < FREQ; i++);
+	fd_pid = open("/dev/motor_pid", O_RDWR);
+	if (fd_pid < 0) {
+		perror("open /dev/motor_pid");
+		return 1;
 	}
+	ioctl(fd_pid, PID_IOC_ENABLE, &enable);
 
-}
+	while(1) {
+		target = encoder_read_degree(rotary_encoder);
+		ioctl(fd_pid, PID_IOC_SET_TARGET, &target);
 
-void writeToDevice(int fd, int num) {
-	memset(writeString, 0, writeLen);
-	sprintf(writeString, "%d", num);
-	printf("writeString: %s\n", writeString);
-	write(fd, writeString, strlen(writeString)+1);
-}
+		if (task->cycles % task->hz == 0 && ioctl(fd_pid, PID_IOC_GET_STATUS, &status) == 0)
+			printf("target: %d position: %d output: %d overruns: %u\n",
+			       status.target, status.position, status.output, status.overruns);
 
-/** @brief readEncoder reads results from a encoder
-    @param fd is the file descriptor of the device
-    @return number of bytes read
-*/
-int readEncoder(int fd) {
-	memset(readString, 0, readLen);
-	read(fd, readString, readLen);
-	return atoi(readString);
+		periodic_wait(task);
+	}
 }
@@ -11,6 +11,8 @@
 #include <sys/types.h> 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <string.h>
 #include <stdlib.h>
@@ -18,154 +20,367 @@
 #include <errno.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+
+#include "periodic.h"
+#include "encoder.h"
+#include "pid.h"
+#include "proto.h"
+#include "mailbox.h"
+#include "motor.h"
+#include "pwm_abi.h"
+#include "uring.h"
 
 /** @brief port number for network */
 #define PORT 5000
-/** @brief define clockwise direction */
-#define CLOCKWISE 1
-/** @brief define counterclockwise direction */
-#define COUNTERCLOCK 2
 /** @brief define speed max */
 #define SPEED 50
-/** @brief define write buffer length */
-#define writeLen 4
-/** @brief define read buffer length */
-#define readLen 64
-/** @brief define the time interval */
-#define FREQ    5000000
-/** @brief define the mox speed */
-#define SHIGH   70
-/** @brief define the low speed upper bound */
-#define SLOW1   20
-/** @brief define the low speed lower bound */
-#define SLOW2   5
-/** @brief define the full round degree */
-#define FULLROUND 360
-/** @brief define the half round degree */
-#define HALFROUND 180
-/** @brief define the buffer size */
-#define BUFFSIZE 32
-
-/** @brief write buffer */
-static char writeString[writeLen];
-/** @brief read buffer */
-static char readString[readLen] = {0};
-/** @brief define Kp */
-static float Kp = 0.23;
-/** @brief define Kd */
-static float Kd = 0.1;
-/** @brief define ki */
-static float Ki = 0.0001;
-/** @brief global varible for received target position */
-static int target_pos = 0;
-/** @brief global varible for sending motor position */
-static int motor_pos = 0;
+/** @brief define the default control loop rate in Hz */
+#define CONTROL_HZ 100
+/** @brief define the default network heartbeat rate in Hz */
+#define NET_HZ     50
+/** @brief define the number of encoder edges that trigger a position send */
+#define NET_EDGES  10
+/** @brief define the max number of epoll events handled per wakeup */
+#define MAX_EVENTS 4
+/** @brief define the io_uring operations one loop may have in flight */
+#define URING_ENTRIES 8
+/** @brief io_uring tag of the datagram receive */
+#define NET_TAG_RX 1
+/** @brief io_uring tag of the datagram send */
+#define NET_TAG_TX 2
+/** @brief io_uring tag of the heartbeat timeout */
+#define NET_TAG_TICK 3
+
+/** @brief one TCP connection shared by its send and receive paths */
+struct net_conn {
+	/** @brief the connected socket */
+	int fd;
+	/** @brief protocol state, see proto.h for which side owns which field */
+	struct proto_peer peer;
+};
+
+/** @brief target position received from the peer, written by the network
+           receive path and read by the motor thread and the send path */
+static struct mailbox target_box;
+/** @brief wheel position published by the motor thread, read by the send
+           path when the wheel encoder is on gpio lines */
+static struct mailbox position_box;
+/** @brief network heartbeat rate in Hz */
+static unsigned int net_hz = NET_HZ;
+/** @brief control loop rate in Hz */
+static unsigned int control_hz = CONTROL_HZ;
+/** @brief 1 to run the motor and datagram loops on io_uring */
+static int use_uring;
 /** @brief ip address */
 static const char *host = "127.0.0.1";
 
-/** @brief prototype for device write function 
-    @param fd is the file descripture of the target device
-    @param num is the number of bits write
+/** @brief returns the newest target position from the network
+    @return the target position in degrees
 */
-void writeToDevice(int fd, int num) {
-	memset(writeString, 0, writeLen);
-	sprintf(writeString, "%d", num);
-	write(fd, writeString, strlen(writeString)+1);
+static int getTarget(void) {
+	int32_t target = 0;
+
+	mailbox_get(&target_box, &target, sizeof(target));
+	return target;
 }
 
-/** @brief readEncoder reads results from a encoder
-    @param fd is the file descriptor of the device
-    @return number of bytes read
+/** @brief hands a new target position to the motor thread
+    @param target is the target position in degrees
 */
-int readEncoder(int fd) {
-	memset(readString, 0, readLen);
-	read(fd, readString, readLen);
-	return atoi(readString);
+static void setTarget(int32_t target) {
+	mailbox_put(&target_box, &target, sizeof(target));
+}
+
+/** @brief angle and velocity of the wheel */
+struct wheel_position {
+	/** @brief angle in degrees */
+	int32_t degree;
+	/** @brief velocity in degrees per second */
+	int32_t velocity;
+};
+
+/** @brief opens the wheel encoder for the send path. Gpio lines can only be
+           requested once and belong to the motor thread, the send path then
+           reads position_box instead
+    @param enc is the encoder to set up
+    @param mode is the encoder mode
+    @return the file descriptor, -1 in gpio mode
+*/
+static int openWheel(struct encoder *enc, int mode) {
+	const char *path = gpio_device("WHEEL_ENCODER", "/dev/wheel_encoder");
+
+	enc->fd = -1;
+	enc->velocity = 0;
+	if (gpio_is_spec(path)) return -1;
+	return encoder_open(enc, path, WHEEL_COUNTS, mode);
+}
+
+/** @brief reads the wheel for the send path
+    @param enc is the encoder opened by openWheel, its velocity is updated
+    @return the angle in degrees
+*/
+static int readWheel(struct encoder *enc) {
+	struct wheel_position pos = { 0, 0 };
+
+	if (enc->fd >= 0) return encoder_read_degree(enc);
+	mailbox_get(&position_box, &pos, sizeof(pos));
+	enc->velocity = pos.velocity;
+	return pos.degree;
+}
+
+/** @brief the receive path of one TCP connection, run on its own thread so
+           a send blocked on a slow peer never holds up new targets
+    @param var is the struct net_conn of the connection
+    @return NULL once the connection is closed
+*/
+void *netRecvFun(void *var) {
+	struct net_conn *conn = var;
+	struct pollfd pfd = { conn->fd, POLLIN, 0 };
+	struct proto_msg msg;
+	int rc = 0;
+
+	while (rc >= 0) {
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) break;
+		while ((rc = proto_recv(conn->fd, &conn->peer, &msg)) > 0)
+			setTarget(proto_predict(&conn->peer, &msg));
+		proto_report("tcp", &conn->peer);
+	}
+	// wakes the send path, its next send fails
+	shutdown(conn->fd, SHUT_RDWR);
+	return NULL;
 }
 
 /** @brief the client function that is being run on one thread
            receive and send motor position over network
+
+    This thread is the send path: it sends the motor position whenever the
+    wheel moved NET_EDGES steps, or at the heartbeat rate when it stands
+    still. A netRecvFun thread runs the receive path.
 */
 void *clientFun() {
-	int sockfd, i;
-	char sendBuffer[BUFFSIZE] = {0}, receiveBuffer[BUFFSIZE] = {0};
+	int epfd, pos, one = 1;
+	struct encoder wheel_encoder;
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct net_conn conn;
+	pthread_t rx;
 
-	struct sockaddr_in client_addr, server_addr;
+	struct sockaddr_in server_addr;
 
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	conn.fd = socket(AF_INET, SOCK_STREAM, 0);
 
 	memset(&server_addr, 0, sizeof(server_addr));
 	server_addr.sin_family = AF_INET;
 	inet_pton(AF_INET, host, &server_addr.sin_addr);
 	server_addr.sin_port = htons(PORT);
 
-	connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+	connect(conn.fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+	setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	proto_peer_init(&conn.peer);
+
+	epfd = epoll_create1(0);
+	if (openWheel(&wheel_encoder, ENC_MODE_TEXT) >= 0) {
+		encoder_set_wakeup(&wheel_encoder, NET_EDGES);
+		fcntl(wheel_encoder.fd, F_SETFL, O_NONBLOCK);
+		ev.events = EPOLLIN;
+		ev.data.fd = wheel_encoder.fd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, wheel_encoder.fd, &ev);
+	}
+
+	pthread_create(&rx, NULL, netRecvFun, &conn);
+
+	// woken by the encoder or by the heartbeat timeout, either way send
+	while (1) {
+		pos = readWheel(&wheel_encoder);
+		if (proto_send(conn.fd, &conn.peer, getTarget(), pos, wheel_encoder.velocity) < 0)
+			break;
+		epoll_wait(epfd, events, MAX_EVENTS, 1000/net_hz);
+	}
+
+	shutdown(conn.fd, SHUT_RDWR);
+	pthread_join(rx, NULL);
+	close(conn.fd);
+	return NULL;
+}
+
+/** @brief the datagram loop on io_uring: the send of each heartbeat, the
+           timeout of the next one and a receive kept armed all go to the
+           kernel in one uring_enter
+    @param sockfd is the connected datagram socket
+    @param peer is the connection
+    @param wheel_encoder is the wheel as opened by openWheel
+    @return -1 if io_uring is not available or fails, never returns
+            otherwise
+*/
+static int udpUringLoop(int sockfd, struct proto_peer *peer, struct encoder *wheel_encoder) {
+	unsigned char tx[PROTO_MSG_SIZE], rx[PROTO_MSG_SIZE+1];
+	struct uring_done done[URING_ENTRIES];
+	struct periodic_task task;
+	struct proto_msg msg;
+	struct uring ring;
+	int n, i, due, tick, rx_armed = 0, tx_busy = 0;
+
+	if (uring_init(&ring, URING_ENTRIES) < 0) return -1;
+	periodic_init(&task, "udp", net_hz);
 
 	while(1) {
-		memset(sendBuffer, 0, BUFFSIZE);
-		memset(receiveBuffer, 0 , BUFFSIZE);
-		sprintf(sendBuffer, "%d", motor_pos);
-		send(sockfd, sendBuffer, strlen(sendBuffer)+1, 0);
-		read(sockfd, receiveBuffer, BUFFSIZE);
-		target_pos = atoi(receiveBuffer);
-
-		for (i = 0; i < FREQ*2; i++);
+		if (!rx_armed) rx_armed = uring_recv(&ring, sockfd, rx, sizeof(rx), NET_TAG_RX) == 0;
+		due = periodic_next(&task);
+		tick = !due || uring_timeout(&ring, &task.next, NET_TAG_TICK) < 0;
+		while (!tick) {
+			if (uring_enter(&ring, 1) < 0) {
+				uring_exit(&ring);
+				return -1;
+			}
+			n = uring_reap(&ring, done, URING_ENTRIES);
+			for (i = 0; i < n; i++) {
+				if (done[i].tag == NET_TAG_TICK) {
+					tick = 1;
+				} else if (done[i].tag == NET_TAG_TX) {
+					tx_busy = 0;
+				} else if (done[i].res >= 0 || done[i].res == -ECONNREFUSED) {
+					// rearmed right away, other errors wait for the next tick
+					if (done[i].res > 0 && proto_accept_dgram(peer, rx, done[i].res, &msg))
+						setTarget(proto_predict(peer, &msg));
+					rx_armed = uring_recv(&ring, sockfd, rx, sizeof(rx), NET_TAG_RX) == 0;
+				} else {
+					rx_armed = 0;
+				}
+			}
+		}
+		if (due) periodic_released(&task);
+
+		// goes out with the next timeout; a send still in flight keeps its
+		// buffer and this heartbeat is skipped
+		if (!tx_busy) {
+			proto_pack(peer, getTarget(), readWheel(wheel_encoder), wheel_encoder->velocity, tx);
+			tx_busy = uring_send(&ring, sockfd, tx, PROTO_MSG_SIZE, NET_TAG_TX) == 0;
+		}
+		proto_report("udp", peer);
 	}
 }
 
+/** @brief the client function for the datagram transport, run on one thread
+           instead of clientFun
+
+    The position is sent over UDP at exactly net_hz from a timerfd, whether
+    or not anything arrives from the peer. Only the newest datagram matters,
+    so stale and duplicate ones are dropped by proto_recv_dgram and a lost
+    one is simply superseded by the next.
+*/
+void *clientUdpFun() {
+	int sockfd, epfd, tfd, n, i;
+	uint64_t ticks;
+	struct itimerspec period;
+	struct encoder wheel_encoder;
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct proto_peer peer;
+	struct proto_msg msg;
+	struct sockaddr_in server_addr;
+
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	inet_pton(AF_INET, host, &server_addr.sin_addr);
+	server_addr.sin_port = htons(PORT);
+
+	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+	openWheel(&wheel_encoder, ENC_MODE_MMAP);
+	proto_peer_init(&peer);
+
+	if (use_uring && udpUringLoop(sockfd, &peer, &wheel_encoder) < 0)
+		perror("io_uring, using epoll");
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	period.it_value.tv_sec = period.it_interval.tv_sec = 1/net_hz;
+	period.it_value.tv_nsec = period.it_interval.tv_nsec = 1000000000L/net_hz%1000000000L;
+	timerfd_settime(tfd, 0, &period, NULL);
+
+	epfd = epoll_create1(0);
+	ev.events = EPOLLIN;
+	ev.data.fd = sockfd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev);
+	ev.data.fd = tfd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+
+	while(1) {
+		n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == tfd) {
+				read(tfd, &ticks, sizeof(ticks));
+				proto_send(sockfd, &peer, getTarget(), readWheel(&wheel_encoder),
+				           wheel_encoder.velocity);
+				proto_report("udp", &peer);
+				continue;
+			}
+			while (proto_recv_dgram(sockfd, &peer, &msg) > 0)
+				setTarget(proto_predict(&peer, &msg));
+		}
+	}
+}
 
 /** @brief the motor function that is simply the same as PID control
            on one thread
 */
 void *motorFun() {
-	int fd_motor, fd_pwm, fd_wheel_encoder, i, err, speed;
-	int err_sum = 0, last_err = 0, dir = 0;
+	int motor_pos;
+	struct motor motor;
+	struct wheel_position pos;
+	struct pid_ctrl pid;
+	q16_t out;
+	struct periodic_task task;
+	struct encoder wheel_encoder;
+	struct uring ring;
+	int uring;
 
-	fd_motor = open("/dev/motor_char", O_RDWR);
-	fd_pwm = open("/dev/motor_pwm", O_RDWR);
-	fd_wheel_encoder = open("/dev/wheel_encoder", O_RDWR);
+	motor_open(&motor, gpio_device("MOTOR_DIR", "/dev/motor_char"),
+	           gpio_device("MOTOR_PWM", "/dev/motor_pwm"), PWM_PERIOD_DEFAULT_NS);
+	encoder_open(&wheel_encoder, gpio_device("WHEEL_ENCODER", "/dev/wheel_encoder"), WHEEL_COUNTS,
+	             ENC_MODE_MMAP);
+	encoder_set_filter(&wheel_encoder, WHEEL_MIN_PULSE_NS, WHEEL_MAX_RATE);
+
+	pid_init(&pid, PID_KP_DEFAULT, PID_KI_DEFAULT, PID_KD_DEFAULT, Q16_FROM_INT(PID_FULLROUND));
+	periodic_init(&task, "motor", control_hz);
+	uring = use_uring && uring_init(&ring, URING_ENTRIES) == 0;
 
 	while (1) {
-		motor_pos = readEncoder(fd_wheel_encoder);
-		
-		err = target_pos-motor_pos;
-
-		if (err < 0 && err >= -HALFROUND) {
-			dir = COUNTERCLOCK;
-		} else if (err < -HALFROUND) {
-			dir = CLOCKWISE;
-			err = -FULLROUND-err;
-		} else if (err >= 0 && err < HALFROUND) {
-			dir = CLOCKWISE;
+		motor_pos = encoder_read_degree(&wheel_encoder);
+		pos.degree = motor_pos;
+		pos.velocity = wheel_encoder.velocity;
+		mailbox_put(&position_box, &pos, sizeof(pos));
+		out = pid_update(&pid, Q16_FROM_INT(getTarget()), Q16_FROM_INT(motor_pos));
+		if (uring) {
+			motor_queue(&motor, &ring, pid_motor_speed(out, motor.period_ns));
+			uring_periodic_wait(&ring, &task);
 		} else {
-			dir = COUNTERCLOCK;
-			err = FULLROUND-err;
+			motor_set(&motor, pid_motor_speed(out, motor.period_ns));
+			periodic_wait(&task);
 		}
-
-		speed = (int)(Kp*err+Kd*(err-last_err)+Ki*err_sum);
-
-		
-		if (speed < 0) speed = -speed;
-		if (speed > SHIGH) speed = SHIGH;
-        else if (speed < SLOW1 && speed >= SLOW2) speed = SLOW1;
-
-        last_err = err;
-		err_sum += err;
-
-		writeToDevice(fd_motor, dir);
-		writeToDevice(fd_pwm, speed);
-
-		for (i = 0; i < FREQ; i++);
+		periodic_report(&task);
 	}
 }
 
 /** @brief creates two threads and run the client function
            and motor function concurrently
+    @param argc is the number of arguments
+    @param argv optionally holds the control and network loop rates in Hz
+           and the transport, "tcp" (default) or "udp", then "uring" to
+           run the motor loop and the udp loop on io_uring
 */
-int main() {
+int main(int argc, char **argv) {
 	pthread_t tid1, tid2;
 
-	pthread_create(&tid1, NULL, clientFun, NULL);
+	control_hz = periodic_parse_hz(argc > 1 ? argv[1] : NULL, CONTROL_HZ);
+	net_hz = periodic_parse_hz(argc > 2 ? argv[2] : NULL, NET_HZ);
+	use_uring = argc > 4 && strcmp(argv[4], "uring") == 0;
+
+	if (argc > 3 && strcmp(argv[3], "udp") == 0)
+		pthread_create(&tid1, NULL, clientUdpFun, NULL);
+	else
+		pthread_create(&tid1, NULL, clientFun, NULL);
 	pthread_create(&tid2, NULL, motorFun, NULL);
 
 	pthread_join(tid1, NULL);
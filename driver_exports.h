@@ -0,0 +1,61 @@
+/**
+ * @file   driver_exports.h
+ *
+ * @brief  functions the LKM drivers export to each other
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _DRIVER_EXPORTS_H_
+#define _DRIVER_EXPORTS_H_
+
+/** @brief define clockwise direction */
+#define MOTOR_CLOCKWISE     1
+/** @brief define counterclockwise direction */
+#define MOTOR_COUNTERCLOCK  2
+/** @brief define stopped, both H-bridge inputs low */
+#define MOTOR_STOP          0
+/** @brief define braking, both H-bridge inputs high; shorts the motor while
+           the pwm enable is high */
+#define MOTOR_BRAKE         3
+
+/** @brief wheel steps per revolution, 4x decoded */
+#define WHEEL_STEPS 2400
+
+/** @brief returns the absolute (unwrapped) step count of the wheel encoder,
+ *         safe to call from any context. Provided by encoder_driver.
+ */
+int wheel_encoder_get_count(void);
+
+/** @brief sets the pwm duty cycle in percent, safe to call from any
+ *         context. Provided by pwm_driver.
+ *  @param cycle the duty cycle, 0 to 100
+ */
+void pwm_set_duty(int cycle);
+
+struct pwm_motor_cmd;
+
+/** @brief sets the motor direction and the pwm period and high time in ns
+ *         together at the next period boundary, like PWM_IOC_MOTOR on the
+ *         first channel; safe to call from any context. Provided by
+ *         pwm_driver.
+ *  @param cmd is the command, see pwm_abi.h
+ *  @return 0 on success, -EINVAL if it is out of range, -EOPNOTSUPP if
+ *          pwm_driver cannot switch the direction
+ */
+int pwm_set_motor(const struct pwm_motor_cmd *cmd);
+
+/** @brief drives the H-bridge direction pins. Provided by motor_driver;
+ *         safe to call from any context only if motor_dir_mmio() is true.
+ *  @param dir MOTOR_STOP, MOTOR_CLOCKWISE, MOTOR_COUNTERCLOCK or MOTOR_BRAKE
+ */
+void motor_set_dir(int dir);
+
+/** @brief tells whether motor_set_dir writes the GPIO registers rather than
+ *         going through gpiolib. Provided by motor_driver.
+ *  @return true if motor_set_dir may be called from an hrtimer
+ */
+bool motor_dir_mmio(void);
+
+#endif /* _DRIVER_EXPORTS_H_ */
@@ -0,0 +1,161 @@
+/**
+ * @file   enc_bench.c
+ *
+ * @brief  throughput and latency of an encoder backend, the LKM driver or
+ *         the gpio lines
+ *
+ * The program sleeps in poll() on the encoder, drains everything queued on
+ * each wakeup and times the newest edge of the batch against the clock
+ * right after the read. That latency covers the interrupt, the wakeup, the
+ * scheduling of the program and the read itself. Run it once per backend
+ * on the same pins while the wheel spins or a signal generator drives them,
+ * e.g.
+ *
+ *   ./enc_bench /dev/wheel_encoder 10
+ *   ./enc_bench gpiochip0:6,7 10 2400 2000 200000
+ *
+ * The last two arguments set the glitch filter and the rate limit of the
+ * gpio lines; the driver takes them as module parameters. poll() also
+ * times out every tick like a control loop would, so the longest gap
+ * between two iterations shows whether noise on the lines starves the
+ * program.
+ *
+ * gpio_sim.sh drives it against gpio-sim on any Linux host.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <time.h>
+
+#include "encoder.h"
+
+/** @brief default run time in s */
+#define BENCH_SECONDS 10
+/** @brief longest sleep in poll(), in ms */
+#define BENCH_TICK_MS 10
+/** @brief most latency samples kept */
+#define MAX_SAMPLES 1000000
+
+/** @brief latency of each wakeup, in ns */
+static long long samples[MAX_SAMPLES];
+
+/** @brief returns the CLOCK_MONOTONIC time in ns
+    @return the time in ns
+*/
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+/** @brief orders two latency samples for qsort
+    @param a is the first sample
+    @param b is the second sample
+    @return <0, 0 or >0
+*/
+static int cmp_ll(const void *a, const void *b) {
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/** @brief reads the filter counters of an encoder, from the driver's state
+           page unless the encoder is gpio lines
+    @param enc is the open encoder
+    @param path is its device
+    @param rejected receives the edges rejected as too short
+    @param storms receives the number of storms
+*/
+static void read_filter(struct encoder *enc, const char *path, unsigned int *rejected,
+                        unsigned int *storms) {
+	struct encoder state;
+	struct enc_state snap;
+
+	*rejected = enc->filter.rejected;
+	*storms = enc->filter.storms;
+	if (enc->mode == ENC_MODE_GPIO) return;
+	if (encoder_open(&state, path, enc->counts, ENC_MODE_MMAP) < 0) return;
+	if (state.mode == ENC_MODE_MMAP) {
+		encoder_read_state(&state, &snap);
+		*rejected = snap.rejected;
+		*storms = snap.storms;
+	}
+	encoder_close(&state);
+}
+
+/** @brief drains the encoder on every wakeup for a while and prints the
+           statistics
+    @param argc is the number of arguments
+    @param argv holds the device or gpio lines, optionally the run time in
+           s, the counts per revolution, the minimum pulse width in ns and
+           the edge rate limit per s
+*/
+int main(int argc, char **argv) {
+	struct encoder enc;
+	struct pollfd pfd;
+	long long start, end, now, prev, stall = 0;
+	unsigned long before, wakeups = 0, n = 0;
+	unsigned int rejected, storms;
+	int seconds, counts, timeout;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <device|gpiochipN:A,B> [seconds] [counts] [min_pulse_ns] [max_rate]\n",
+		        argv[0]);
+		return 2;
+	}
+	seconds = argc > 2 ? atoi(argv[2]) : BENCH_SECONDS;
+	counts = argc > 3 ? atoi(argv[3]) : WHEEL_COUNTS;
+	if (encoder_open(&enc, argv[1], counts, ENC_MODE_BINARY) < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (enc.mode == ENC_MODE_TEXT) {
+		fprintf(stderr, "%s: no edge timestamps in text mode\n", argv[1]);
+		return 1;
+	}
+	if (argc > 4 && encoder_set_filter(&enc, atoll(argv[4]), argc > 5 ? atoi(argv[5]) : 0) < 0)
+		fprintf(stderr, "%s: the driver filters with its module parameters\n", argv[1]);
+	// wake on every edge, the gpio lines always do
+	encoder_set_wakeup(&enc, 1);
+
+	pfd.fd = enc.fd;
+	pfd.events = POLLIN;
+	start = prev = now_ns();
+	end = start+seconds*1000000000LL;
+	while ((now = now_ns()) < end) {
+		if (now-prev > stall) stall = now-prev;
+		prev = now;
+		timeout = (int)((end-now)/1000000)+1;
+		if (poll(&pfd, 1, timeout < BENCH_TICK_MS ? timeout : BENCH_TICK_MS) <= 0) {
+			// a storm turns the edges of the gpio lines off, they are then
+			// only sampled on reads; the driver's read() would block here
+			if (enc.mode == ENC_MODE_GPIO) encoder_read_degree(&enc);
+			continue;
+		}
+		before = enc.events;
+		encoder_read_degree(&enc);
+		now = now_ns();
+		if (enc.events == before) continue;
+		wakeups++;
+		if (n < MAX_SAMPLES) samples[n++] = now-enc.last_edge_ns;
+	}
+	now = now_ns();
+
+	printf("%s: %lu edges in %.2f s, %.0f edges/s, %.1f edges per read\n", argv[1], enc.events,
+	       (now-start)/1e9, enc.events/((now-start)/1e9), wakeups ? (double)enc.events/wakeups : 0.0);
+	if (n) {
+		qsort(samples, n, sizeof(samples[0]), cmp_ll);
+		printf("latency: min %.1f us, median %.1f us, p99 %.1f us, max %.1f us\n",
+		       samples[0]/1e3, samples[n/2]/1e3, samples[n*99/100]/1e3, samples[n-1]/1e3);
+	}
+	read_filter(&enc, argv[1], &rejected, &storms);
+	printf("longest iteration %.1f ms\n", stall/1e6);
+	printf("count %d invalid %lu rejected %u storms %u\n", enc.count, enc.invalid, rejected, storms);
+	encoder_close(&enc);
+	return 0;
+}
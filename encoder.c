@@ -0,0 +1,316 @@
+/**
+ * @file   encoder.c
+ *
+ * @brief  user side access to the encoder devices
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "encoder.h"
+
+/** @brief define read buffer length for text mode */
+#define readLen 64
+/** @brief number of events drained per read() in binary mode */
+#define EVENT_BATCH 64
+
+/** @brief requests the channel lines and reads their initial levels
+    @param enc is the encoder to set up
+    @param spec is the gpio lines of channel A and B
+    @return the line request fd, -1 on failure
+*/
+static int encoder_open_gpio(struct encoder *enc, const char *spec) {
+	uint64_t levels = 0;
+
+	enc->mode = ENC_MODE_GPIO;
+	// the kernel keeps a full ring of edges between two reads, like the
+	// driver's per-open ring
+	enc->fd = gpio_line_open(&enc->lines, spec, GPIO_LINE_EDGES, "encoder", ENC_RING_SIZE);
+	if (enc->fd < 0) return -1;
+	if (enc->lines.num != 2) {
+		gpio_line_close(&enc->lines);
+		errno = EINVAL;
+		return enc->fd = -1;
+	}
+	gpio_line_get(&enc->lines, &levels);
+	enc->quad_prev = enc->raw = quad_state(levels & 1, levels & 2);
+	return enc->fd;
+}
+
+int encoder_open(struct encoder *enc, const char *path, int counts, int mode) {
+	void *page;
+	int binary = ENC_MODE_BINARY;
+
+	memset(enc, 0, sizeof(*enc));
+	enc->counts = counts;
+	enc->lines.fd = -1;
+	if (gpio_is_spec(path)) return encoder_open_gpio(enc, path);
+
+	enc->mode = ENC_MODE_TEXT;
+	enc->fd = open(path, O_RDWR);
+	if (enc->fd < 0) return -1;
+
+	if (mode == ENC_MODE_MMAP) {
+		page = mmap(NULL, sizeof(struct enc_state), PROT_READ, MAP_SHARED, enc->fd, 0);
+		if (page != MAP_FAILED) {
+			enc->state = page;
+			enc->mode = ENC_MODE_MMAP;
+			return enc->fd;
+		}
+	}
+	if (mode != ENC_MODE_TEXT && ioctl(enc->fd, ENC_IOC_SET_MODE, &binary) == 0)
+		enc->mode = ENC_MODE_BINARY;
+	return enc->fd;
+}
+
+int encoder_set_wakeup(struct encoder *enc, unsigned int edges) {
+	if (enc->mode == ENC_MODE_GPIO) {
+		errno = ENOTTY;
+		return -1;
+	}
+	return ioctl(enc->fd, ENC_IOC_SET_WAKEUP, &edges);
+}
+
+int encoder_set_filter(struct encoder *enc, long long min_pulse_ns, unsigned int max_rate) {
+	if (enc->mode != ENC_MODE_GPIO) {
+		errno = ENOTTY;
+		return -1;
+	}
+	enc->min_pulse_ns = min_pulse_ns;
+	enc->max_rate = max_rate;
+	return 0;
+}
+
+void encoder_read_state(struct encoder *enc, struct enc_state *out) {
+	unsigned int seq;
+
+	do {
+		seq = __atomic_load_n(&enc->state->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) continue;
+		out->counts_per_rev = enc->state->counts_per_rev;
+		out->angle = enc->state->angle;
+		out->count = enc->state->count;
+		out->speed = enc->state->speed;
+		out->dir = enc->state->dir;
+		out->last_edge_ns = enc->state->last_edge_ns;
+		out->invalid = enc->state->invalid;
+		out->velocity = enc->state->velocity;
+		out->rejected = enc->state->rejected;
+		out->storms = enc->state->storms;
+		out->polling = enc->state->polling;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (seq & 1 || seq != enc->state->seq);
+	out->seq = seq;
+}
+
+/** @brief drains queued edge events and updates the cached position
+    @param enc is the encoder to drain
+*/
+static void encoder_drain(struct encoder *enc) {
+	struct enc_event events[EVENT_BATCH];
+	ssize_t n;
+	int i;
+
+	while ((n = read(enc->fd, events, sizeof(events))) > 0) {
+		n /= sizeof(struct enc_event);
+		for (i = 0; i < n; i++) {
+			enc->count = events[i].count;
+			if (events[i].channel != ENC_CHANNEL_SNAPSHOT) {
+				enc->last_edge_ns = events[i].timestamp_ns;
+				enc->events++;
+			}
+		}
+		if (n < EVENT_BATCH) break;
+	}
+}
+
+/** @brief returns the CLOCK_MONOTONIC time in ns
+    @return the time in ns
+*/
+static long long encoder_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+/** @brief decodes a new state of the gpio lines
+    @param enc is the encoder
+    @param state is the state of the lines, see quadrature.h
+    @param ts is the time of the change in ns
+*/
+static void encoder_step(struct encoder *enc, unsigned int state, long long ts) {
+	int step = quad_decode(&enc->quad_prev, state);
+
+	if (step == 0) return;
+	if (step == QUAD_INVALID) {
+		enc->invalid++;
+		return;
+	}
+	enc->count += step;
+	enc->last_edge_ns = ts;
+	enc->events++;
+	quad_vel_edge(&enc->vel, enc->count, step, ts);
+}
+
+/** @brief samples the levels of the gpio lines and decodes them
+    @param enc is the encoder
+    @param now is the current time in ns
+*/
+static void encoder_sample(struct encoder *enc, long long now) {
+	uint64_t levels;
+
+	if (gpio_line_get(&enc->lines, &levels) < 0) return;
+	enc->raw = quad_state(levels & 1, levels & 2);
+	encoder_step(enc, enc->raw, now);
+}
+
+/** @brief turns the edges off for a storm, the lines are sampled on each
+           read until QUAD_STORM_HOLD_NS later
+    @param enc is the encoder
+    @param now is the current time in ns
+*/
+static void encoder_storm_begin(struct encoder *enc, long long now) {
+	struct gpio_edge edges[EVENT_BATCH];
+
+	gpio_line_edges(&enc->lines, 0);
+	// the edges still queued are older than the levels sampled now
+	while (gpio_line_read(&enc->lines, edges, EVENT_BATCH) > 0);
+	enc->storm_ns = now;
+	encoder_sample(enc, now);
+}
+
+/** @brief samples the lines during a storm and turns the edges back on
+           after the hold time
+    @param enc is the encoder
+    @param now is the current time in ns
+*/
+static void encoder_poll_gpio(struct encoder *enc, long long now) {
+	encoder_sample(enc, now);
+	if (now-enc->storm_ns < QUAD_STORM_HOLD_NS || gpio_line_edges(&enc->lines, 1) < 0) return;
+	enc->storm_ns = 0;
+	enc->filter.window_edges = 0;
+	// a change between the sample and the switch made no edge
+	encoder_sample(enc, now);
+}
+
+/** @brief decodes the queued edges of the gpio lines, several per read(),
+           through the glitch filter and the rate limit
+    @param enc is the encoder to drain
+*/
+static void encoder_drain_gpio(struct encoder *enc) {
+	struct gpio_edge edges[EVENT_BATCH];
+	unsigned int bit, line;
+	uint64_t levels;
+	long long now;
+	int n, i;
+
+	if (enc->storm_ns) {
+		encoder_poll_gpio(enc, encoder_now());
+		return;
+	}
+	while ((n = gpio_line_read(&enc->lines, edges, EVENT_BATCH)) > 0) {
+		for (i = 0; i < n; i++) {
+			if (edges[i].lost) {
+				// the kernel dropped edges, the levels are the only truth left
+				enc->invalid += edges[i].lost;
+				if (gpio_line_get(&enc->lines, &levels) == 0)
+					enc->quad_prev = enc->raw = quad_state(levels & 1, levels & 2);
+			}
+			bit = edges[i].line == 0 ? 2 : 1;
+			enc->raw = edges[i].rising ? enc->raw | bit : enc->raw & ~bit;
+			if (quad_filter_storm(&enc->filter, edges[i].timestamp_ns, enc->max_rate)) {
+				encoder_storm_begin(enc, encoder_now());
+				return;
+			}
+			// the other channel may still be settling, decode this one alone
+			if (quad_filter_pulse(&enc->filter, edges[i].line, edges[i].timestamp_ns, enc->min_pulse_ns))
+				encoder_step(enc, (enc->quad_prev & ~bit) | (enc->raw & bit), edges[i].timestamp_ns);
+		}
+		if (n < EVENT_BATCH) break;
+	}
+
+	// pick up the levels of channels that went quiet after rejected edges
+	now = encoder_now();
+	for (line = 0; line < 2; line++) {
+		bit = line == 0 ? 2 : 1;
+		if (((enc->raw ^ enc->quad_prev) & bit) &&
+		    quad_filter_settled(&enc->filter, line, now, enc->min_pulse_ns))
+			encoder_step(enc, (enc->quad_prev & ~bit) | (enc->raw & bit), enc->filter.last_ns[line]);
+	}
+}
+
+/** @brief updates the velocity estimate from two consecutive reads
+    @param enc is the encoder
+    @param degree is the angle just read
+    @return degree, unchanged
+*/
+static int encoder_track(struct encoder *enc, int degree) {
+	long long now = encoder_now();
+	int delta;
+
+	if (enc->last_read_ns && now > enc->last_read_ns) {
+		delta = degree-enc->last_degree;
+		if (delta >= 180) delta -= 360;
+		else if (delta < -180) delta += 360;
+		enc->velocity = (int)(delta*1000000000LL/(now-enc->last_read_ns));
+	}
+	enc->last_degree = degree;
+	enc->last_read_ns = now;
+	return degree;
+}
+
+int encoder_read_degree(struct encoder *enc) {
+	char readString[readLen] = {0};
+	struct enc_state snap;
+	char *end, *rest;
+	int step, degree, velocity;
+
+	if (enc->mode == ENC_MODE_TEXT) {
+		read(enc->fd, readString, readLen);
+		degree = strtol(readString, &end, 10);
+		velocity = strtol(end, &rest, 10);
+		encoder_track(enc, degree);
+		// older drivers print the angle only
+		if (rest != end) enc->velocity = velocity;
+		return degree;
+	}
+
+	if (enc->mode == ENC_MODE_MMAP) {
+		encoder_read_state(enc, &snap);
+		enc->count = snap.count;
+		enc->last_edge_ns = snap.last_edge_ns;
+		enc->velocity = (long long)quad_vel_bound(snap.velocity, snap.last_edge_ns, encoder_now())*360/enc->counts;
+		return snap.angle*360/enc->counts;
+	}
+
+	if (enc->mode == ENC_MODE_GPIO) {
+		encoder_drain_gpio(enc);
+		enc->velocity = (long long)quad_vel_read(&enc->vel, encoder_now())*360/enc->counts;
+	} else {
+		encoder_drain(enc);
+	}
+	step = enc->count % enc->counts;
+	if (step < 0) step += enc->counts;
+	degree = step*360/enc->counts;
+	// gpio mode times the velocity from the edges
+	return enc->mode == ENC_MODE_GPIO ? degree : encoder_track(enc, degree);
+}
+
+void encoder_close(struct encoder *enc) {
+	if (enc->state) munmap((void *)enc->state, sizeof(struct enc_state));
+	enc->state = NULL;
+	if (enc->mode == ENC_MODE_GPIO) gpio_line_close(&enc->lines);
+	else close(enc->fd);
+	enc->fd = -1;
+}
@@ -0,0 +1,143 @@
+/**
+ * @file   encoder.h
+ *
+ * @brief  user side access to the encoder devices
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _ENCODER_H_
+#define _ENCODER_H_
+
+#include "encoder_abi.h"
+#include "gpio_line.h"
+#include "quadrature.h"
+
+/** @brief counts per revolution of the wheel encoder, 4x decoded */
+#define WHEEL_COUNTS 2400
+/** @brief counts per revolution of the rotary encoder, 4x decoded */
+#define ROT_COUNTS   96
+
+/** @brief shortest pulse of the wheel encoder in ns, the LKM driver default */
+#define WHEEL_MIN_PULSE_NS 2000
+/** @brief edge rate limit of the wheel encoder, the LKM driver default */
+#define WHEEL_MAX_RATE     200000
+/** @brief shortest pulse of the rotary encoder in ns, longer than its
+           contact bounce, the LKM driver default */
+#define ROT_MIN_PULSE_NS   500000
+/** @brief edge rate limit of the rotary encoder, the LKM driver default */
+#define ROT_MAX_RATE       20000
+
+/** @brief user side only: sample the state page mapped from the driver,
+           no syscall per read */
+#define ENC_MODE_MMAP 2
+/** @brief user side only: decode the edge events of the gpio lines, no
+           driver module needed, see gpio_line.h */
+#define ENC_MODE_GPIO 3
+
+/** @brief an open encoder device */
+struct encoder {
+	/** @brief file descriptor of the device */
+	int fd;
+	/** @brief ENC_MODE_TEXT, ENC_MODE_BINARY or ENC_MODE_MMAP */
+	int mode;
+	/** @brief counts per revolution */
+	int counts;
+	/** @brief latest absolute step count (not in text mode) */
+	int count;
+	/** @brief CLOCK_MONOTONIC time of the latest edge in ns (not in text mode) */
+	long long last_edge_ns;
+	/** @brief total number of edge events consumed */
+	unsigned long events;
+	/** @brief angle returned by the previous read, in degrees */
+	int last_degree;
+	/** @brief CLOCK_MONOTONIC time of the previous read in ns */
+	long long last_read_ns;
+	/** @brief velocity in degrees per second, timed from the edges where
+	           the driver reports it, otherwise between the last two reads */
+	int velocity;
+	/** @brief the driver's state page (mmap mode only) */
+	const volatile struct enc_state *state;
+	/** @brief channel A and B lines (gpio mode only) */
+	struct gpio_lines lines;
+	/** @brief decoder state of the lines (gpio mode only) */
+	unsigned int quad_prev;
+	/** @brief edges that skipped a state or were dropped by the kernel
+	           (gpio mode only) */
+	unsigned long invalid;
+	/** @brief velocity estimator fed with the edge timestamps (gpio mode
+	           only) */
+	struct quad_velocity vel;
+	/** @brief glitch filter and rate limiter of the edges (gpio mode only) */
+	struct quad_filter filter;
+	/** @brief shortest pulse accepted in ns, 0 for no filter (gpio mode
+	           only) */
+	long long min_pulse_ns;
+	/** @brief edges per second before the lines are polled, 0 for no
+	           limit (gpio mode only) */
+	unsigned int max_rate;
+	/** @brief levels of the lines after the latest edge, decoded or not
+	           (gpio mode only) */
+	unsigned int raw;
+	/** @brief time the current storm started in ns, 0 while the edges are
+	           on (gpio mode only) */
+	long long storm_ns;
+};
+
+/** @brief opens an encoder device
+ *
+ *  If the requested mode is not supported by the driver, the encoder falls
+ *  back from mmap to binary to text mode. A path naming gpio lines,
+ *  "gpiochipN:A,B", selects gpio mode whatever the requested mode; the fd
+ *  is then the line request, pollable like the device nodes.
+ *
+    @param enc is the encoder to set up
+    @param path is the device node or the gpio lines of channel A and B
+    @param counts is the number of counts per revolution
+    @param mode is ENC_MODE_TEXT, ENC_MODE_BINARY or ENC_MODE_MMAP
+    @return the file descriptor, -1 on failure
+*/
+int encoder_open(struct encoder *enc, const char *path, int counts, int mode);
+
+/** @brief reads the current angle of an encoder
+ *
+ *  In binary mode this drains every queued edge in one read() and keeps the
+ *  last known position when no edge happened.
+ *
+    @param enc is the encoder to read
+    @return the angle in degrees, 0 to 359
+*/
+int encoder_read_degree(struct encoder *enc);
+
+/** @brief makes read() and poll() wait for a number of new edges
+    @param enc is the encoder to configure, must be in text or binary mode
+    @param edges is the number of edges to wait for, 0 never blocks
+    @return 0 on success, -1 if the driver does not support it. In gpio
+            mode every edge wakes poll().
+*/
+int encoder_set_wakeup(struct encoder *enc, unsigned int edges);
+
+/** @brief sets the glitch filter and the rate limit of the gpio lines, see
+           quadrature.h. The LKM driver takes them as module parameters.
+    @param enc is the encoder to configure, must be in gpio mode
+    @param min_pulse_ns is the shortest pulse accepted in ns, 0 for no filter
+    @param max_rate is the edges per second above which the edges are
+           turned off and the lines polled on each read, 0 for no limit;
+           the rate window is sized from it, so any value holds exactly
+    @return 0 on success, -1 outside gpio mode
+*/
+int encoder_set_filter(struct encoder *enc, long long min_pulse_ns, unsigned int max_rate);
+
+/** @brief takes a consistent snapshot of the driver's state page
+    @param enc is the encoder to sample, must be in mmap mode
+    @param out receives the snapshot
+*/
+void encoder_read_state(struct encoder *enc, struct enc_state *out);
+
+/** @brief closes an encoder device
+    @param enc is the encoder to close
+*/
+void encoder_close(struct encoder *enc);
+
+#endif /* _ENCODER_H_ */
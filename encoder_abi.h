@@ -0,0 +1,94 @@
+/**
+ * @file   encoder_abi.h
+ *
+ * @brief  binary interface of the encoder devices, shared by the LKM
+ *         drivers and the user programs
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _ENCODER_ABI_H_
+#define _ENCODER_ABI_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/** @brief read() returns the angle in degrees and the velocity in degrees
+           per second as a decimal string, "angle velocity" */
+#define ENC_MODE_TEXT   0
+/** @brief read() drains struct enc_event records from the edge ring */
+#define ENC_MODE_BINARY 1
+
+/** @brief event came from channel A */
+#define ENC_CHANNEL_A        0
+/** @brief event came from channel B */
+#define ENC_CHANNEL_B        1
+/** @brief synthetic event carrying the current state, no edge happened */
+#define ENC_CHANNEL_SNAPSHOT 2
+
+/** @brief number of events held per open file, must be a power of 2 */
+#define ENC_RING_SIZE 256
+
+/** @brief one encoder edge as seen by the IRQ handler */
+struct enc_event {
+	/** @brief CLOCK_MONOTONIC time of the edge in ns */
+	__s64 timestamp_ns;
+	/** @brief absolute (unwrapped) step count after the edge, four steps
+	           per encoder line */
+	__s32 count;
+	/** @brief ENC_CHANNEL_A, ENC_CHANNEL_B or ENC_CHANNEL_SNAPSHOT */
+	__u8 channel;
+	/** @brief +1 for clockwise, -1 for counterclockwise, 0 if unknown */
+	__s8 dir;
+	/** @brief padding, always 0 */
+	__u16 reserved;
+};
+
+/** @brief encoder state published in the page exposed through mmap()
+ *
+ *  The driver bumps seq to an odd value before updating the other fields
+ *  and to the next even value afterwards. A reader copies the fields and
+ *  retries if seq was odd or changed meanwhile.
+ */
+struct enc_state {
+	/** @brief sequence counter, odd while an update is in progress */
+	__u32 seq;
+	/** @brief steps per revolution of this encoder */
+	__u32 counts_per_rev;
+	/** @brief step within the current revolution, 0 to counts_per_rev-1 */
+	__s32 angle;
+	/** @brief absolute (unwrapped) step count */
+	__s32 count;
+	/** @brief steps counted during the last speed interval */
+	__s32 speed;
+	/** @brief +1 for clockwise, -1 for counterclockwise, 0 if stopped */
+	__s32 dir;
+	/** @brief CLOCK_MONOTONIC time of the latest edge in ns */
+	__s64 last_edge_ns;
+	/** @brief transitions that skipped a state and were not counted */
+	__u32 invalid;
+	/** @brief edge-timed velocity in steps per second, positive
+	           clockwise; 0 once no edge came for a while. Readers bound it
+	           by one step per time since last_edge_ns, see quadrature.h */
+	__s32 velocity;
+	/** @brief edges rejected as shorter than the minimum pulse width */
+	__u32 rejected;
+	/** @brief times the edge rate limit was exceeded */
+	__u32 storms;
+	/** @brief 1 while a storm keeps the interrupts off and the levels are
+	           polled instead */
+	__u32 polling;
+};
+
+/** @brief ioctl magic number of the encoder devices */
+#define ENC_IOC_MAGIC 'e'
+/** @brief selects ENC_MODE_TEXT or ENC_MODE_BINARY for this open file */
+#define ENC_IOC_SET_MODE    _IOW(ENC_IOC_MAGIC, 1, int)
+/** @brief returns the number of events dropped because the ring was full */
+#define ENC_IOC_GET_DROPPED _IOR(ENC_IOC_MAGIC, 2, __u32)
+/** @brief number of new edges that make the file readable, 0 keeps read()
+           from ever blocking */
+#define ENC_IOC_SET_WAKEUP  _IOW(ENC_IOC_MAGIC, 3, __u32)
+
+#endif /* _ENCODER_ABI_H_ */
@@ -0,0 +1,875 @@
+/**
+ * @file   encoder_driver.c
+ *
+ * @brief  LKM driver for quadrature encoders, one device per encoder
+ *
+ * Every encoder is an instance described by the module parameters, all four
+ * arrays need the same length:
+ *
+ *   insmod encoder_driver.ko names=wheel_encoder,rot_encoder \
+ *          pins_a=6,17 pins_b=7,23 counts=2400,96
+ *
+ * The defaults are the wheel and the rotary knob of the board. Instance i
+ * appears as /dev/<names[i]> with minor number i. Each instance keeps its
+ * state in its own cache line aligned struct enc_dev, which is also the
+ * dev_id of its two interrupts, so encoders share neither a cache line nor
+ * a lock.
+ *
+ * Both edges of both channels interrupt and are decoded 4x through the
+ * table in quadrature.h. Transitions that skip a state are counted in the
+ * invalid field of the state page instead of moving the count. Velocity is
+ * estimated from the edge timestamps, see quadrature.h.
+ *
+ * Every instance filters its edges before decoding, see quadrature.h. An
+ * edge closer than min_pulse_ns to the previous one of its channel is
+ * rejected and the levels are sampled again once the channel has been
+ * quiet that long. More than max_rate edges per second is an interrupt
+ * storm: both interrupts are disabled and the poll timer samples the
+ * levels every poll_us until QUAD_STORM_HOLD_NS later, when the interrupts
+ * are tried again. A storm so costs at most one rate window of interrupts
+ * per hold time, and the pwm hrtimer and the control thread keep running.
+ * Rejected edges, storms and the polling state are in the state page. The
+ * optional arrays min_pulse_ns and max_rate may be shorter than names, 0
+ * turns the filter or the limit off:
+ *
+ *   insmod encoder_driver.ko min_pulse_ns=2000,500000 max_rate=200000,20000
+ *
+ * The IRQ handlers and the speed timer of an instance serialize on its
+ * lock. Readers never take it: every open file has its own context with its
+ * own event ring and read cursor, and takes its snapshots of the state page
+ * through the seqlock, so a controller, a logger and a network publisher
+ * can share an encoder without contending or seeing a torn read.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+#include <linux/init.h>   // Macros used to mark up functions e.g. __init __exit
+#include <linux/module.h> // Core header for loading LKMs into the kernel
+#include <linux/moduleparam.h>  // Required for the instance parameters
+#include <linux/device.h> // Header to support the kernel Driver Model
+#include <linux/kernel.h> // Contains types, macros, functions for the kernel
+#include <linux/fs.h>     // Header for the Linux file system support
+#include <asm/uaccess.h>  // Required for the copy to user function
+#include <linux/io.h>     // for iore/unmap()
+#include <linux/gpio.h>   // required for the gpio functions
+#include <linux/interrupt.h>    // Required for the IRQ code
+#include <linux/slab.h>         // Required for kzalloc/kfree
+#include <linux/list.h>         // Required for the list of open readers
+#include <linux/spinlock.h>     // Required for the instance and reader locks
+#include <linux/mutex.h>        // Required for the per-reader read lock
+#include <linux/atomic.h>       // Required for the lock-free reads
+#include <linux/cache.h>        // Required for the cache line alignment
+#include <linux/circ_buf.h>     // Required for the ring buffer macros
+#include <linux/ktime.h>        // Required for ktime
+#include <linux/hrtimer.h>      // Required for the speed timer
+#include <linux/mm.h>           // Required for mmap of the state page
+#include <linux/wait.h>         // Required for the reader wait queue
+#include <linux/poll.h>         // Required for poll
+
+#include "encoder_abi.h"
+#include "driver_exports.h"
+#include "quadrature.h"
+#include "motor_trace.h"
+
+/** @brief name of the driver, its class and its character device */
+#define NAME "encoder"
+/** @brief most encoders one module drives */
+#define ENC_MAX 8
+/** @brief timer interval, also how quickly a stop shows in the velocity */
+#define TIMER_INTERVAL 1e7
+/** @brief timer ticks per speed interval of one second */
+#define SPEED_TICKS 100
+/** @brief full round degree num */
+#define FULLROUND 360
+
+/** @brief Module info: license */
+MODULE_LICENSE("GPL");
+/** @brief Module info: author(s) */
+MODULE_AUTHOR("David Dong, Yanying Zhu");
+/** @brief Module info: description */
+MODULE_DESCRIPTION("Quadrature encoder driver for the RPi motor");
+/** @brief Module info: version */
+MODULE_VERSION("0.2");
+
+/** @brief device names, one per encoder */
+static char *names[ENC_MAX] = { "wheel_encoder", "rot_encoder" };
+/** @brief number of names given */
+static int nnames = 2;
+module_param_array(names, charp, &nnames, 0444);
+MODULE_PARM_DESC(names, "device names, one per encoder");
+
+/** @brief gpio pins of channel A */
+static int pins_a[ENC_MAX] = { 6, 17 };
+/** @brief number of channel A pins given */
+static int npins_a = 2;
+module_param_array(pins_a, int, &npins_a, 0444);
+MODULE_PARM_DESC(pins_a, "gpio pin of channel A, one per encoder");
+
+/** @brief gpio pins of channel B */
+static int pins_b[ENC_MAX] = { 7, 23 };
+/** @brief number of channel B pins given */
+static int npins_b = 2;
+module_param_array(pins_b, int, &npins_b, 0444);
+MODULE_PARM_DESC(pins_b, "gpio pin of channel B, one per encoder");
+
+/** @brief steps per revolution, 4x decoded */
+static int counts[ENC_MAX] = { WHEEL_STEPS, 96 };
+/** @brief number of step counts given */
+static int ncounts = 2;
+module_param_array(counts, int, &ncounts, 0444);
+MODULE_PARM_DESC(counts, "steps per revolution after 4x decoding, one per encoder");
+
+/** @brief shortest pulse accepted, in ns */
+static int min_pulse_ns[ENC_MAX] = { 2000, 500000 };
+/** @brief number of minimum pulse widths given */
+static int nmin_pulse_ns = 2;
+module_param_array(min_pulse_ns, int, &nmin_pulse_ns, 0444);
+MODULE_PARM_DESC(min_pulse_ns, "shortest pulse accepted in ns, one per encoder, 0 for no filter");
+
+/** @brief edge rate above which an encoder is polled, in edges per second */
+static int max_rate[ENC_MAX] = { 200000, 20000 };
+/** @brief number of rate limits given */
+static int nmax_rate = 2;
+module_param_array(max_rate, int, &nmax_rate, 0444);
+MODULE_PARM_DESC(max_rate, "edges per second before the encoder is polled, one per encoder, 0 for no limit");
+
+/** @brief interval of the level sampling during a storm, in us */
+static int poll_us = 100;
+module_param(poll_us, int, 0444);
+MODULE_PARM_DESC(poll_us, "interval the levels are sampled at during an interrupt storm in us");
+
+/** @brief one encoder */
+struct enc_dev {
+  /** @brief name of the device node */
+  const char *name;
+  /** @brief gpio pin of channel A */
+  int pin_a;
+  /** @brief gpio pin of channel B */
+  int pin_b;
+  /** @brief irq number of channel A */
+  int irq_a;
+  /** @brief irq number of channel B */
+  int irq_b;
+  /** @brief steps per revolution */
+  int counts;
+  /** @brief serializes the IRQ handlers and the timer of this encoder */
+  spinlock_t lock;
+  /** @brief last decoded channel state, see quadrature.h */
+  unsigned int quad_prev;
+  /** @brief transitions that skipped a state */
+  u32 invalid;
+  /** @brief +1 clockwise, -1 counterclockwise, 0 stopped */
+  int dir;
+  /** @brief steps within the current speed interval */
+  int steps;
+  /** @brief steps counted during the last speed interval */
+  int speed;
+  /** @brief timer ticks since speed was last updated */
+  int ticks;
+  /** @brief edge-timed velocity estimator */
+  struct quad_velocity vel;
+  /** @brief glitch filter and rate limiter */
+  struct quad_filter filter;
+  /** @brief shortest pulse accepted in ns, 0 for no filter */
+  s64 min_pulse_ns;
+  /** @brief edges per second before a storm, 0 for no limit */
+  u32 max_rate;
+  /** @brief true while a storm keeps the interrupts disabled */
+  bool polling;
+  /** @brief time the current storm started in ns */
+  s64 storm_ns;
+  /** @brief absolute step count, read without the lock */
+  atomic_t count;
+  /** @brief total number of edges since load, used to detect movement */
+  atomic_t edges;
+  /** @brief page shared read-only with user space through mmap */
+  struct enc_state *state;
+  /** @brief readers sleeping in read() or poll() wait here for an edge */
+  wait_queue_head_t wait;
+  /** @brief all open readers */
+  struct list_head readers;
+  /** @brief protects the readers list against the IRQ handlers */
+  spinlock_t readers_lock;
+  /** @brief speed and staleness timer */
+  struct hrtimer timer;
+  /** @brief samples the levels once after rejected edges, or periodically
+   *  during a storm */
+  struct hrtimer poll;
+} ____cacheline_aligned_in_smp;
+
+/** @brief per-open state, holds the edge ring of one reader
+ *
+ *  The IRQ handlers are the only producer (they own head, serialized by
+ *  readers_lock) and read() is the only consumer (it owns tail), so the
+ *  ring itself needs no lock.
+ */
+struct enc_reader {
+  /** @brief entry in the list of open readers of the encoder */
+  struct list_head list;
+  /** @brief the encoder */
+  struct enc_dev *enc;
+  /** @brief ENC_MODE_TEXT or ENC_MODE_BINARY */
+  int mode;
+  /** @brief write index, advanced by the IRQ handler */
+  unsigned int head;
+  /** @brief read index, advanced by read() */
+  unsigned int tail;
+  /** @brief events dropped because the ring was full */
+  u32 dropped;
+  /** @brief value of edges at the last read */
+  unsigned int seen;
+  /** @brief new edges needed before a blocking read returns, 0 never blocks */
+  unsigned int wakeup;
+  /** @brief serializes concurrent read() calls on the same file */
+  struct mutex read_lock;
+  /** @brief the edge ring */
+  struct enc_event ring[ENC_RING_SIZE];
+};
+
+/** @brief the encoders */
+static struct enc_dev encs[ENC_MAX];
+/** @brief number of encoders set up */
+static int nencs;
+/** @brief major number of the device */
+static int majorNumber;
+/** @brief the device driver class struct pointer */
+static struct class* class = NULL;
+
+// ****************************************************************************
+// Encoder state
+// ****************************************************************************
+
+/** @brief returns the step within the current revolution
+ *  @param enc the encoder
+ *  @param count an absolute step count
+ *  @return the step, 0 to counts-1
+ */
+static int enc_angle(struct enc_dev *enc, int count){
+  int angle = count % enc->counts;
+
+  return angle < 0 ? angle + enc->counts : angle;
+}
+
+/** @brief publishes the current encoder state to the mmap page. Called
+ *  with enc->lock held.
+ *  @param enc the encoder
+ *  @param edge_ns time of the latest edge, 0 to keep the previous one
+ */
+static void enc_state_publish(struct enc_dev *enc, s64 edge_ns){
+  struct enc_state *state = enc->state;
+  int count = atomic_read(&enc->count);
+  s32 velocity = quad_vel_read(&enc->vel, ktime_get_ns());
+
+  WRITE_ONCE(state->seq, state->seq + 1);
+  smp_wmb();
+  state->angle = enc_angle(enc, count);
+  state->count = count;
+  state->speed = enc->speed;
+  state->dir = enc->dir;
+  state->invalid = enc->invalid;
+  state->velocity = velocity;
+  state->rejected = enc->filter.rejected;
+  state->storms = enc->filter.storms;
+  state->polling = enc->polling;
+  if (edge_ns) state->last_edge_ns = edge_ns;
+  smp_wmb();
+  WRITE_ONCE(state->seq, state->seq + 1);
+}
+
+/** @brief takes a consistent snapshot of the state page without the lock,
+ *  retrying while an update is in progress
+ *  @param enc the encoder
+ *  @param snap receives the snapshot
+ */
+static void enc_state_read(struct enc_dev *enc, struct enc_state *snap){
+  const struct enc_state *state = enc->state;
+  u32 seq;
+
+  do {
+    seq = smp_load_acquire(&state->seq);
+    if (seq & 1) {
+      cpu_relax();
+      continue;
+    }
+    *snap = *state;
+    smp_rmb();
+  } while ((seq & 1) || READ_ONCE(state->seq) != seq);
+}
+
+/** @brief returns the absolute step count of the first encoder, the wheel,
+ *  exported for the in-kernel controller
+ *  @return the absolute step count
+ */
+int wheel_encoder_get_count(void){
+  return atomic_read(&encs[0].count);
+}
+EXPORT_SYMBOL(wheel_encoder_get_count);
+
+// ****************************************************************************
+// Edge rings of the binary readers
+// ****************************************************************************
+
+/** @brief pushes one event into a reader's ring, dropping it if the ring is full.
+ *  Must be called with readers_lock held so there is a single producer.
+ *  @param reader the reader to push to
+ *  @param ev the event to push
+ */
+static void enc_ring_push(struct enc_reader *reader, const struct enc_event *ev){
+  unsigned int head = reader->head;
+  unsigned int tail = smp_load_acquire(&reader->tail);
+
+  if (CIRC_SPACE(head, tail, ENC_RING_SIZE) == 0) {
+    reader->dropped++;
+    return;
+  }
+  reader->ring[head] = *ev;
+  smp_store_release(&reader->head, (head + 1) & (ENC_RING_SIZE - 1));
+}
+
+/** @brief copies queued events of a binary-mode reader to user space
+ *  @param reader the reader to drain
+ *  @param buffer the user buffer
+ *  @param len the length of the user buffer
+ *  @return number of bytes copied, -EAGAIN if no event is queued
+ */
+static ssize_t enc_ring_read(struct enc_reader *reader, char __user *buffer, size_t len){
+  unsigned int head, tail, n, chunk;
+  size_t want = len / sizeof(struct enc_event);
+  size_t copied = 0;
+
+  if (want == 0) return -EINVAL;
+
+  mutex_lock(&reader->read_lock);
+  head = smp_load_acquire(&reader->head);
+  tail = reader->tail;
+  n = CIRC_CNT(head, tail, ENC_RING_SIZE);
+  if (n > want) n = want;
+  while (n > 0) {
+    // copy the contiguous run up to the end of the ring in one go
+    chunk = CIRC_CNT_TO_END(head, tail, ENC_RING_SIZE);
+    if (chunk > n) chunk = n;
+    if (copy_to_user(buffer + copied, &reader->ring[tail],
+                     chunk * sizeof(struct enc_event))) {
+      mutex_unlock(&reader->read_lock);
+      return copied ? copied : -EFAULT;
+    }
+    copied += chunk * sizeof(struct enc_event);
+    tail = (tail + chunk) & (ENC_RING_SIZE - 1);
+    smp_store_release(&reader->tail, tail);
+    n -= chunk;
+  }
+  mutex_unlock(&reader->read_lock);
+
+  return copied ? copied : -EAGAIN;
+}
+
+/** @brief pushes an event to every binary-mode reader of an encoder
+ *  @param enc the encoder
+ *  @param channel the channel the event came from
+ *  @param direction +1, -1 or 0
+ *  @param count the absolute step count after the event
+ *  @param now_ns time of the event
+ */
+static void enc_publish(struct enc_dev *enc, u8 channel, s8 direction, int count, s64 now_ns){
+  struct enc_reader *reader;
+  struct enc_event ev;
+  unsigned long flags;
+
+  ev.timestamp_ns = now_ns;
+  ev.count = count;
+  ev.channel = channel;
+  ev.dir = direction;
+  ev.reserved = 0;
+
+  spin_lock_irqsave(&enc->readers_lock, flags);
+  list_for_each_entry(reader, &enc->readers, list) {
+    if (reader->mode == ENC_MODE_BINARY) enc_ring_push(reader, &ev);
+  }
+  spin_unlock_irqrestore(&enc->readers_lock, flags);
+}
+
+// ****************************************************************************
+// Interrupt and timer
+// ****************************************************************************
+
+/** @brief decodes the current levels of both channels. Called with
+ *  enc->lock held.
+ *  @param enc the encoder
+ *  @param now_ns time of the change
+ *  @param count receives the absolute step count after a step
+ *  @return +1 or -1 for a step, 0 if there was none
+ */
+static int enc_decode(struct enc_dev *enc, s64 now_ns, int *count){
+  int step = quad_decode(&enc->quad_prev, quad_state(gpio_get_value(enc->pin_a), gpio_get_value(enc->pin_b)));
+
+  if (step == QUAD_INVALID) {
+    enc->invalid++;
+    step = 0;
+  }
+  // a bounce that ends on the old state is not a step
+  if (step == 0) {
+    enc_state_publish(enc, 0);
+    return 0;
+  }
+  enc->dir = step;
+  enc->steps++;
+  *count = atomic_add_return(step, &enc->count);
+  quad_vel_edge(&enc->vel, *count, step, now_ns);
+  enc_state_publish(enc, now_ns);
+  return step;
+}
+
+/** @brief hands a decoded step to the readers. Called without enc->lock.
+ *  @param enc the encoder
+ *  @param channel the channel the step came from
+ *  @param step +1 or -1
+ *  @param count the absolute step count after the step
+ *  @param now_ns time of the step
+ */
+static void enc_notify(struct enc_dev *enc, u8 channel, int step, int count, s64 now_ns){
+  trace_motor_enc_edge(enc->name, count, step);
+  enc_publish(enc, channel, step, count, now_ns);
+  atomic_inc(&enc->edges);
+  wake_up_interruptible(&enc->wait);
+}
+
+/** @brief turns the interrupts of an encoder off and polls its levels
+ *  instead. Called with enc->lock held.
+ *  @param enc the encoder
+ *  @param now_ns time of the edge that exceeded the rate limit
+ */
+static void enc_storm_begin(struct enc_dev *enc, s64 now_ns){
+  disable_irq_nosync(enc->irq_a);
+  disable_irq_nosync(enc->irq_b);
+  enc->polling = true;
+  enc->storm_ns = now_ns;
+  hrtimer_start(&enc->poll, ns_to_ktime((s64)poll_us * NSEC_PER_USEC), HRTIMER_MODE_REL);
+  enc_state_publish(enc, 0);
+}
+
+/** @brief The GPIO IRQ Handler function that happens on an edge of either channel.
+ *  @param irq    the IRQ number, tells channel A and B apart
+ *  @param dev_id the struct enc_dev of the encoder
+ *  @return IRQ_HANDLED
+ */
+static irqreturn_t enc_irq_handler(int irq, void *dev_id){
+  struct enc_dev *enc = dev_id;
+  u8 channel = irq == enc->irq_b ? ENC_CHANNEL_B : ENC_CHANNEL_A;
+  s64 now = ktime_get_ns();
+  int step, count;
+
+  spin_lock(&enc->lock);
+  // the other channel may still fire once while a storm disables both
+  if (enc->polling) {
+    spin_unlock(&enc->lock);
+    return IRQ_HANDLED;
+  }
+  if (quad_filter_storm(&enc->filter, now, enc->max_rate)) {
+    enc_storm_begin(enc, now);
+    spin_unlock(&enc->lock);
+    return IRQ_HANDLED;
+  }
+  if (!quad_filter_pulse(&enc->filter, channel, now, enc->min_pulse_ns)) {
+    // decode whatever level the channel settles on
+    hrtimer_start(&enc->poll, ns_to_ktime(enc->min_pulse_ns), HRTIMER_MODE_REL);
+    enc_state_publish(enc, 0);
+    spin_unlock(&enc->lock);
+    return IRQ_HANDLED;
+  }
+  step = enc_decode(enc, now, &count);
+  spin_unlock(&enc->lock);
+
+  if (step) enc_notify(enc, channel, step, count, now);
+  return IRQ_HANDLED;
+}
+
+/** @brief the poll timer callback, samples the levels once the channels
+ *  settled after rejected edges, and every poll_us during a storm until the
+ *  hold time is over
+ *  @param timer is the poll timer of one encoder
+ *  @return HRTIMER_RESTART while the storm lasts, HRTIMER_NORESTART otherwise
+ */
+static enum hrtimer_restart enc_poll_callback(struct hrtimer *timer){
+  struct enc_dev *enc = container_of(timer, struct enc_dev, poll);
+  s64 now = ktime_get_ns();
+  unsigned int prev;
+  bool polling, resume;
+  unsigned long flags;
+  int step, count;
+  u8 channel;
+
+  spin_lock_irqsave(&enc->lock, flags);
+  polling = enc->polling;
+  prev = enc->quad_prev;
+  step = enc_decode(enc, now, &count);
+  channel = (prev ^ enc->quad_prev) & 2 ? ENC_CHANNEL_A : ENC_CHANNEL_B;
+  resume = polling && now - enc->storm_ns >= QUAD_STORM_HOLD_NS;
+  if (resume) {
+    enc->polling = false;
+    enc->filter.window_edges = 0;
+    enc_state_publish(enc, 0);
+  }
+  spin_unlock_irqrestore(&enc->lock, flags);
+
+  if (step) enc_notify(enc, channel, step, count, now);
+  if (resume) {
+    enable_irq(enc->irq_a);
+    enable_irq(enc->irq_b);
+  }
+  if (!polling || resume) return HRTIMER_NORESTART;
+  hrtimer_forward_now(timer, ns_to_ktime((s64)poll_us * NSEC_PER_USEC));
+  return HRTIMER_RESTART;
+}
+
+/** @brief the hr timer callback, updates the speed once per second and
+ *  the staleness of the velocity every tick
+ *  @param timer is the timer of one encoder
+ *  @return HRTIMER_RESTART
+ */
+static enum hrtimer_restart enc_timer_callback(struct hrtimer *timer){
+  struct enc_dev *enc = container_of(timer, struct enc_dev, timer);
+  unsigned long flags;
+
+  // the arguments are evaluated before the static key, keep ktime_get()
+  // off the tick while the event is disabled
+  if (trace_motor_timer_fire_enabled())
+    trace_motor_timer_fire(enc->name, ktime_to_ns(ktime_sub(ktime_get(), hrtimer_get_expires(timer))));
+  spin_lock_irqsave(&enc->lock, flags);
+  if (++enc->ticks == SPEED_TICKS) {
+    enc->speed = enc->steps;
+    enc->steps = 0;
+    enc->ticks = 0;
+  }
+  // the direction is only known while the encoder moves
+  if (quad_vel_stalled(&enc->vel, ktime_get_ns())) enc->dir = 0;
+  enc_state_publish(enc, 0);
+  spin_unlock_irqrestore(&enc->lock, flags);
+
+  hrtimer_forward_now(timer, ktime_set(0, TIMER_INTERVAL));
+  return HRTIMER_RESTART;
+}
+
+// ****************************************************************************
+// Module interface functions
+// ****************************************************************************
+
+/** @brief The device open function that is called each time the device is opened
+ *  @param inodep A pointer to an inode object (defined in linux/fs.h)
+ *  @param filep A pointer to a file object (defined in linux/fs.h)
+ *  @return 0 on success, negative errno otherwise
+ */
+static int my_driver_open(struct inode *inodep, struct file *filep){
+  struct enc_reader *reader;
+  struct enc_dev *enc;
+  unsigned long flags;
+
+  if (iminor(inodep) >= nencs) return -ENODEV;
+  enc = &encs[iminor(inodep)];
+
+  reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+  if (!reader) return -ENOMEM;
+  reader->enc = enc;
+  reader->mode = ENC_MODE_TEXT;
+  mutex_init(&reader->read_lock);
+  filep->private_data = reader;
+
+  spin_lock_irqsave(&enc->readers_lock, flags);
+  list_add_tail(&reader->list, &enc->readers);
+  spin_unlock_irqrestore(&enc->readers_lock, flags);
+  return 0;
+}
+
+/** @brief The device release function that is called whenever the device is closed/released by
+ *  the userspace program
+ *  @param inodep A pointer to an inode object (defined in linux/fs.h)
+ *  @param filep A pointer to a file object (defined in linux/fs.h)
+ *  @return 0
+ */
+static int my_driver_release(struct inode *inodep, struct file *filep){
+  struct enc_reader *reader = filep->private_data;
+  struct enc_dev *enc = reader->enc;
+  unsigned long flags;
+
+  spin_lock_irqsave(&enc->readers_lock, flags);
+  list_del(&reader->list);
+  spin_unlock_irqrestore(&enc->readers_lock, flags);
+  kfree(reader);
+  return 0;
+}
+
+/** @brief maps the state page of the encoder read-only into user space
+ *  @param filep A pointer to a file object (defined in linux/fs.h)
+ *  @param vma the user mapping, must be a single read-only page
+ *  @return 0 on success, negative errno otherwise
+ */
+static int my_driver_mmap(struct file *filep, struct vm_area_struct *vma){
+  struct enc_reader *reader = filep->private_data;
+
+  if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_SIZE) return -EINVAL;
+  if (vma->vm_flags & VM_WRITE) return -EPERM;
+  vma->vm_flags &= ~VM_MAYWRITE;
+  return remap_pfn_range(vma, vma->vm_start, virt_to_phys(reader->enc->state) >> PAGE_SHIFT,
+                         PAGE_SIZE, vma->vm_page_prot);
+}
+
+/** @brief checks whether a reader has something new to read
+ *  @param reader the reader to check
+ *  @return true once enough edges arrived since its last read
+ */
+static bool enc_ready(struct enc_reader *reader){
+  unsigned int need = reader->wakeup ? reader->wakeup : 1;
+
+  if (reader->mode == ENC_MODE_BINARY)
+    return CIRC_CNT(smp_load_acquire(&reader->head), reader->tail, ENC_RING_SIZE) >= need;
+  return (unsigned int)atomic_read(&reader->enc->edges) - reader->seen >= need;
+}
+
+/** @brief reports the file readable once the encoder moved
+ *  @param filep A pointer to a file object (defined in linux/fs.h)
+ *  @param wait the poll table to register the wait queue with
+ *  @return POLLIN | POLLRDNORM when readable, 0 otherwise
+ */
+static unsigned int my_driver_poll(struct file *filep, poll_table *wait){
+  struct enc_reader *reader = filep->private_data;
+
+  poll_wait(filep, &reader->enc->wait, wait);
+  return enc_ready(reader) ? POLLIN | POLLRDNORM : 0;
+}
+
+/** @brief handles the encoder ioctls, see encoder_abi.h
+ *  @param filep A pointer to a file object (defined in linux/fs.h)
+ *  @param cmd the ioctl command
+ *  @param arg the ioctl argument
+ *  @return 0 on success, negative errno otherwise
+ */
+static long my_driver_ioctl(struct file *filep, unsigned int cmd, unsigned long arg){
+  struct enc_reader *reader = filep->private_data;
+  struct enc_dev *enc = reader->enc;
+  unsigned long flags;
+  int mode;
+
+  switch (cmd) {
+    case ENC_IOC_SET_MODE:
+      if (copy_from_user(&mode, (int __user *)arg, sizeof(mode))) return -EFAULT;
+      if (mode != ENC_MODE_TEXT && mode != ENC_MODE_BINARY) return -EINVAL;
+      spin_lock_irqsave(&enc->readers_lock, flags);
+      reader->mode = mode;
+      spin_unlock_irqrestore(&enc->readers_lock, flags);
+      // give the new binary reader a starting point before the first edge
+      if (mode == ENC_MODE_BINARY)
+        enc_publish(enc, ENC_CHANNEL_SNAPSHOT, 0, atomic_read(&enc->count), ktime_get_ns());
+      return 0;
+    case ENC_IOC_GET_DROPPED:
+      return put_user(reader->dropped, (u32 __user *)arg);
+    case ENC_IOC_SET_WAKEUP:
+      return get_user(reader->wakeup, (u32 __user *)arg);
+  }
+  return -ENOTTY;
+}
+
+/** @brief This function is called whenever device is being read from user space i.e. data is
+ *  being sent from the device to the user.
+ *  @param filep A pointer to a file object (defined in linux/fs.h)
+ *  @param buffer The pointer to the buffer to which this function writes the data
+ *  @param len The length of the b
+ *  @param offset The offset if required
+ *  @return 0 in text mode, the number of bytes copied in binary mode
+ */
+static ssize_t my_driver_read(struct file *filep, char __user *buffer, size_t len, loff_t *offset){
+  struct enc_reader *reader = filep->private_data;
+  struct enc_dev *enc = reader->enc;
+  struct enc_state snap;
+  char output[64] = {0};
+  int degree, velocity;
+
+  // block only if the reader asked for it, keeping the old polling behaviour by default
+  if (reader->wakeup && !(filep->f_flags & O_NONBLOCK)) {
+    if (wait_event_interruptible(enc->wait, enc_ready(reader))) return -ERESTARTSYS;
+  }
+  reader->seen = atomic_read(&enc->edges);
+
+  // angle and velocity from the same update
+  enc_state_read(enc, &snap);
+  degree = snap.angle * FULLROUND / enc->counts;
+  velocity = quad_vel_bound(snap.velocity, snap.last_edge_ns, ktime_get_ns()) * FULLROUND / enc->counts;
+  trace_motor_enc_read(enc->name, degree, velocity);
+  if (reader->mode == ENC_MODE_BINARY) return enc_ring_read(reader, buffer, len);
+
+  snprintf(output, sizeof(output), "%d %d", degree, velocity);
+  if (copy_to_user(buffer, output, min(len, sizeof(output)))) return -EFAULT;
+  return 0;
+}
+
+/** @brief Devices are represented as file structure in the kernel.
+*/
+static struct file_operations fops =
+{
+  .open = my_driver_open,
+  .read = my_driver_read,
+  .unlocked_ioctl = my_driver_ioctl,
+  .mmap = my_driver_mmap,
+  .poll = my_driver_poll,
+  .release = my_driver_release,
+};
+
+// ****************************************************************************
+// Instance setup
+// ****************************************************************************
+
+/** @brief stops the poll timer and turns the interrupts back on if a storm
+ *  left them disabled. An edge may arm the timer again until the interrupts
+ *  are freed, so teardown cancels it once more after free_irq.
+ *  @param enc the encoder
+ */
+static void enc_poll_stop(struct enc_dev *enc){
+  hrtimer_cancel(&enc->poll);
+  if (enc->polling) {
+    enc->polling = false;
+    enable_irq(enc->irq_a);
+    enable_irq(enc->irq_b);
+  }
+}
+
+/** @brief sets up one encoder from the module parameters
+ *  @param enc the encoder
+ *  @param i the index of the encoder, also its minor number
+ *  @return 0 on success, negative errno otherwise
+ */
+static int enc_setup(struct enc_dev *enc, int i){
+  struct device *device;
+  int result;
+
+  if (counts[i] <= 0) return -EINVAL;
+  enc->name = names[i];
+  enc->pin_a = pins_a[i];
+  enc->pin_b = pins_b[i];
+  enc->counts = counts[i];
+  enc->min_pulse_ns = max(min_pulse_ns[i], 0);
+  spin_lock_init(&enc->lock);
+  spin_lock_init(&enc->readers_lock);
+  INIT_LIST_HEAD(&enc->readers);
+  init_waitqueue_head(&enc->wait);
+
+  enc->state = (struct enc_state *)get_zeroed_page(GFP_KERNEL);
+  if (!enc->state) return -ENOMEM;
+  enc->state->counts_per_rev = enc->counts;
+
+  result = gpio_request(enc->pin_a, enc->name);
+  if (result) goto fail_page;
+  result = gpio_request(enc->pin_b, enc->name);
+  if (result) goto fail_pin_a;
+  gpio_direction_input(enc->pin_a);
+  gpio_direction_input(enc->pin_b);
+  hrtimer_init(&enc->poll, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  enc->poll.function = enc_poll_callback;
+  enc->quad_prev = quad_state(gpio_get_value(enc->pin_a), gpio_get_value(enc->pin_b));
+
+  enc->irq_a = gpio_to_irq(enc->pin_a);
+  enc->irq_b = gpio_to_irq(enc->pin_b);
+  result = request_irq(enc->irq_a, enc_irq_handler, IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+                       enc->name, enc);
+  if (result) goto fail_pin_b;
+  result = request_irq(enc->irq_b, enc_irq_handler, IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+                       enc->name, enc);
+  if (result) goto fail_irq_a;
+  // a storm disables both interrupts, so the limit only applies once both exist
+  WRITE_ONCE(enc->max_rate, max(max_rate[i], 0));
+
+  hrtimer_init(&enc->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  enc->timer.function = enc_timer_callback;
+  hrtimer_start(&enc->timer, ktime_set(0, TIMER_INTERVAL), HRTIMER_MODE_REL);
+
+  device = device_create(class, NULL, MKDEV(majorNumber, i), NULL, "%s", enc->name);
+  if (IS_ERR(device)) {
+    result = PTR_ERR(device);
+    goto fail_timer;
+  }
+  return 0;
+
+fail_timer:
+  hrtimer_cancel(&enc->timer);
+  enc_poll_stop(enc);
+  free_irq(enc->irq_b, enc);
+fail_irq_a:
+  free_irq(enc->irq_a, enc);
+  // an edge before free_irq may have re-armed it
+  hrtimer_cancel(&enc->poll);
+fail_pin_b:
+  gpio_free(enc->pin_b);
+fail_pin_a:
+  gpio_free(enc->pin_a);
+fail_page:
+  free_page((unsigned long)enc->state);
+  return result;
+}
+
+/** @brief releases everything enc_setup acquired
+ *  @param enc the encoder
+ *  @param i the index of the encoder
+ */
+static void enc_teardown(struct enc_dev *enc, int i){
+  device_destroy(class, MKDEV(majorNumber, i));
+  hrtimer_cancel(&enc->timer);
+  enc_poll_stop(enc);
+  free_irq(enc->irq_b, enc);
+  free_irq(enc->irq_a, enc);
+  // a pulse rejected or a storm begun before free_irq re-arms the poll
+  hrtimer_cancel(&enc->poll);
+  gpio_free(enc->pin_b);
+  gpio_free(enc->pin_a);
+  free_page((unsigned long)enc->state);
+}
+
+/** @brief Called when the module is loaded with insmod
+ *  @return 0 on success, negative errno otherwise
+ */
+static int __init encoder_driver_init(void) {
+  int result = 0;
+
+  if (nnames == 0 || npins_a != nnames || npins_b != nnames || ncounts != nnames) {
+    printk(KERN_ERR "encoder: names, pins_a, pins_b and counts need the same length\n");
+    return -EINVAL;
+  }
+  if (poll_us <= 0) return -EINVAL;
+
+  majorNumber = register_chrdev(0, NAME, &fops);
+  if (majorNumber < 0) return majorNumber;
+  class = class_create(THIS_MODULE, NAME);
+  if (IS_ERR(class)) {
+    unregister_chrdev(majorNumber, NAME);
+    return PTR_ERR(class);
+  }
+
+  for (nencs = 0; nencs < nnames; nencs++) {
+    result = enc_setup(&encs[nencs], nencs);
+    if (result) break;
+  }
+  if (result) {
+    printk(KERN_ERR "encoder: setting up %s failed: %d\n", names[nencs], result);
+    while (nencs > 0) {
+      nencs--;
+      enc_teardown(&encs[nencs], nencs);
+    }
+    class_destroy(class);
+    unregister_chrdev(majorNumber, NAME);
+    return result;
+  }
+
+  printk(KERN_INFO "encoder: %d encoders, device number is %d\n", nencs, majorNumber);
+  return 0;
+}
+
+/** @brief Called when the module is unloaded with rmmod */
+static void __exit encoder_driver_exit(void) {
+  int i;
+
+  for (i = nencs - 1; i >= 0; i--) enc_teardown(&encs[i], i);
+  class_destroy(class);
+  unregister_chrdev(majorNumber, NAME);
+}
+
+/** @brief Registering the module init function with the kernel */
+module_init(encoder_driver_init);
+
+/** @brief Registering the module exit function with the kernel */
+module_exit(encoder_driver_exit);
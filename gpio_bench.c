@@ -0,0 +1,169 @@
+/**
+ * @file   gpio_bench.c
+ *
+ * @brief  LKM benchmark of the two backends of gpio_fast.h
+ *
+ * On load the module toggles one free output pin with each backend and
+ * prints to the kernel log
+ *   - the CPU cost of one pin write, timed over many writes with
+ *     interrupts off
+ *   - the toggle latency, from the start of a write until the new level
+ *     reads back from GPLEV0
+ * and stays loaded until rmmod. Nothing may be wired to the pin.
+ *
+ *   insmod gpio_bench.ko pin=16 loops=100000
+ *   dmesg | grep gpio_bench
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+#include <linux/init.h>   // Macros used to mark up functions e.g. __init __exit
+#include <linux/module.h> // Core header for loading LKMs into the kernel
+#include <linux/moduleparam.h>  // Required for the parameters
+#include <linux/kernel.h> // Contains types, macros, functions for the kernel
+#include <linux/gpio.h>   // required for the gpio functions
+#include <linux/irqflags.h>     // Required to time with interrupts off
+#include <linux/ktime.h>        // Required for ktime
+#include <linux/math64.h>       // Required for 64 bit division on 32 bit ARM
+#include <linux/sched.h>        // Required for cond_resched
+
+#include "gpio_fast.h"
+
+/** @brief writes timed with interrupts off in one go */
+#define BENCH_CHUNK 1000
+/** @brief number of toggles whose latency is measured */
+#define BENCH_TOGGLES 1000
+/** @brief reads of the level before a toggle counts as lost */
+#define BENCH_SPIN 100000
+
+/** @brief Module info: license */
+MODULE_LICENSE("GPL");
+/** @brief Module info: author(s) */
+MODULE_AUTHOR("David Dong, Yanying Zhu");
+/** @brief Module info: description */
+MODULE_DESCRIPTION("Compares the register and gpiolib pin backends");
+/** @brief Module info: version */
+MODULE_VERSION("0.1");
+
+/** @brief the pin toggled */
+static int pin = 16;
+module_param(pin, int, 0444);
+MODULE_PARM_DESC(pin, "free gpio to toggle, 0 to 31");
+
+/** @brief number of writes timed per backend */
+static int loops = 100000;
+module_param(loops, int, 0444);
+MODULE_PARM_DESC(loops, "pin writes timed per backend");
+
+/** @brief reads the pin level back from the registers */
+static struct gpio_fast level;
+
+/** @brief times pin writes with interrupts off
+ *  @param g the backend
+ *  @return the mean cost of one write in ns
+ */
+static u64 bench_cost(struct gpio_fast *g){
+  unsigned long flags;
+  u64 total = 0, start;
+  int done, i;
+
+  for (done = 0; done < loops; done += BENCH_CHUNK) {
+    local_irq_save(flags);
+    start = ktime_get_ns();
+    for (i = 0; i < BENCH_CHUNK; i += 2) {
+      gpio_fast_set(g, pin, true);
+      gpio_fast_set(g, pin, false);
+    }
+    total += ktime_get_ns() - start;
+    local_irq_restore(flags);
+    cond_resched();
+  }
+  return div_u64(total, done);
+}
+
+/** @brief times toggles until the level reads back
+ *  @param g the backend
+ *  @param max receives the worst latency in ns
+ *  @return the mean latency in ns
+ */
+static u64 bench_latency(struct gpio_fast *g, u64 *max){
+  unsigned long flags;
+  u64 total = 0, start, t;
+  bool value = false;
+  int i, spin;
+
+  *max = 0;
+  for (i = 0; i < BENCH_TOGGLES; i++) {
+    value = !value;
+    local_irq_save(flags);
+    start = ktime_get_ns();
+    gpio_fast_set(g, pin, value);
+    for (spin = 0; spin < BENCH_SPIN && gpio_fast_get(&level, pin) != value; spin++);
+    t = ktime_get_ns() - start;
+    local_irq_restore(flags);
+    total += t;
+    if (t > *max) *max = t;
+  }
+  return div_u64(total, BENCH_TOGGLES);
+}
+
+/** @brief runs the benchmark of one backend and prints the result
+ *  @param name the backend name
+ *  @param mmio true for the register backend
+ */
+static void bench_run(const char *name, bool mmio){
+  struct gpio_fast g;
+  u64 cost, latency, max;
+
+  if (gpio_fast_init(&g, mmio)) {
+    printk(KERN_WARNING "gpio_bench: %s: cannot map the GPIO registers\n", name);
+    return;
+  }
+  cost = bench_cost(&g);
+  latency = bench_latency(&g, &max);
+  gpio_fast_set(&g, pin, false);
+  gpio_fast_exit(&g);
+  printk(KERN_INFO "gpio_bench: %s: %llu ns per write, toggle visible after %llu ns (max %llu ns)\n",
+         name, cost, latency, max);
+}
+
+/** @brief Called when the module is loaded with insmod
+ *  @return 0 on success, negative errno otherwise
+ */
+static int __init gpio_bench_init(void) {
+  int result;
+
+  if (pin < 0 || pin > 31 || loops < BENCH_CHUNK) return -EINVAL;
+  result = gpio_request(pin, "gpio_bench");
+  if (result) return result;
+  gpio_direction_output(pin, false);
+
+  // the level is always read from the registers, so both backends are
+  // timed against the same reference
+  result = gpio_fast_init(&level, true);
+  if (result) {
+    gpio_free(pin);
+    return result;
+  }
+  bench_run("mmio", true);
+  bench_run("gpiolib", false);
+  return 0;
+}
+
+/** @brief Called when the module is unloaded with rmmod */
+static void __exit gpio_bench_exit(void) {
+  gpio_fast_exit(&level);
+  gpio_free(pin);
+}
+
+/** @brief Registering the module init function with the kernel
+ *
+ *  gpio_bench_init: The function that holds the module's init routine
+ */
+module_init(gpio_bench_init);
+
+/** @brief Registering the module exit function with the kernel
+ *
+ *  gpio_bench_exit: The function that holds the module's exit routine
+ */
+module_exit(gpio_bench_exit);
@@ -0,0 +1,142 @@
+/**
+ * @file   gpio_fast.h
+ *
+ * @brief  pin access shared by the LKM drivers, either straight through the
+ *         GPIO registers of the BCM2835 family or through gpiolib
+ *
+ * The register backend sets or clears any number of pins of a bank with a
+ * single store to GPSETn or GPCLRn, so pins that belong together, like the
+ * two H-bridge inputs or all pwm channels due at the same instant, change
+ * together, and no per-pin gpiolib call sits on the edge path. The pins are
+ * still requested and made outputs through gpiolib, so they show up as in
+ * use. The gpiolib backend works with any gpio chip, gpio-sim included, and
+ * writes the pins one by one.
+ *
+ * Each driver keeps its own struct gpio_fast and picks the backend with its
+ * gpio_mmio module parameter. Pins are given as 64 bit masks, bit n for
+ * gpio n.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _GPIO_FAST_H_
+#define _GPIO_FAST_H_
+
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/io.h>     // for iore/unmap()
+#include <linux/gpio.h>   // required for the gpiolib backend
+
+/** @brief base of MMIO (physical address) on the pi */
+#define MMIO_BASE_PHYSICAL 0x3F000000
+/** @brief base of GPIO in memory mapped IO on pi */
+#define GPIO_BASE (MMIO_BASE_PHYSICAL + 0x200000)
+/** @brief size of the GPIO register block */
+#define GPIO_MAP_SIZE 0xB4
+/** @brief GPIO Pin Output Set 0 */
+#define GPIO_REG_GPSET0 7
+/** @brief GPIO Pin Output Set 1 */
+#define GPIO_REG_GPSET1 8
+/** @brief GPIO Pin Output Clear 0 */
+#define GPIO_REG_GPCLR0 10
+/** @brief GPIO Pin Output Clear 1 */
+#define GPIO_REG_GPCLR1 11
+/** @brief GPIO Pin Level 0 */
+#define GPIO_REG_GPLEV0 13
+/** @brief GPIO Pin Level 1 */
+#define GPIO_REG_GPLEV1 14
+/** @brief GPIO Function Select INPUT */
+#define GPIO_FUN_INPUT 0
+/** @brief GPIO Function Select OUTPUT */
+#define GPIO_FUN_OUTPUT 1
+
+/** @brief pin access of one driver */
+struct gpio_fast {
+  /** @brief the GPIO registers, NULL for the gpiolib backend */
+  u32 __iomem *regs;
+};
+
+/** @brief selects the backend and maps the registers if needed
+ *  @param g the pin access to set up
+ *  @param mmio true for the register backend, false for gpiolib
+ *  @return 0 on success, -ENOMEM if the registers could not be mapped
+ */
+static inline int gpio_fast_init(struct gpio_fast *g, bool mmio) {
+  g->regs = mmio ? ioremap(GPIO_BASE, GPIO_MAP_SIZE) : NULL;
+  return mmio && !g->regs ? -ENOMEM : 0;
+}
+
+/** @brief unmaps the registers
+ *  @param g the pin access
+ */
+static inline void gpio_fast_exit(struct gpio_fast *g) {
+  if (g->regs) iounmap(g->regs);
+  g->regs = NULL;
+}
+
+/** @brief configures a pin for a given functionality.
+ *
+ *  See BCM2835 peripherals pg 102 - 103 for various alternate
+ *  functions of GPIO pins. The gpiolib backend knows input and output only.
+ *
+ *  @param g the pin access
+ *  @param pin the pin number to configure (0 to 53 on pi)
+ *  @param fun the function type (see defines)
+ */
+static inline void gpio_fast_config(struct gpio_fast *g, unsigned int pin, unsigned int fun) {
+  // get the offset into MM GPIO
+  unsigned int reg = pin / 10;
+  // get the bit offset into the GPIO_REG_GPFSEL register
+  unsigned int offset = (pin % 10) * 3;
+  u32 config;
+
+  if (!g->regs) {
+    if (fun == GPIO_FUN_OUTPUT) gpio_direction_output(pin, false);
+    else gpio_direction_input(pin);
+    return;
+  }
+  config = readl(g->regs + reg);
+  config &= ~(0x7 << offset);
+  config |= (fun << offset);
+  writel(config, g->regs + reg);
+}
+
+/** @brief drives several pins at once. With the register backend this is at
+ *  most one store per bank to clear and one to set, clears first.
+ *  @param g the pin access
+ *  @param set the pins to drive high
+ *  @param clr the pins to drive low
+ */
+static inline void gpio_fast_write(struct gpio_fast *g, u64 set, u64 clr) {
+  if (g->regs) {
+    if ((u32)clr) writel_relaxed((u32)clr, g->regs + GPIO_REG_GPCLR0);
+    if (clr >> 32) writel_relaxed(clr >> 32, g->regs + GPIO_REG_GPCLR1);
+    if ((u32)set) writel_relaxed((u32)set, g->regs + GPIO_REG_GPSET0);
+    if (set >> 32) writel_relaxed(set >> 32, g->regs + GPIO_REG_GPSET1);
+    return;
+  }
+  for (; clr; clr &= clr - 1) gpio_set_value(__ffs64(clr), 0);
+  for (; set; set &= set - 1) gpio_set_value(__ffs64(set), 1);
+}
+
+/** @brief drives one pin
+ *  @param g the pin access
+ *  @param pin the pin number (0 to 53 on pi)
+ *  @param value the level
+ */
+static inline void gpio_fast_set(struct gpio_fast *g, unsigned int pin, bool value) {
+  gpio_fast_write(g, value ? BIT_ULL(pin) : 0, value ? 0 : BIT_ULL(pin));
+}
+
+/** @brief reads the level of one pin
+ *  @param g the pin access
+ *  @param pin the pin number (0 to 53 on pi)
+ *  @return the level
+ */
+static inline bool gpio_fast_get(struct gpio_fast *g, unsigned int pin) {
+  if (!g->regs) return gpio_get_value(pin);
+  return readl_relaxed(g->regs + (pin > 31 ? GPIO_REG_GPLEV1 : GPIO_REG_GPLEV0)) & BIT(pin % 32);
+}
+
+#endif /* _GPIO_FAST_H_ */
@@ -0,0 +1,181 @@
+/**
+ * @file   gpio_line.c
+ *
+ * @brief  user side access to gpio lines through the gpio character device
+ *         (line API v2)
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "gpio_line.h"
+
+/** @brief most edges read per read() call */
+#define EDGE_BATCH 64
+
+const char *gpio_device(const char *var, const char *dflt) {
+	const char *path = getenv(var);
+
+	return path && *path ? path : dflt;
+}
+
+int gpio_is_spec(const char *path) {
+	if (strncmp(path, "/dev/", 5) == 0) path += 5;
+	return strncmp(path, "gpiochip", 8) == 0 && strchr(path, ':') != NULL;
+}
+
+void gpio_line_close(struct gpio_lines *lines) {
+	if (lines->fd >= 0) close(lines->fd);
+	lines->fd = -1;
+}
+
+/* toolchains whose kernel headers predate line API v2 (Linux 5.10) build
+   without the backend, every request then fails with ENOSYS */
+#ifdef GPIO_V2_GET_LINE_IOCTL
+
+/** @brief splits a spec into the chip device and the line offsets
+    @param lines receives the line offsets
+    @param spec is the spec
+    @param chip receives the chip device
+    @param len is the size of chip
+    @return 0 on success, -1 if the spec is malformed
+*/
+static int gpio_parse(struct gpio_lines *lines, const char *spec, char *chip, size_t len) {
+	const char *colon;
+	char *end;
+
+	if (strncmp(spec, "/dev/", 5) == 0) spec += 5;
+	colon = strchr(spec, ':');
+	if (colon == NULL || (size_t)snprintf(chip, len, "/dev/%.*s", (int)(colon-spec), spec) >= len)
+		return -1;
+	lines->num = 0;
+	do {
+		lines->offsets[lines->num++] = strtoul(colon+1, &end, 10);
+		if (end == colon+1) return -1;
+		colon = end;
+	} while (lines->num < GPIO_LINE_MAX && *colon == ',');
+	return *colon ? -1 : 0;
+}
+
+int gpio_line_open(struct gpio_lines *lines, const char *spec, int how, const char *consumer,
+                   unsigned int buffered) {
+	struct gpio_v2_line_request req;
+	char chip[64];
+	unsigned int i;
+	int fd, rc;
+
+	memset(lines, 0, sizeof(*lines));
+	lines->fd = -1;
+	if (gpio_parse(lines, spec, chip, sizeof(chip)) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	for (i = 0; i < lines->num; i++)
+		req.offsets[i] = lines->offsets[i];
+	req.num_lines = lines->num;
+	req.event_buffer_size = buffered;
+	strncpy(req.consumer, consumer, sizeof(req.consumer)-1);
+	if (how == GPIO_LINE_OUTPUT)
+		req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	else
+		req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING |
+		                   GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+	fd = open(chip, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+	rc = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	close(fd);
+	if (rc < 0) return -1;
+	if (how == GPIO_LINE_EDGES)
+		fcntl(req.fd, F_SETFL, O_NONBLOCK);
+	lines->fd = req.fd;
+	return lines->fd;
+}
+
+int gpio_line_get(struct gpio_lines *lines, uint64_t *bits) {
+	struct gpio_v2_line_values values = { 0, (1ULL << lines->num)-1 };
+
+	if (ioctl(lines->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) return -1;
+	*bits = values.bits;
+	return 0;
+}
+
+int gpio_line_set(struct gpio_lines *lines, uint64_t mask, uint64_t bits) {
+	struct gpio_v2_line_values values = { bits, mask };
+
+	return ioctl(lines->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+int gpio_line_read(struct gpio_lines *lines, struct gpio_edge *edges, int max) {
+	struct gpio_v2_line_event events[EDGE_BATCH];
+	ssize_t n;
+	int i;
+
+	if (max > EDGE_BATCH) max = EDGE_BATCH;
+	n = read(lines->fd, events, max*sizeof(events[0]));
+	if (n < 0) return errno == EAGAIN ? 0 : -1;
+
+	n /= sizeof(events[0]);
+	for (i = 0; i < n; i++) {
+		edges[i].timestamp_ns = events[i].timestamp_ns;
+		edges[i].line = 0;
+		while (edges[i].line < lines->num-1 && lines->offsets[edges[i].line] != events[i].offset)
+			edges[i].line++;
+		edges[i].rising = events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+		// seqno counts the events of the whole request
+		edges[i].lost = lines->seqno ? events[i].seqno-lines->seqno-1 : 0;
+		lines->seqno = events[i].seqno;
+	}
+	return n;
+}
+
+int gpio_line_edges(struct gpio_lines *lines, int on) {
+	struct gpio_v2_line_config config;
+
+	memset(&config, 0, sizeof(config));
+	config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	if (on) config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	return ioctl(lines->fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config);
+}
+
+#else
+
+int gpio_line_open(struct gpio_lines *lines, const char *spec, int how, const char *consumer,
+                   unsigned int buffered) {
+	lines->fd = -1;
+	errno = ENOSYS;
+	return -1;
+}
+
+int gpio_line_get(struct gpio_lines *lines, uint64_t *bits) {
+	errno = ENOSYS;
+	return -1;
+}
+
+int gpio_line_set(struct gpio_lines *lines, uint64_t mask, uint64_t bits) {
+	errno = ENOSYS;
+	return -1;
+}
+
+int gpio_line_read(struct gpio_lines *lines, struct gpio_edge *edges, int max) {
+	errno = ENOSYS;
+	return -1;
+}
+
+int gpio_line_edges(struct gpio_lines *lines, int on) {
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif /* GPIO_V2_GET_LINE_IOCTL */
@@ -0,0 +1,123 @@
+/**
+ * @file   gpio_line.h
+ *
+ * @brief  user side access to gpio lines through the gpio character device
+ *         (line API v2), the backend that needs no kernel module
+ *
+ * A set of lines is named by a spec "gpiochipN:A,B,...", the chip under /dev
+ * and its line offsets, on the Pi the BCM pin numbers of gpiochip0. The
+ * programs pick a backend per device from the environment:
+ *
+ *   WHEEL_ENCODER=gpiochip0:6,7  ROT_ENCODER=gpiochip0:17,23
+ *   MOTOR_DIR=gpiochip0:21,20    MOTOR_PWM=/sys/class/pwm/pwmchip0/pwm0
+ *
+ * Unset variables keep the /dev nodes of the LKM drivers. Edge events are
+ * timestamped with CLOCK_MONOTONIC by the kernel in the interrupt handler,
+ * not when the program reads them, so batching many events per read() does
+ * not blur the velocity.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _GPIO_LINE_H_
+#define _GPIO_LINE_H_
+
+#include <stdint.h>
+
+/** @brief most lines in one spec */
+#define GPIO_LINE_MAX 8
+
+/** @brief request the lines as inputs reporting both edges */
+#define GPIO_LINE_EDGES  0
+/** @brief request the lines as outputs, initially low */
+#define GPIO_LINE_OUTPUT 1
+
+/** @brief a set of requested lines */
+struct gpio_lines {
+	/** @brief the line request, -1 if none */
+	int fd;
+	/** @brief number of lines */
+	unsigned int num;
+	/** @brief chip offsets of the lines, in spec order */
+	unsigned int offsets[GPIO_LINE_MAX];
+	/** @brief sequence number of the last edge read, 0 before the first */
+	uint32_t seqno;
+};
+
+/** @brief one edge of a requested input line */
+struct gpio_edge {
+	/** @brief CLOCK_MONOTONIC time of the edge in ns */
+	int64_t timestamp_ns;
+	/** @brief index of the line in the spec */
+	unsigned int line;
+	/** @brief 1 for a rising edge, 0 for a falling one */
+	int rising;
+	/** @brief events the kernel dropped right before this one because the
+	           program did not read them in time */
+	unsigned int lost;
+};
+
+/** @brief returns the device picked by an environment variable
+    @param var is the variable, e.g. WHEEL_ENCODER
+    @param dflt is the device used if the variable is unset
+    @return the value of var, or dflt
+*/
+const char *gpio_device(const char *var, const char *dflt);
+
+/** @brief tells whether a device names gpio lines rather than a device node
+    @param path is the device
+    @return 1 for a "gpiochipN:A,B" spec, 0 otherwise
+*/
+int gpio_is_spec(const char *path);
+
+/** @brief requests the lines of a spec
+    @param lines is the set to set up
+    @param spec is "gpiochipN:A,B,..." or "/dev/gpiochipN:A,B,..."
+    @param how is GPIO_LINE_EDGES or GPIO_LINE_OUTPUT
+    @param consumer is the label shown by gpioinfo
+    @param buffered is the number of edges the kernel holds for read(), 0
+           for its default
+    @return the line request fd, -1 on failure. Edge requests are
+            non-blocking and pollable.
+*/
+int gpio_line_open(struct gpio_lines *lines, const char *spec, int how, const char *consumer,
+                   unsigned int buffered);
+
+/** @brief reads the levels of all lines
+    @param lines is the set to read
+    @param bits receives the level of line i in bit i
+    @return 0 on success, -1 on failure
+*/
+int gpio_line_get(struct gpio_lines *lines, uint64_t *bits);
+
+/** @brief sets several output lines in one ioctl, so they change together
+    @param lines is the set to write
+    @param mask selects the lines to set, bit i is line i of the spec
+    @param bits holds the new levels
+    @return 0 on success, -1 on failure
+*/
+int gpio_line_set(struct gpio_lines *lines, uint64_t mask, uint64_t bits);
+
+/** @brief drains queued edges with one read()
+    @param lines is a set requested with GPIO_LINE_EDGES
+    @param edges receives the edges, oldest first
+    @param max is the size of edges
+    @return the number of edges, 0 if none is queued, -1 on failure
+*/
+int gpio_line_read(struct gpio_lines *lines, struct gpio_edge *edges, int max);
+
+/** @brief turns the edge detection of input lines on or off, without it
+           the lines interrupt nothing and are only sampled
+    @param lines is a set requested with GPIO_LINE_EDGES
+    @param on is 1 to report both edges again, 0 to stop
+    @return 0 on success, -1 on failure
+*/
+int gpio_line_edges(struct gpio_lines *lines, int on);
+
+/** @brief releases the lines
+    @param lines is the set to release
+*/
+void gpio_line_close(struct gpio_lines *lines);
+
+#endif /* _GPIO_LINE_H_ */
@@ -0,0 +1,76 @@
+#! /bin/bash
+# Runs enc_bench on the lines of a gpio-sim chip, so the gpio backend of the
+# encoders is tested on any Linux host without the Pi or the LKM drivers.
+# The lines are stepped clockwise through the quadrature sequence and the
+# count must come out at four steps per cycle.
+#
+# A second run filters the lines and toggles channel A as fast as the shell
+# can between slow steps. The noise must trip the rate limit, cost no step
+# (edges the kernel drops under it show as invalid and are resynced),
+# and never keep enc_bench from running for longer than MAX_STALL_MS.
+#
+# Needs root, configfs and a kernel with CONFIG_GPIO_SIM.
+#   sudo ./gpio_sim.sh [enc_bench binary] [cycles] [noise toggles]
+#
+# Author: David Dong haochend@andrew.cmu.edu
+#         Yanying Zhu yanyingz@andrew.cmu.edu
+set -e
+BENCH=${1:-./enc_bench}
+CYCLES=${2:-250}
+NOISE=${3:-20000}
+# slow steps around the noise, far below the rate limit
+SLOW_CYCLES=10
+MIN_PULSE_NS=100000
+MAX_RATE=5000
+MAX_STALL_MS=50
+CFG=/sys/kernel/config/gpio-sim/encoder
+
+modprobe gpio-sim
+mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+mkdir $CFG $CFG/bank0
+trap 'echo 0 > $CFG/live; rmdir $CFG/bank0 $CFG' EXIT
+echo 2 > $CFG/bank0/num_lines
+echo 1 > $CFG/live
+
+chip=$(cat $CFG/bank0/chip_name)
+sim=/sys/devices/platform/$(cat $CFG/dev_name)/$chip
+# a pull on an input line of gpio-sim is an edge on that line
+pull() { echo pull-$2 > $sim/sim_gpio$1/pull; }
+pull 0 down
+pull 1 down
+
+# A is line 0: 00 -> 10 -> 11 -> 01 -> 00
+cycle() {
+	pull 0 up; sleep $1
+	pull 1 up; sleep $1
+	pull 0 down; sleep $1
+	pull 1 down; sleep $1
+}
+
+$BENCH $chip:0,1 3 > gpio_sim.out &
+sleep 0.5
+for ((i = 0; i < CYCLES; i++)); do cycle 0; done
+wait $!
+
+cat gpio_sim.out
+grep -q "^count $((CYCLES*4)) invalid 0 " gpio_sim.out
+echo "gpio-sim: $((CYCLES*4)) steps decoded"
+
+$BENCH $chip:0,1 8 2400 $MIN_PULSE_NS $MAX_RATE > gpio_sim.out &
+sleep 0.5
+for ((i = 0; i < SLOW_CYCLES; i++)); do cycle 0.005; done
+# a burst of pulses far shorter than the minimum, ending on the old level
+for ((i = 0; i < NOISE; i++)); do
+	pull 0 up
+	pull 0 down
+done
+# past the storm hold time, so the edges are back on
+sleep 0.5
+for ((i = 0; i < SLOW_CYCLES; i++)); do cycle 0.005; done
+wait $!
+
+cat gpio_sim.out
+grep -q "^count $((SLOW_CYCLES*8)) invalid [0-9]* rejected [1-9][0-9]* storms [1-9]" gpio_sim.out
+stall=$(sed -n 's/^longest iteration \([0-9]*\).*/\1/p' gpio_sim.out)
+[ "$stall" -lt $MAX_STALL_MS ]
+echo "gpio-sim: $((NOISE*2)) noise edges filtered, longest iteration ${stall} ms"
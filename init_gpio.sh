@@ -0,0 +1,10 @@
+#! /bin/bash
+echo "Running init script"
+echo "raspberry" | sudo -S su
+sleep 0.1
+# no driver modules: the encoders and the H-bridge pins are gpio lines and
+# the duty comes from the hardware pwm on gpio 12 (dtoverlay=pwm,pin=12,func=4)
+sudo WHEEL_ENCODER=gpiochip0:6,7 ROT_ENCODER=gpiochip0:17,23 \
+     MOTOR_DIR=gpiochip0:21,20 MOTOR_PWM=/sys/class/pwm/pwmchip0/pwm0 ./pid
+echo "PID controller Running"
+exit 0
\ No newline at end of file
@@ -0,0 +1,11 @@
+#! /bin/bash
+echo "Running init script"
+echo "raspberry" | sudo -S su
+sleep 0.1
+sudo insmod /home/pi/motor_driver.ko
+sudo insmod /home/pi/encoder_driver.ko
+sudo insmod /home/pi/pwm_driver.ko
+sudo insmod /home/pi/pid_driver.ko
+sudo ./pid 100 kernel
+echo "kernel PID controller Running"
+exit 0
@@ -0,0 +1,75 @@
+/**
+ * @file   mailbox.h
+ *
+ * @brief  lock-free latest-value mailbox between one writer thread and any
+ *         number of reader threads
+ *
+ * The writer never waits and a reader always gets the newest complete value,
+ * older values are simply overwritten. The value is guarded by a sequence
+ * counter the same way the encoder state page is: odd while a write is in
+ * progress, readers retry if it changed under them. Every word is accessed
+ * with an atomic builtin so the mailbox is clean under ThreadSanitizer.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/** @brief largest value a mailbox holds, in 32 bit words */
+#define MAILBOX_WORDS 8
+
+/** @brief one mailbox, zero-initialise before use */
+struct mailbox {
+	/** @brief sequence counter, odd while the writer is updating */
+	uint32_t seq;
+	/** @brief the value */
+	uint32_t data[MAILBOX_WORDS];
+};
+
+/** @brief publishes a new value, must only be called from one thread
+    @param mb is the mailbox
+    @param src is the value
+    @param len is the size of the value, at most MAILBOX_WORDS*4 bytes
+*/
+static inline void mailbox_put(struct mailbox *mb, const void *src, size_t len) {
+	uint32_t words[MAILBOX_WORDS] = {0};
+	uint32_t seq = __atomic_load_n(&mb->seq, __ATOMIC_RELAXED);
+	size_t i;
+
+	memcpy(words, src, len);
+	__atomic_store_n(&mb->seq, seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (i = 0; i < (len+3)/4; i++)
+		__atomic_store_n(&mb->data[i], words[i], __ATOMIC_RELAXED);
+	__atomic_store_n(&mb->seq, seq+2, __ATOMIC_RELEASE);
+}
+
+/** @brief reads the newest value
+    @param mb is the mailbox
+    @param dst receives the value
+    @param len is the size of the value
+    @return the version of the value, 0 if nothing was published yet
+*/
+static inline uint32_t mailbox_get(const struct mailbox *mb, void *dst, size_t len) {
+	uint32_t words[MAILBOX_WORDS];
+	uint32_t seq;
+	size_t i;
+
+	do {
+		while ((seq = __atomic_load_n(&mb->seq, __ATOMIC_ACQUIRE)) & 1)
+			;
+		for (i = 0; i < (len+3)/4; i++)
+			words[i] = __atomic_load_n(&mb->data[i], __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&mb->seq, __ATOMIC_RELAXED) != seq);
+
+	memcpy(dst, words, len);
+	return seq/2;
+}
+
+#endif /* _MAILBOX_H_ */
@@ -0,0 +1,164 @@
+/**
+ * @file   motor.c
+ *
+ * @brief  user side access to the motor through the LKM drivers or through
+ *         gpio lines and a sysfs pwm channel
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "motor.h"
+#include "pid.h"
+#include "pwm_abi.h"
+
+/** @brief define write buffer length */
+#define writeLen 12
+
+/** @brief writes a number as text, the way the LKM drivers take it
+    @param fd is the file descripture of the target device
+    @param num is the number to write
+*/
+static void writeToDevice(int fd, long num) {
+	char writeString[writeLen];
+	int len = snprintf(writeString, writeLen, "%ld", num);
+
+	write(fd, writeString, len+1);
+}
+
+/** @brief sets the duty of a sysfs pwm channel
+    @param fd is the open duty_cycle file
+    @param duty_ns is the high time in ns
+*/
+static void sysfs_duty(int fd, uint32_t duty_ns) {
+	char value[writeLen];
+	int len = snprintf(value, sizeof(value), "%u", duty_ns);
+
+	pwrite(fd, value, len, 0);
+}
+
+/** @brief writes a number to an attribute of a sysfs pwm channel
+    @param dir is the channel directory
+    @param attr is the attribute
+    @param num is the value
+    @return 0 on success, -1 on failure
+*/
+static int sysfs_write(const char *dir, const char *attr, long num) {
+	char path[128], value[writeLen];
+	int fd, len, rc;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fd = open(path, O_WRONLY);
+	if (fd < 0) return -1;
+	len = snprintf(value, sizeof(value), "%ld", num);
+	rc = write(fd, value, len) == len ? 0 : -1;
+	close(fd);
+	return rc;
+}
+
+/** @brief exports, configures and enables a sysfs pwm channel
+    @param dir is the channel directory, .../pwmchipN/pwmM
+    @param period_ns is the period in ns
+    @return the open duty_cycle file, -1 on failure
+*/
+static int sysfs_pwm_open(const char *dir, uint32_t period_ns) {
+	char chip[128], path[160];
+	const char *name = strrchr(dir, '/');
+
+	if (access(dir, F_OK) != 0 && name && strncmp(name, "/pwm", 4) == 0) {
+		snprintf(chip, sizeof(chip), "%.*s", (int)(name-dir), dir);
+		sysfs_write(chip, "export", strtol(name+4, NULL, 10));
+	}
+	// the duty may not exceed the period at any time
+	sysfs_write(dir, "duty_cycle", 0);
+	if (sysfs_write(dir, "period", period_ns) < 0 || sysfs_write(dir, "enable", 1) < 0)
+		return -1;
+	snprintf(path, sizeof(path), "%s/duty_cycle", dir);
+	return open(path, O_WRONLY);
+}
+
+int motor_open(struct motor *m, const char *dir, const char *pwm, uint32_t period_ns) {
+	memset(m, 0, sizeof(*m));
+	m->fd_dir = -1;
+	m->dir_lines.fd = -1;
+	m->period_ns = period_ns;
+
+	if (gpio_is_spec(dir)) {
+		if (gpio_line_open(&m->dir_lines, dir, GPIO_LINE_OUTPUT, "motor", 0) < 0) return -1;
+	} else {
+		m->fd_dir = open(dir, O_RDWR);
+	}
+	m->sysfs = strncmp(pwm, "/sys/", 5) == 0;
+	m->fd_pwm = m->sysfs ? sysfs_pwm_open(pwm, period_ns) : open(pwm, O_RDWR);
+	return m->fd_pwm < 0 ? -1 : 0;
+}
+
+/** @brief sets the duty alone
+    @param m is the motor
+    @param duty_ns is the high time in ns
+*/
+static void motor_duty(struct motor *m, uint32_t duty_ns) {
+	if (m->sysfs) sysfs_duty(m->fd_pwm, duty_ns);
+	// the text interface takes whole percents
+	else writeToDevice(m->fd_pwm, duty_ns/(m->period_ns/100));
+}
+
+void motor_set(struct motor *m, int32_t speed_ns) {
+	struct pwm_motor_cmd cmd = { m->period_ns, speed_ns, 0 };
+	int dir = speed_ns < 0 ? -1 : 1;
+
+	// one call sets direction and duty together
+	if (m->dir_lines.fd < 0 && !m->sysfs && ioctl(m->fd_pwm, PWM_IOC_MOTOR, &cmd) == 0) {
+		m->dir = dir;
+		return;
+	}
+
+	// otherwise they are two calls, so never let the old duty run in the
+	// new direction
+	if (dir != m->dir) {
+		if (m->dir) motor_duty(m, 0);
+		if (m->dir_lines.fd >= 0) gpio_line_set(&m->dir_lines, 3, dir > 0 ? 1 : 2);
+		else writeToDevice(m->fd_dir, dir < 0 ? PID_COUNTERCLOCK : PID_CLOCKWISE);
+	}
+	motor_duty(m, (uint32_t)abs(speed_ns));
+	m->dir = dir;
+}
+
+void motor_queue(struct motor *m, struct uring *r, int32_t speed_ns) {
+	int dir = speed_ns < 0 ? -1 : 1, len, rc;
+	uint32_t duty_ns = (uint32_t)abs(speed_ns);
+
+	if (m->dir_lines.fd < 0 && !m->sysfs) {
+		len = snprintf(m->cmd, sizeof(m->cmd), "%u %d", m->period_ns, (int)speed_ns);
+		rc = uring_write(r, m->fd_pwm, m->cmd, len+1, -1, 0);
+	} else if (dir == m->dir && m->sysfs) {
+		len = snprintf(m->cmd, sizeof(m->cmd), "%u", duty_ns);
+		rc = uring_write(r, m->fd_pwm, m->cmd, len, 0, 0);
+	} else if (dir == m->dir) {
+		len = snprintf(m->cmd, sizeof(m->cmd), "%u", duty_ns/(m->period_ns/100));
+		rc = uring_write(r, m->fd_pwm, m->cmd, len+1, -1, 0);
+	} else {
+		rc = -1;
+	}
+	if (rc < 0) motor_set(m, speed_ns);
+	else m->dir = dir;
+}
+
+void motor_close(struct motor *m) {
+	if (m->fd_pwm >= 0) {
+		motor_set(m, 0);
+		close(m->fd_pwm);
+	}
+	if (m->dir_lines.fd >= 0) gpio_line_set(&m->dir_lines, 3, 0);
+	gpio_line_close(&m->dir_lines);
+	if (m->fd_dir >= 0) close(m->fd_dir);
+	m->fd_pwm = m->fd_dir = -1;
+}
@@ -0,0 +1,82 @@
+/**
+ * @file   motor.h
+ *
+ * @brief  user side access to the motor: the H-bridge direction and the pwm
+ *         duty, through the LKM drivers or straight through gpio lines and
+ *         a sysfs pwm channel
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _MOTOR_H_
+#define _MOTOR_H_
+
+#include <stdint.h>
+
+#include "gpio_line.h"
+#include "uring.h"
+
+/** @brief an open motor */
+struct motor {
+	/** @brief /dev/motor_char, -1 if the direction pins are gpio lines */
+	int fd_dir;
+	/** @brief the direction pins, clockwise then counterclockwise (gpio
+	           mode only) */
+	struct gpio_lines dir_lines;
+	/** @brief /dev/motor_pwm, or the duty_cycle file of a sysfs channel */
+	int fd_pwm;
+	/** @brief 1 if fd_pwm is a sysfs channel */
+	int sysfs;
+	/** @brief pwm period in ns */
+	uint32_t period_ns;
+	/** @brief sign of the last speed set, 0 before the first */
+	int dir;
+	/** @brief text of the write queued by motor_queue, kept until it
+	           completed */
+	char cmd[24];
+};
+
+/** @brief opens the motor
+ *
+ *  A "gpiochipN:CW,CCW" direction spec drives the H-bridge pins from user
+ *  space. A sysfs channel directory such as /sys/class/pwm/pwmchip0/pwm0
+ *  as pwm is exported, set to period_ns and enabled here; together the two
+ *  need no driver module at all.
+ *
+    @param m is the motor to set up
+    @param dir is /dev/motor_char or the gpio lines of the direction pins
+    @param pwm is /dev/motor_pwm or a sysfs pwm channel directory
+    @param period_ns is the pwm period in ns
+    @return 0 on success, -1 on failure
+*/
+int motor_open(struct motor *m, const char *dir, const char *pwm, uint32_t period_ns);
+
+/** @brief sets direction and speed
+    @param m is the motor
+    @param speed_ns is the high time in ns, negative for counterclockwise,
+           see pid_motor_speed()
+*/
+void motor_set(struct motor *m, int32_t speed_ns);
+
+/** @brief sets direction and speed like motor_set, but queues the write on
+ *  an io_uring instead of making it
+ *
+ *  The pwm driver takes direction and duty together as one text write. A
+ *  sysfs channel or gpio direction lines only take the duty that way, so a
+ *  change of direction is still set right away with motor_set, as is any
+ *  write that does not fit the ring.
+ *
+    @param m is the motor
+    @param r is the instance the write is queued on, it must be reaped
+           before the next call
+    @param speed_ns is the high time in ns, negative for counterclockwise
+*/
+void motor_queue(struct motor *m, struct uring *r, int32_t speed_ns);
+
+/** @brief stops the motor and closes it
+    @param m is the motor to close
+*/
+void motor_close(struct motor *m);
+
+#endif /* _MOTOR_H_ */
@@ -14,6 +14,20 @@
 #include <linux/io.h>     // for iore/unmap()
 #include <linux/gpio.h>   // required for the gpio functions
 #include <linux/interrupt.h>    // Required for the IRQ code
+#include <linux/moduleparam.h>  // Required for the backend parameter
+
+#include "driver_exports.h"
+#include "gpio_fast.h"
+
+#define CREATE_TRACE_POINTS
+#include "motor_trace.h"
+
+// the other drivers emit these events too
+EXPORT_TRACEPOINT_SYMBOL(motor_enc_edge);
+EXPORT_TRACEPOINT_SYMBOL(motor_enc_read);
+EXPORT_TRACEPOINT_SYMBOL(motor_dev_write);
+EXPORT_TRACEPOINT_SYMBOL(motor_pwm_update);
+EXPORT_TRACEPOINT_SYMBOL(motor_timer_fire);
 
 /** @brief The device will appear at /dev/motor_char using this value*/
 #define DEVICE_NAME "motor_char"
@@ -55,24 +69,14 @@ static struct file_operations fops =
   .release = mydriver_release,
 };
 
-// ****************************************************************************
-// 18-349 GPIO library ported to LKM
-// ****************************************************************************
+/** @brief drive the direction pins through the GPIO registers, or through
+           gpiolib if false */
+static bool gpio_mmio = true;
+module_param(gpio_mmio, bool, 0444);
+MODULE_PARM_DESC(gpio_mmio, "write the direction pins straight to the GPIO registers (default) or use gpiolib");
 
-/** @brief base of MMIO (physical address) on the pi */
-#define MMIO_BASE_PHYSICAL 0x3F000000
-/** @brief base of GPIO in memory mapped IO on pi */
-#define GPIO_BASE (MMIO_BASE_PHYSICAL + 0x200000)
-/** @brief GPIO Pin Output Set 0 */
-#define GPIO_REG_GPSET0 7
-/** @brief GPIO Pin Output Set 1 */
-#define GPIO_REG_GPSET1 8
-/** @brief GPIO Pin Output Clear 0 */
-#define GPIO_REG_GPCLR0 10
-/** @brief GPIO Pin Output Clear 1 */
-#define GPIO_REG_GPCLR1 11
-/** @brief GPIO Function Select OUTPUT */
-#define GPIO_FUN_OUTPUT 1
+/** @brief access to the direction pins */
+static struct gpio_fast gpio;
 
 /** @brief major number of the device */
 static int majorNumber;
@@ -82,8 +86,6 @@ static int irqNumber;
 static struct class* motorcharclass = NULL;
 /** @brief the device driver device struct pointer */
 static struct device* motorchardevice = NULL;
-/** @brief input number */
-static char input[8] = {0};
 
 // ****************************************************************************
 // Module interface functions
@@ -114,25 +116,52 @@ static int mydriver_release(struct inode *inodep, struct file *filep){
  *  @param offset The offset if required
  */
 static ssize_t mydriver_write(struct file *filep, const char *buffer,size_t len, loff_t *offset){
-  sprintf(input, buffer);
-  printk(KERN_INFO "character received: %s, len of %zu\n", buffer, len);
+  // on the stack, concurrent writers must not share the buffer
+  char input[8] = {0};
+
+  if (copy_from_user(input, buffer, min(len, sizeof(input)-1))) return -EFAULT;
+  trace_motor_dev_write(DEVICE_NAME, input[0] - '0');
   switch (input[0]){
     case '0':
-      gpio_set_value(MOTOR1, false);
-      gpio_set_value(MOTOR2, false);
+      motor_set_dir(MOTOR_STOP);
       break;
     case '1':
-      gpio_set_value(MOTOR1, true);
-      gpio_set_value(MOTOR2, false);
+      motor_set_dir(MOTOR_CLOCKWISE);
       break;
     case '2':
-      gpio_set_value(MOTOR1, false);
-      gpio_set_value(MOTOR2, true);
+      motor_set_dir(MOTOR_COUNTERCLOCK);
+      break;
+    case '3':
+      motor_set_dir(MOTOR_BRAKE);
       break;
   }
   return len;
 }
 
+/** @brief drives the H-bridge direction pins, exported for the in-kernel controller
+ *  @param dir MOTOR_STOP, MOTOR_CLOCKWISE, MOTOR_COUNTERCLOCK or MOTOR_BRAKE
+ */
+void motor_set_dir(int dir){
+  u64 high = 0;
+
+  if (dir == MOTOR_CLOCKWISE || dir == MOTOR_BRAKE) high |= BIT_ULL(MOTOR1);
+  if (dir == MOTOR_COUNTERCLOCK || dir == MOTOR_BRAKE) high |= BIT_ULL(MOTOR2);
+  // the pin going low is cleared before the other is set, so a reversal
+  // coasts for an instant instead of braking
+  gpio_fast_write(&gpio, high, (BIT_ULL(MOTOR1) | BIT_ULL(MOTOR2)) & ~high);
+}
+// GPL so that pwm_driver can look it up with symbol_get
+EXPORT_SYMBOL_GPL(motor_set_dir);
+
+/** @brief tells whether motor_set_dir writes the registers, which makes it
+ *         safe in hard interrupt context; gpiolib chips may sleep
+ *  @return true for the register backend
+ */
+bool motor_dir_mmio(void){
+  return gpio.regs != NULL;
+}
+EXPORT_SYMBOL_GPL(motor_dir_mmio);
+
 /** @brief the irq handler 
  *  @param irq the irq number with the gpio pin
  *  @param dev_id the device id
@@ -140,11 +169,11 @@ static ssize_t mydriver_write(struct file *filep, const char *buffer,size_t len,
  *  @return the handling status
  */
 static irq_handler_t my_irq_handler(unsigned int irq, void *dev_id, struct pt_regs *regs){
-   int cur1,cur2;
-   cur1 = gpio_get_value(MOTOR1);
-   cur2 = gpio_get_value(MOTOR2);
-   gpio_set_value(MOTOR1, !cur1);          // Set the physical LED accordingly
-   gpio_set_value(MOTOR2, !cur2);
+   u64 high = 0;
+   if (!gpio_fast_get(&gpio, MOTOR1)) high |= BIT_ULL(MOTOR1);
+   if (!gpio_fast_get(&gpio, MOTOR2)) high |= BIT_ULL(MOTOR2);
+   // toggle both pins with one write
+   gpio_fast_write(&gpio, high, (BIT_ULL(MOTOR1) | BIT_ULL(MOTOR2)) & ~high);
    return (irq_handler_t) IRQ_HANDLED;      // Announce that the IRQ has been handled correctly
 }
 
@@ -169,6 +198,8 @@ static int __init motor_driver_init(void) {
   gpio_request(MOTOR2, "gpioMotor2"); // gpio for Motor A requested
   gpio_direction_output(MOTOR2, false); // Set the gpio to be in output mode and on
   gpio_export(MOTOR2, false); // Causes gpio20 to appear in /sys/class/gpio
+  if (gpio_fast_init(&gpio, gpio_mmio))
+    printk(KERN_WARNING "motor_driver: cannot map the GPIO registers, using gpiolib\n");
 
   gpio_request(BUTTON, "DOWNBUTTON");
   gpio_direction_input(BUTTON);
@@ -195,6 +226,7 @@ static void __exit motor_driver_exit(void) {
   gpio_unexport(MOTOR1);                  // Unexport the LED GPIO
   gpio_unexport(MOTOR2);
   free_irq(irqNumber, NULL);               // Free the IRQ number, no *dev_id required in this case
+  gpio_fast_exit(&gpio);                   // the button IRQ toggled the pins through it
   gpio_unexport(BUTTON);               // Unexport the Button GPIO
   gpio_free(MOTOR1);                      // Free the LED GPIO
   gpio_free(MOTOR2);                   // Free the Button GPIO
@@ -0,0 +1,122 @@
+/**
+ * @file   motor_trace.h
+ *
+ * @brief  tracepoints of the motor LKM drivers
+ *
+ * The events replace the printk calls that used to sit in the IRQ handlers
+ * and the read/write paths. A disabled tracepoint costs a patched-out
+ * branch, but its arguments are still evaluated; callers whose arguments
+ * cost more than a load, like the timer lateness, check
+ * trace_<event>_enabled() first. motor_driver defines the tracepoints and exports them, the other
+ * drivers only include this header; motor_driver is always loaded first.
+ *
+ * Capture with
+ *   trace-cmd record -e motor -e irq:irq_handler_entry
+ * and summarise with trace_report.py.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM motor
+
+#if !defined(_MOTOR_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _MOTOR_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+/** @brief one decoded encoder edge */
+TRACE_EVENT(motor_enc_edge,
+  TP_PROTO(const char *dev, int count, int step),
+  TP_ARGS(dev, count, step),
+  TP_STRUCT__entry(
+    __string(dev, dev)
+    __field(int, count)
+    __field(int, step)
+  ),
+  TP_fast_assign(
+    __assign_str(dev, dev);
+    __entry->count = count;
+    __entry->step = step;
+  ),
+  TP_printk("dev=%s count=%d step=%d", __get_str(dev), __entry->count, __entry->step)
+);
+
+/** @brief one read() of an encoder device */
+TRACE_EVENT(motor_enc_read,
+  TP_PROTO(const char *dev, int degree, int velocity),
+  TP_ARGS(dev, degree, velocity),
+  TP_STRUCT__entry(
+    __string(dev, dev)
+    __field(int, degree)
+    __field(int, velocity)
+  ),
+  TP_fast_assign(
+    __assign_str(dev, dev);
+    __entry->degree = degree;
+    __entry->velocity = velocity;
+  ),
+  TP_printk("dev=%s degree=%d velocity=%d", __get_str(dev), __entry->degree,
+            __entry->velocity)
+);
+
+/** @brief one text write() to a motor device */
+TRACE_EVENT(motor_dev_write,
+  TP_PROTO(const char *dev, int value),
+  TP_ARGS(dev, value),
+  TP_STRUCT__entry(
+    __string(dev, dev)
+    __field(int, value)
+  ),
+  TP_fast_assign(
+    __assign_str(dev, dev);
+    __entry->value = value;
+  ),
+  TP_printk("dev=%s value=%d", __get_str(dev), __entry->value)
+);
+
+/** @brief a pwm setting staged for the next period boundary */
+TRACE_EVENT(motor_pwm_update,
+  TP_PROTO(int channel, u32 period_ns, u32 duty_ns, int dir),
+  TP_ARGS(channel, period_ns, duty_ns, dir),
+  TP_STRUCT__entry(
+    __field(int, channel)
+    __field(u32, period_ns)
+    __field(u32, duty_ns)
+    __field(int, dir)
+  ),
+  TP_fast_assign(
+    __entry->channel = channel;
+    __entry->period_ns = period_ns;
+    __entry->duty_ns = duty_ns;
+    __entry->dir = dir;
+  ),
+  TP_printk("channel=%d period_ns=%u duty_ns=%u dir=%d", __entry->channel,
+            __entry->period_ns, __entry->duty_ns, __entry->dir)
+);
+
+/** @brief an hrtimer callback ran, late_ns after its expiry */
+TRACE_EVENT(motor_timer_fire,
+  TP_PROTO(const char *dev, s64 late_ns),
+  TP_ARGS(dev, late_ns),
+  TP_STRUCT__entry(
+    __string(dev, dev)
+    __field(s64, late_ns)
+  ),
+  TP_fast_assign(
+    __assign_str(dev, dev);
+    __entry->late_ns = late_ns;
+  ),
+  TP_printk("dev=%s late_ns=%lld", __get_str(dev), __entry->late_ns)
+);
+
+#endif /* _MOTOR_TRACE_H_ */
+
+/* the drivers are built out of tree, define_trace.h looks for this file in
+   the module directory */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE motor_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,109 @@
+/**
+ * @file   periodic.c
+ *
+ * @brief  deadline-driven periodic task scheduler shared by the control
+ *         programs
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include "periodic.h"
+
+/** @brief nanoseconds per second */
+#define NSEC_PER_SEC 1000000000L
+
+/** @brief adds ns nanoseconds to a timespec
+    @param ts is the timespec to advance
+    @param ns is the number of nanoseconds to add
+*/
+static void timespec_add_ns(struct timespec *ts, long ns) {
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= NSEC_PER_SEC) {
+		ts->tv_nsec -= NSEC_PER_SEC;
+		ts->tv_sec++;
+	}
+}
+
+/** @brief computes a - b in nanoseconds
+    @param a is the later time
+    @param b is the earlier time
+    @return the difference in nanoseconds
+*/
+static long long timespec_diff_ns(const struct timespec *a, const struct timespec *b) {
+	return (long long)(a->tv_sec-b->tv_sec)*NSEC_PER_SEC+(a->tv_nsec-b->tv_nsec);
+}
+
+void periodic_init(struct periodic_task *task, const char *name, unsigned int hz) {
+	task->name = name;
+	task->hz = hz;
+	task->period_ns = NSEC_PER_SEC/hz;
+	task->cycles = 0;
+	task->overruns = 0;
+	task->jitter_max_ns = 0;
+	task->jitter_sum_ns = 0;
+	task->jitter_samples = 0;
+	clock_gettime(CLOCK_MONOTONIC, &task->next);
+}
+
+int periodic_next(struct periodic_task *task) {
+	struct timespec now;
+	long long late;
+
+	timespec_add_ns(&task->next, task->period_ns);
+	task->cycles++;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	late = timespec_diff_ns(&now, &task->next);
+	if (late > 0) {
+		/* missed the deadline: re-anchor to the next period boundary */
+		task->overruns++;
+		timespec_add_ns(&task->next, (late/task->period_ns)*task->period_ns);
+		return 0;
+	}
+	return 1;
+}
+
+void periodic_released(struct periodic_task *task) {
+	struct timespec now;
+	long long late;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	late = timespec_diff_ns(&now, &task->next);
+	if (late > task->jitter_max_ns) task->jitter_max_ns = late;
+	task->jitter_sum_ns += late;
+	task->jitter_samples++;
+}
+
+void periodic_wait(struct periodic_task *task) {
+	if (!periodic_next(task)) return;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &task->next, NULL) == EINTR);
+	periodic_released(task);
+}
+
+void periodic_report(struct periodic_task *task) {
+	if (task->cycles % task->hz != 0) return;
+
+	printf("%s: %u Hz, %lu cycles, %lu overruns, jitter avg %lld ns max %ld ns\n",
+	       task->name, task->hz, task->cycles, task->overruns,
+	       task->jitter_samples ? task->jitter_sum_ns/(long long)task->jitter_samples : 0,
+	       task->jitter_max_ns);
+
+	task->jitter_max_ns = 0;
+	task->jitter_sum_ns = 0;
+	task->jitter_samples = 0;
+}
+
+unsigned int periodic_parse_hz(const char *arg, unsigned int def) {
+	long hz;
+
+	if (arg == NULL) return def;
+	hz = atol(arg);
+	if (hz <= 0 || hz > NSEC_PER_SEC) return def;
+	return (unsigned int)hz;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file   periodic.h
+ *
+ * @brief  deadline-driven periodic task scheduler shared by the control
+ *         programs
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _PERIODIC_H_
+#define _PERIODIC_H_
+
+#include <time.h>
+
+/** @brief state of one periodic loop */
+struct periodic_task {
+	/** @brief name printed in reports */
+	const char *name;
+	/** @brief loop rate in Hz */
+	unsigned int hz;
+	/** @brief loop period in ns */
+	long period_ns;
+	/** @brief absolute deadline of the next release */
+	struct timespec next;
+	/** @brief number of completed periods */
+	unsigned long cycles;
+	/** @brief number of periods whose deadline was already missed */
+	unsigned long overruns;
+	/** @brief worst release latency seen since the last report, in ns */
+	long jitter_max_ns;
+	/** @brief summed release latency since the last report, in ns */
+	long long jitter_sum_ns;
+	/** @brief number of samples in jitter_sum_ns */
+	unsigned long jitter_samples;
+};
+
+/** @brief sets up a periodic task and anchors its first deadline to now
+    @param task is the task to set up
+    @param name is the name used in reports
+    @param hz is the loop rate in Hz, must be non-zero
+*/
+void periodic_init(struct periodic_task *task, const char *name, unsigned int hz);
+
+/** @brief sleeps until the next absolute deadline of the task
+ *
+ *  The deadline advances by exactly one period each call, so the loop rate
+ *  does not drift with the time spent in the loop body. If the deadline has
+ *  already passed the call returns immediately, counts an overrun and skips
+ *  the missed periods instead of bursting to catch up.
+ *
+    @param task is the task to wait on
+*/
+void periodic_wait(struct periodic_task *task);
+
+/** @brief advances the deadline of the task by one period, the first half
+           of periodic_wait for loops that sleep some other way
+    @param task is the task
+    @return 1 if the caller should sleep until task->next, 0 if the
+            deadline had already passed, which counts as an overrun
+*/
+int periodic_next(struct periodic_task *task);
+
+/** @brief records the release latency once the sleep until task->next
+           ended, the second half of periodic_wait
+    @param task is the task
+*/
+void periodic_released(struct periodic_task *task);
+
+/** @brief prints overrun and jitter statistics once per second of loop time
+           and resets the jitter window
+    @param task is the task to report on
+*/
+void periodic_report(struct periodic_task *task);
+
+/** @brief parses a loop rate from a command line argument
+    @param arg is the argument, may be NULL
+    @param def is the rate returned if arg is missing or invalid
+    @return the loop rate in Hz
+*/
+unsigned int periodic_parse_hz(const char *arg, unsigned int def);
+
+#endif /* _PERIODIC_H_ */
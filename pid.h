@@ -0,0 +1,221 @@
+/**
+ * @file   pid.h
+ *
+ * @brief  fixed-point PID position controller shared by the user programs
+ *         and the pid_driver LKM
+ *
+ * All values are Q16.16. The controller uses derivative-on-measurement with
+ * a first order low-pass filter, an integrator clamped to +-i_max to stop
+ * windup and a branch-free shortest-path wrap for angular inputs. Everything
+ * is static inline so the same code builds in the kernel and in user space.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _PID_H_
+#define _PID_H_
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+/** @brief number of fractional bits */
+#define Q16_SHIFT 16
+/** @brief 1.0 in Q16.16 */
+#define Q16_ONE   (1 << Q16_SHIFT)
+/** @brief converts an integer to Q16.16 */
+#define Q16_FROM_INT(x) ((q16_t)(x) * Q16_ONE)
+/** @brief converts Q16.16 to an integer, rounding toward zero */
+#define Q16_TO_INT(x)   ((x) / Q16_ONE)
+
+/** @brief define clockwise direction */
+#define PID_CLOCKWISE     1
+/** @brief define counterclockwise direction */
+#define PID_COUNTERCLOCK  2
+/** @brief define the max speed */
+#define PID_SHIGH   70
+/** @brief define the low speed upper bound */
+#define PID_SLOW1   20
+/** @brief define the low speed lower bound */
+#define PID_SLOW2   5
+/** @brief define the full round degree */
+#define PID_FULLROUND 360
+
+/** @brief default proportional gain, 0.23 */
+#define PID_KP_DEFAULT 15073
+/** @brief default integral gain, 0.0001 */
+#define PID_KI_DEFAULT 7
+/** @brief default derivative gain, 0.1 */
+#define PID_KD_DEFAULT 6554
+
+/** @brief a Q16.16 fixed-point number */
+typedef int32_t q16_t;
+
+/** @brief state and tuning of one controller */
+struct pid_ctrl {
+	/** @brief proportional gain */
+	q16_t kp;
+	/** @brief integral gain, per update */
+	q16_t ki;
+	/** @brief derivative gain, per update */
+	q16_t kd;
+	/** @brief integrator bound in output units */
+	q16_t i_max;
+	/** @brief output bound */
+	q16_t out_max;
+	/** @brief wrap range of the inputs, 0 for linear inputs */
+	q16_t range;
+	/** @brief derivative filter strength, the filter moves 1/2^d_shift of
+	           the way to the raw derivative each update */
+	int d_shift;
+	/** @brief integrator state, already scaled by ki */
+	q16_t integ;
+	/** @brief filtered derivative of the measurement */
+	q16_t d_filt;
+	/** @brief measurement of the previous update */
+	q16_t last_meas;
+	/** @brief non-zero once last_meas is valid */
+	int primed;
+};
+
+/** @brief multiplies two Q16.16 numbers
+    @param a is the first factor
+    @param b is the second factor
+    @return a*b in Q16.16
+*/
+static inline q16_t q16_mul(q16_t a, q16_t b) {
+	return (q16_t)(((int64_t)a * b) >> Q16_SHIFT);
+}
+
+/** @brief clamps a value to [-max, max]
+    @param x is the value
+    @param max is the bound, must be positive
+    @return the clamped value
+*/
+static inline q16_t q16_clamp(q16_t x, q16_t max) {
+	return x > max ? max : (x < -max ? -max : x);
+}
+
+/** @brief maps a difference of two angles onto the shortest path
+ *
+ *  The comparisons compile to flag-setting instructions rather than jumps.
+ *
+    @param d is the difference, in (-range, range)
+    @param range is the full circle, 0 disables wrapping
+    @return d moved into [-range/2, range/2)
+*/
+static inline q16_t pid_wrap(q16_t d, q16_t range) {
+	q16_t half = range >> 1;
+	d += range & -(q16_t)(d < -half);
+	d -= range & -(q16_t)(d >= half);
+	return d;
+}
+
+/** @brief sets up a controller with the given gains and clears its state
+    @param c is the controller
+    @param kp is the proportional gain
+    @param ki is the integral gain
+    @param kd is the derivative gain
+    @param range is the wrap range of the inputs, 0 for linear inputs
+*/
+static inline void pid_init(struct pid_ctrl *c, q16_t kp, q16_t ki, q16_t kd, q16_t range) {
+	c->kp = kp;
+	c->ki = ki;
+	c->kd = kd;
+	c->range = range;
+	c->i_max = Q16_FROM_INT(PID_SHIGH / 2);
+	c->out_max = Q16_FROM_INT(PID_SHIGH * 4);
+	c->d_shift = 1;
+	c->integ = 0;
+	c->d_filt = 0;
+	c->last_meas = 0;
+	c->primed = 0;
+}
+
+/** @brief clears the dynamic state, e.g. after the loop was paused
+    @param c is the controller
+*/
+static inline void pid_reset(struct pid_ctrl *c) {
+	c->integ = 0;
+	c->d_filt = 0;
+	c->primed = 0;
+}
+
+/** @brief runs one controller update
+    @param c is the controller
+    @param setpoint is the target
+    @param meas is the measurement
+    @return the controller output, bounded by out_max
+*/
+static inline q16_t pid_update(struct pid_ctrl *c, q16_t setpoint, q16_t meas) {
+	q16_t err, d_raw;
+
+	err = pid_wrap(setpoint - meas, c->range);
+
+	// derivative on measurement does not kick when the setpoint jumps
+	d_raw = c->primed ? -pid_wrap(meas - c->last_meas, c->range) : 0;
+	c->d_filt += (d_raw - c->d_filt) >> c->d_shift;
+	c->last_meas = meas;
+	c->primed = 1;
+
+	c->integ = q16_clamp(c->integ + q16_mul(c->ki, err), c->i_max);
+
+	return q16_clamp(q16_mul(c->kp, err) + c->integ + q16_mul(c->kd, c->d_filt), c->out_max);
+}
+
+/** @brief turns a controller output into a motor direction and duty cycle
+ *
+ *  The duty is capped at PID_SHIGH and lifted to PID_SLOW1 when it is too
+ *  small to overcome friction but above the PID_SLOW2 dead band.
+ *
+    @param out is the controller output
+    @param dir receives PID_CLOCKWISE or PID_COUNTERCLOCK
+    @param speed receives the duty cycle in percent
+*/
+static inline void pid_motor_command(q16_t out, int *dir, int *speed) {
+	int s = Q16_TO_INT(out);
+
+	*dir = s < 0 ? PID_COUNTERCLOCK : PID_CLOCKWISE;
+	if (s < 0) s = -s;
+	if (s > PID_SHIGH) s = PID_SHIGH;
+	else if (s < PID_SLOW1 && s >= PID_SLOW2) s = PID_SLOW1;
+	*speed = s;
+}
+
+/** @brief turns a controller output into a motor direction and a pwm high
+ *         time, keeping the fraction of a percent pid_motor_command drops
+ *
+ *  The output is shaped the same way as in pid_motor_command.
+ *
+    @param out is the controller output, in percent
+    @param dir receives PID_CLOCKWISE or PID_COUNTERCLOCK
+    @param period_ns is the pwm period in ns
+    @return the high time in ns
+*/
+static inline uint32_t pid_motor_duty(q16_t out, int *dir, uint32_t period_ns) {
+	q16_t s = out < 0 ? -out : out;
+
+	*dir = out < 0 ? PID_COUNTERCLOCK : PID_CLOCKWISE;
+	if (s > Q16_FROM_INT(PID_SHIGH)) s = Q16_FROM_INT(PID_SHIGH);
+	else if (s < Q16_FROM_INT(PID_SLOW1) && s >= Q16_FROM_INT(PID_SLOW2)) s = Q16_FROM_INT(PID_SLOW1);
+	// no 64 bit division, so this builds in the kernel as well
+	return (uint32_t)(((uint64_t)s * (period_ns / 100)) >> Q16_SHIFT);
+}
+
+/** @brief turns a controller output into a signed pwm high time for
+ *         PWM_IOC_MOTOR, shaped as in pid_motor_duty
+    @param out is the controller output, in percent
+    @param period_ns is the pwm period in ns
+    @return the high time in ns, negative for counterclockwise
+*/
+static inline int32_t pid_motor_speed(q16_t out, uint32_t period_ns) {
+	int dir;
+	int32_t on = (int32_t)pid_motor_duty(out, &dir, period_ns);
+
+	return dir == PID_COUNTERCLOCK ? -on : on;
+}
+
+#endif /* _PID_H_ */
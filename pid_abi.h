@@ -0,0 +1,58 @@
+/**
+ * @file   pid_abi.h
+ *
+ * @brief  ioctl interface of the in-kernel PID controller, shared by the
+ *         LKM driver and the user programs
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _PID_ABI_H_
+#define _PID_ABI_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/** @brief number of fractional bits of the fixed-point gains */
+#define PID_Q 16
+
+/** @brief controller gains in Q16.16, applied to the error in degrees */
+struct pid_gains {
+	/** @brief proportional gain */
+	__s32 kp;
+	/** @brief integral gain, per controller tick */
+	__s32 ki;
+	/** @brief derivative gain, per controller tick */
+	__s32 kd;
+};
+
+/** @brief snapshot of the controller state */
+struct pid_status {
+	/** @brief target angle in degrees */
+	__s32 target;
+	/** @brief wheel angle in degrees */
+	__s32 position;
+	/** @brief shortest-path error in degrees, Q16.16 */
+	__s32 error;
+	/** @brief last duty cycle written to the pwm, in whole percent; the pwm
+	           gets the high time to the ns */
+	__s32 output;
+	/** @brief number of controller ticks since load */
+	__u32 ticks;
+	/** @brief number of ticks the timer was late by a whole period */
+	__u32 overruns;
+};
+
+/** @brief ioctl magic number of the controller device */
+#define PID_IOC_MAGIC 'p'
+/** @brief sets the target angle in degrees */
+#define PID_IOC_SET_TARGET _IOW(PID_IOC_MAGIC, 1, __s32)
+/** @brief sets the controller gains */
+#define PID_IOC_SET_GAINS  _IOW(PID_IOC_MAGIC, 2, struct pid_gains)
+/** @brief starts (non-zero) or stops (0) the control loop */
+#define PID_IOC_ENABLE     _IOW(PID_IOC_MAGIC, 3, __s32)
+/** @brief reads a struct pid_status */
+#define PID_IOC_GET_STATUS _IOR(PID_IOC_MAGIC, 4, struct pid_status)
+
+#endif /* _PID_ABI_H_ */
@@ -0,0 +1,97 @@
+/**
+ * @file   pid_bench.c
+ *
+ * @brief  host micro-benchmark of the fixed-point controller in pid.h
+ *         against the float controller it replaced
+ *
+ * Both controllers are driven with the same pseudo-random angle pairs and
+ * the time per update is printed. Runs anywhere, no hardware needed.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pid.h"
+
+/** @brief number of updates timed per controller */
+#define ITERATIONS 10000000
+/** @brief number of precomputed input pairs */
+#define SAMPLES 4096
+
+/** @brief setpoints fed to the controllers */
+static int setpoints[SAMPLES];
+/** @brief measurements fed to the controllers */
+static int measurements[SAMPLES];
+/** @brief sink that keeps the compiler from dropping the loops */
+static volatile int sink;
+
+/** @brief the float controller previously inlined in the user programs
+    @param target is the target angle
+    @param pos is the measured angle
+    @param last_err is the error of the previous update
+    @param err_sum is the error integral
+    @return the duty cycle
+*/
+static int float_update(int target, int pos, int *last_err, int *err_sum) {
+	int err = target-pos, speed;
+
+	if (err < -PID_FULLROUND/2) err = -PID_FULLROUND-err;
+	else if (err >= PID_FULLROUND/2) err = PID_FULLROUND-err;
+
+	speed = (int)(0.23f*err+0.1f*(err-*last_err)+0.0001f*(*err_sum));
+	if (speed < 0) speed = -speed;
+	if (speed > PID_SHIGH) speed = PID_SHIGH;
+	else if (speed < PID_SLOW1 && speed >= PID_SLOW2) speed = PID_SLOW1;
+
+	*last_err = err;
+	*err_sum += err;
+	return speed;
+}
+
+/** @brief returns the CLOCK_MONOTONIC time in ns
+    @return the time in ns
+*/
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+/** @brief times both controllers and prints ns per update */
+int main() {
+	struct pid_ctrl pid;
+	long long start, float_ns, fixed_ns;
+	int i, j, dir, speed, last_err = 0, err_sum = 0;
+
+	srand(349);
+	for (i = 0; i < SAMPLES; i++) {
+		setpoints[i] = rand() % PID_FULLROUND;
+		measurements[i] = rand() % PID_FULLROUND;
+	}
+
+	start = now_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		j = i & (SAMPLES-1);
+		sink = float_update(setpoints[j], measurements[j], &last_err, &err_sum);
+	}
+	float_ns = now_ns()-start;
+
+	pid_init(&pid, PID_KP_DEFAULT, PID_KI_DEFAULT, PID_KD_DEFAULT, Q16_FROM_INT(PID_FULLROUND));
+	start = now_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		j = i & (SAMPLES-1);
+		pid_motor_command(pid_update(&pid, Q16_FROM_INT(setpoints[j]),
+		                             Q16_FROM_INT(measurements[j])), &dir, &speed);
+		sink = speed;
+	}
+	fixed_ns = now_ns()-start;
+
+	printf("float: %.2f ns/update\n", (double)float_ns/ITERATIONS);
+	printf("fixed: %.2f ns/update\n", (double)fixed_ns/ITERATIONS);
+	return 0;
+}
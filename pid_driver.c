@@ -0,0 +1,243 @@
+/**
+ * @file   pid_driver.c
+ *
+ * @brief  LKM closed-loop PID position controller for the RPi motor
+ *
+ * The controller runs in an hrtimer callback at a fixed rate. Each tick it
+ * reads the wheel encoder count, runs the fixed-point controller from pid.h
+ * and applies the output through the motor and pwm drivers, so no syscall
+ * is on the control path. User space only sets the target and the gains, either
+ * through ioctl on /dev/motor_pid or through the module parameters in
+ * /sys/module/pid_driver/parameters.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+#include <linux/init.h>   // Macros used to mark up functions e.g. __init __exit
+#include <linux/module.h> // Core header for loading LKMs into the kernel
+#include <linux/moduleparam.h> // Required for the sysfs parameters
+#include <linux/device.h> // Header to support the kernel Driver Model
+#include <linux/kernel.h> // Contains types, macros, functions for the kernel
+#include <linux/fs.h>     // Header for the Linux file system support
+#include <asm/uaccess.h>  // Required for the copy to user function
+#include <linux/hrtimer.h> // Required for hrtimer
+#include <linux/ktime.h>  // Required for ktime
+#include <linux/math64.h> // Required for div_s64
+
+#include "driver_exports.h"
+#include "pid_abi.h"
+#include "pwm_abi.h"
+#include "pid.h"
+#include "motor_trace.h"
+
+/** @brief the name of the device */
+#define NAME "motor_pid"
+/** @brief define the full round degree */
+#define FULLROUND PID_FULLROUND
+
+/** @brief Module info: license */
+MODULE_LICENSE("GPL");
+/** @brief Module info: author(s) */
+MODULE_AUTHOR("LASTONE");
+/** @brief Module info: description */
+MODULE_DESCRIPTION("An in-kernel PID position controller for the RPi motor");
+/** @brief Module info: version */
+MODULE_VERSION("0.1");
+
+/** @brief controller rate in Hz */
+static unsigned int rate_hz = 1000;
+module_param(rate_hz, uint, 0444);
+MODULE_PARM_DESC(rate_hz, "controller rate in Hz (default 1000)");
+/** @brief pwm period in ns */
+static unsigned int period_ns = 1000000;
+module_param(period_ns, uint, 0444);
+MODULE_PARM_DESC(period_ns, "pwm period in ns (default 1000000)");
+/** @brief target angle in degrees */
+static int target = 0;
+module_param(target, int, 0644);
+MODULE_PARM_DESC(target, "target angle in degrees");
+/** @brief proportional gain, Q16.16 (0.23) */
+static int kp = PID_KP_DEFAULT;
+module_param(kp, int, 0644);
+MODULE_PARM_DESC(kp, "proportional gain in Q16.16");
+/** @brief integral gain, Q16.16 (0.0001) */
+static int ki = PID_KI_DEFAULT;
+module_param(ki, int, 0644);
+MODULE_PARM_DESC(ki, "integral gain in Q16.16");
+/** @brief derivative gain, Q16.16 (0.1) */
+static int kd = PID_KD_DEFAULT;
+module_param(kd, int, 0644);
+MODULE_PARM_DESC(kd, "derivative gain in Q16.16");
+/** @brief non-zero while the controller drives the motor */
+static int enable = 0;
+module_param(enable, int, 0644);
+MODULE_PARM_DESC(enable, "set to 1 to close the loop, 0 to stop the motor");
+
+/** @brief the hr timer struct */
+static struct hrtimer hr_timer;
+/** @brief the controller period */
+static ktime_t period;
+/** @brief true while the last tick drove the motor */
+static bool running = false;
+/** @brief the controller state */
+static struct pid_ctrl ctrl;
+/** @brief status reported through PID_IOC_GET_STATUS */
+static struct pid_status status;
+/** @brief device major number */
+static int major_number;
+/** @brief class struct pointer */
+static struct class*  this_class  = NULL;
+/** @brief device struct pointer */
+static struct device* this_device = NULL;
+
+static long driver_ioctl(struct file *filep, unsigned int cmd, unsigned long arg);
+
+/** @brief The file operations structure lists the
+ *         callback functions that you can associate with the file operations.
+ */
+static struct file_operations fops ={
+  .unlocked_ioctl = driver_ioctl,
+};
+
+/** @brief stops the motor and clears the controller memory */
+static void pid_stop(void) {
+  struct pwm_motor_cmd cmd = { .period_ns = period_ns };
+
+  pwm_set_motor(&cmd);
+  pid_reset(&ctrl);
+  running = false;
+}
+
+/** @brief runs one controller update, called at rate_hz by the hr timer
+    @param timer is the hrtimer that is currently used
+    @return HRTIMER_RESTART to keep the loop running
+*/
+static enum hrtimer_restart pid_tick(struct hrtimer *timer) {
+  struct pwm_motor_cmd cmd = { .period_ns = period_ns };
+  int pos, goal;
+  q16_t meas, out;
+  u64 missed;
+
+  // read the clock only while someone traces
+  if (trace_motor_timer_fire_enabled())
+    trace_motor_timer_fire(NAME, ktime_to_ns(ktime_sub(ktime_get(), hrtimer_get_expires(timer))));
+  missed = hrtimer_forward_now(timer, period);
+  if (missed > 1) status.overruns += missed - 1;
+  status.ticks++;
+
+  if (!READ_ONCE(enable)) {
+    if (running) pid_stop();
+    return HRTIMER_RESTART;
+  }
+  running = true;
+
+  pos = wheel_encoder_get_count() % WHEEL_STEPS;
+  if (pos < 0) pos += WHEEL_STEPS;
+
+  goal = READ_ONCE(target) % FULLROUND;
+  if (goal < 0) goal += FULLROUND;
+
+  // wheel angle in Q16.16 degrees, keeping the sub-degree encoder resolution
+  meas = (q16_t)div_s64((s64)pos * Q16_FROM_INT(FULLROUND), WHEEL_STEPS);
+
+  ctrl.kp = READ_ONCE(kp);
+  ctrl.ki = READ_ONCE(ki);
+  ctrl.kd = READ_ONCE(kd);
+  out = pid_update(&ctrl, Q16_FROM_INT(goal), meas);
+  // the high time keeps the fraction of a percent of the output
+  cmd.speed_ns = pid_motor_speed(out, period_ns);
+  pwm_set_motor(&cmd);
+
+  status.target = goal;
+  status.position = pos * FULLROUND / WHEEL_STEPS;
+  status.error = pid_wrap(Q16_FROM_INT(goal) - meas, ctrl.range);
+  status.output = abs(cmd.speed_ns) / (period_ns / 100);
+  return HRTIMER_RESTART;
+}
+
+/** @brief handles the controller ioctls, see pid_abi.h
+ *  @param filep A pointer to a file object (defined in linux/fs.h)
+ *  @param cmd the ioctl command
+ *  @param arg the ioctl argument
+ *  @return 0 on success, negative errno otherwise
+ */
+static long driver_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+  struct pid_gains gains;
+  struct pid_status snap;
+  int value;
+
+  switch (cmd) {
+    case PID_IOC_SET_TARGET:
+      if (get_user(value, (s32 __user *)arg)) return -EFAULT;
+      WRITE_ONCE(target, value);
+      return 0;
+    case PID_IOC_SET_GAINS:
+      if (copy_from_user(&gains, (void __user *)arg, sizeof(gains))) return -EFAULT;
+      WRITE_ONCE(kp, gains.kp);
+      WRITE_ONCE(ki, gains.ki);
+      WRITE_ONCE(kd, gains.kd);
+      return 0;
+    case PID_IOC_ENABLE:
+      if (get_user(value, (s32 __user *)arg)) return -EFAULT;
+      WRITE_ONCE(enable, value != 0);
+      return 0;
+    case PID_IOC_GET_STATUS:
+      snap = status;
+      if (copy_to_user((void __user *)arg, &snap, sizeof(snap))) return -EFAULT;
+      return 0;
+  }
+  return -ENOTTY;
+}
+
+/** @brief Called when the module is loaded with insmod
+ *  @return 0 on success, negative errno on failure
+ */
+static int __init pid_driver_init(void) {
+  struct pwm_motor_cmd cmd = { .period_ns = period_ns };
+
+  if (rate_hz == 0 || rate_hz > 100000) return -EINVAL;
+  if (period_ns < PWM_PERIOD_MIN_NS || period_ns > PWM_PERIOD_MAX_NS) return -EINVAL;
+  // the controller reverses the motor, pwm_driver must be able to
+  if (pwm_set_motor(&cmd)) {
+    printk(KERN_ERR "pid_driver: pwm_driver cannot switch the motor direction\n");
+    return -EOPNOTSUPP;
+  }
+
+  major_number = register_chrdev(0, NAME, &fops);
+  if (major_number < 0) return major_number;
+
+  this_class = class_create(THIS_MODULE, NAME);
+
+  this_device = device_create(this_class, NULL, MKDEV(major_number, 0), NULL, NAME);
+
+  pid_init(&ctrl, kp, ki, kd, Q16_FROM_INT(FULLROUND));
+  period = ktime_set(0, NSEC_PER_SEC / rate_hz);
+  hrtimer_init(&hr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  hr_timer.function = &pid_tick;
+  hrtimer_start(&hr_timer, period, HRTIMER_MODE_REL);
+  printk(KERN_INFO "pid_driver: running at %u Hz\n", rate_hz);
+  return 0;
+}
+
+/** @brief Called when the module is unloaded with rmmod */
+static void __exit pid_driver_exit(void) {
+  hrtimer_cancel(&hr_timer);
+  pid_stop();
+  device_destroy(this_class, MKDEV(major_number,0));
+  class_unregister(this_class);
+  class_destroy(this_class);
+  unregister_chrdev(major_number, NAME);
+}
+
+/** @brief Registering the module init function with the kernel
+ *
+ *  pid_driver_init: The function that holds the module's init routine
+ */
+module_init(pid_driver_init);
+
+
+/** @brief Registering the module exit function with the kernel
+ *
+ *  pid_driver_exit: The function that holds the module's exit routine
+ */
+module_exit(pid_driver_exit);
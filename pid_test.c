@@ -0,0 +1,199 @@
+/**
+ * @file   pid_test.c
+ *
+ * @brief  host unit tests of the fixed-point controller in pid.h
+ *
+ * Checks the Q16.16 helpers, the shortest-path wrap, the integrator clamp,
+ * derivative on measurement and the shaping of the motor commands against
+ * hand-computed values. Every mismatch is printed and the program exits
+ * with 1, so "make test" fails. Runs anywhere, no hardware needed.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#include <stdio.h>
+
+#include "pid.h"
+
+/** @brief compares two integer values and records a mismatch */
+#define CHECK_EQ(got, want) check_eq(__FILE__, __LINE__, #got, (long long)(got), (long long)(want))
+
+/** @brief number of failed checks */
+static int failures;
+/** @brief number of checks run */
+static int checks;
+
+/** @brief records the result of one check, printing it if it failed
+    @param file is the source file of the check
+    @param line is its line
+    @param expr is the expression checked
+    @param got is its value
+    @param want is the expected value
+*/
+static void check_eq(const char *file, int line, const char *expr, long long got, long long want) {
+	checks++;
+	if (got == want) return;
+	failures++;
+	printf("%s:%d: %s is %lld, expected %lld\n", file, line, expr, got, want);
+}
+
+/** @brief Q16.16 conversions, multiplication and clamping */
+static void test_q16(void) {
+	CHECK_EQ(Q16_FROM_INT(1), Q16_ONE);
+	CHECK_EQ(Q16_FROM_INT(-7), -7*65536);
+	CHECK_EQ(Q16_TO_INT(Q16_FROM_INT(360)), 360);
+	CHECK_EQ(Q16_TO_INT(Q16_FROM_INT(-360)), -360);
+	// conversion back to an integer rounds toward zero on both sides
+	CHECK_EQ(Q16_TO_INT(3*Q16_ONE/2), 1);
+	CHECK_EQ(Q16_TO_INT(-3*Q16_ONE/2), -1);
+	CHECK_EQ(Q16_TO_INT(Q16_ONE-1), 0);
+	CHECK_EQ(Q16_TO_INT(-(Q16_ONE-1)), 0);
+
+	CHECK_EQ(q16_mul(Q16_FROM_INT(2), Q16_FROM_INT(3)), Q16_FROM_INT(6));
+	CHECK_EQ(q16_mul(Q16_FROM_INT(-2), Q16_ONE/2), -Q16_ONE);
+	CHECK_EQ(q16_mul(Q16_ONE/2, Q16_ONE/2), Q16_ONE/4);
+	// the product is shifted, so it rounds toward minus infinity
+	CHECK_EQ(q16_mul(1, 1), 0);
+	CHECK_EQ(q16_mul(-1, 1), -1);
+	// 0.23 * 100 = 22.999
+	CHECK_EQ(q16_mul(PID_KP_DEFAULT, Q16_FROM_INT(100)), 1507300);
+	CHECK_EQ(Q16_TO_INT(q16_mul(PID_KP_DEFAULT, Q16_FROM_INT(100))), 22);
+	// no overflow in the product of two large values
+	CHECK_EQ(q16_mul(Q16_FROM_INT(-150), Q16_FROM_INT(200)), Q16_FROM_INT(-30000));
+
+	CHECK_EQ(q16_clamp(Q16_FROM_INT(5), Q16_FROM_INT(3)), Q16_FROM_INT(3));
+	CHECK_EQ(q16_clamp(Q16_FROM_INT(-5), Q16_FROM_INT(3)), Q16_FROM_INT(-3));
+	CHECK_EQ(q16_clamp(Q16_FROM_INT(2), Q16_FROM_INT(3)), Q16_FROM_INT(2));
+}
+
+/** @brief shortest-path wrap at the edges of a full circle */
+static void test_wrap(void) {
+	q16_t range = Q16_FROM_INT(PID_FULLROUND);
+
+	CHECK_EQ(pid_wrap(0, range), 0);
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(179), range), Q16_FROM_INT(179));
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(-179), range), Q16_FROM_INT(-179));
+	// the result is in [-180, 180), so +180 maps to -180 and -180 stays
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(180), range), Q16_FROM_INT(-180));
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(-180), range), Q16_FROM_INT(-180));
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(180)-1, range), Q16_FROM_INT(180)-1);
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(-180)-1, range), Q16_FROM_INT(180)-1);
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(181), range), Q16_FROM_INT(-179));
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(-181), range), Q16_FROM_INT(179));
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(359), range), Q16_FROM_INT(-1));
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(-359), range), Q16_FROM_INT(1));
+	// a zero range leaves linear inputs alone
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(359), 0), Q16_FROM_INT(359));
+	CHECK_EQ(pid_wrap(Q16_FROM_INT(-359), 0), Q16_FROM_INT(-359));
+}
+
+/** @brief the integrator stops at +-i_max however long the error lasts */
+static void test_integrator_clamp(void) {
+	struct pid_ctrl c;
+	q16_t out = 0;
+	int i;
+
+	pid_init(&c, 0, Q16_ONE, 0, 0);
+	for (i = 0; i < 100; i++) out = pid_update(&c, Q16_FROM_INT(10), 0);
+	CHECK_EQ(c.integ, c.i_max);
+	CHECK_EQ(out, c.i_max);
+	CHECK_EQ(Q16_TO_INT(out), PID_SHIGH/2);
+
+	for (i = 0; i < 100; i++) out = pid_update(&c, Q16_FROM_INT(-10), 0);
+	CHECK_EQ(c.integ, -c.i_max);
+	CHECK_EQ(out, -c.i_max);
+
+	// winds back from the bound right away
+	out = pid_update(&c, Q16_FROM_INT(10), 0);
+	CHECK_EQ(c.integ, -c.i_max+Q16_FROM_INT(10));
+
+	pid_reset(&c);
+	CHECK_EQ(c.integ, 0);
+}
+
+/** @brief a setpoint step moves only the proportional term, a measurement
+           step moves the derivative */
+static void test_derivative_on_measurement(void) {
+	struct pid_ctrl c;
+	q16_t out;
+
+	pid_init(&c, 0, 0, Q16_ONE, Q16_FROM_INT(PID_FULLROUND));
+	CHECK_EQ(pid_update(&c, 0, Q16_FROM_INT(30)), 0);
+	// no kick when the setpoint jumps
+	CHECK_EQ(pid_update(&c, Q16_FROM_INT(90), Q16_FROM_INT(30)), 0);
+	CHECK_EQ(pid_update(&c, Q16_FROM_INT(-90), Q16_FROM_INT(30)), 0);
+
+	// the filter moves half way to the raw derivative of -10
+	out = pid_update(&c, Q16_FROM_INT(-90), Q16_FROM_INT(40));
+	CHECK_EQ(out, Q16_FROM_INT(-5));
+	out = pid_update(&c, Q16_FROM_INT(-90), Q16_FROM_INT(40));
+	CHECK_EQ(out, Q16_FROM_INT(-5)/2);
+
+	// a measurement crossing 0 takes the short way
+	pid_reset(&c);
+	pid_update(&c, 0, Q16_FROM_INT(355));
+	out = pid_update(&c, 0, Q16_FROM_INT(5));
+	CHECK_EQ(out, Q16_FROM_INT(-5));
+
+	// the proportional term alone does follow the setpoint
+	pid_init(&c, Q16_ONE, 0, Q16_ONE, Q16_FROM_INT(PID_FULLROUND));
+	pid_update(&c, 0, 0);
+	CHECK_EQ(pid_update(&c, Q16_FROM_INT(90), 0), Q16_FROM_INT(90));
+}
+
+/** @brief shaping of the controller output into motor commands */
+static void test_motor_shaping(void) {
+	uint32_t period_ns = 1000000;
+	int dir, speed;
+
+	pid_motor_command(Q16_FROM_INT(100), &dir, &speed);
+	CHECK_EQ(dir, PID_CLOCKWISE);
+	CHECK_EQ(speed, PID_SHIGH);
+	pid_motor_command(Q16_FROM_INT(-100), &dir, &speed);
+	CHECK_EQ(dir, PID_COUNTERCLOCK);
+	CHECK_EQ(speed, PID_SHIGH);
+	pid_motor_command(Q16_FROM_INT(PID_SLOW2), &dir, &speed);
+	CHECK_EQ(speed, PID_SLOW1);
+	pid_motor_command(Q16_FROM_INT(-(PID_SLOW1-1)), &dir, &speed);
+	CHECK_EQ(dir, PID_COUNTERCLOCK);
+	CHECK_EQ(speed, PID_SLOW1);
+	pid_motor_command(Q16_FROM_INT(PID_SLOW1), &dir, &speed);
+	CHECK_EQ(speed, PID_SLOW1);
+	pid_motor_command(Q16_FROM_INT(PID_SLOW2-1), &dir, &speed);
+	CHECK_EQ(speed, PID_SLOW2-1);
+	pid_motor_command(Q16_FROM_INT(45), &dir, &speed);
+	CHECK_EQ(speed, 45);
+	// the fraction is dropped toward zero
+	pid_motor_command(Q16_FROM_INT(45)+Q16_ONE/2, &dir, &speed);
+	CHECK_EQ(speed, 45);
+
+	CHECK_EQ(pid_motor_duty(Q16_FROM_INT(100), &dir, period_ns), 700000);
+	CHECK_EQ(dir, PID_CLOCKWISE);
+	CHECK_EQ(pid_motor_duty(Q16_FROM_INT(-100), &dir, period_ns), 700000);
+	CHECK_EQ(dir, PID_COUNTERCLOCK);
+	CHECK_EQ(pid_motor_duty(Q16_FROM_INT(50), &dir, period_ns), 500000);
+	CHECK_EQ(pid_motor_duty(Q16_FROM_INT(PID_SLOW2), &dir, period_ns), 200000);
+	CHECK_EQ(pid_motor_duty(Q16_FROM_INT(PID_SLOW2)-1, &dir, period_ns), 49999);
+	// the fraction of a percent pid_motor_command drops is kept
+	CHECK_EQ(pid_motor_duty(Q16_FROM_INT(45)+Q16_ONE/2, &dir, period_ns), 455000);
+	CHECK_EQ(pid_motor_duty(0, &dir, period_ns), 0);
+
+	CHECK_EQ(pid_motor_speed(Q16_FROM_INT(50), period_ns), 500000);
+	CHECK_EQ(pid_motor_speed(Q16_FROM_INT(-50), period_ns), -500000);
+	CHECK_EQ(pid_motor_speed(Q16_FROM_INT(-3), period_ns), -30000);
+}
+
+/** @brief runs all tests
+    @return 0 if all checks passed, 1 otherwise
+*/
+int main(void) {
+	test_q16();
+	test_wrap();
+	test_integrator_clamp();
+	test_derivative_on_measurement();
+	test_motor_shaping();
+
+	printf("pid_test: %d checks, %d failed\n", checks, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+/**
+ * @file   proto.c
+ *
+ * @brief  binary wire format between server.c and client.c
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "proto.h"
+
+/** @brief define the full round degree */
+#define FULLROUND 360
+
+/** @brief timestamp to echo, passed through proto_peer.echo */
+struct proto_echo {
+	/** @brief latest peer timestamp */
+	int64_t peer_ts;
+	/** @brief local time it was received */
+	int64_t peer_rx_ns;
+};
+
+/** @brief stores a 16 bit value big endian
+    @param p is the destination
+    @param v is the value
+*/
+static void put16(unsigned char *p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+/** @brief stores a 32 bit value big endian
+    @param p is the destination
+    @param v is the value
+*/
+static void put32(unsigned char *p, uint32_t v) {
+	put16(p, v >> 16);
+	put16(p+2, v);
+}
+
+/** @brief stores a 64 bit value big endian
+    @param p is the destination
+    @param v is the value
+*/
+static void put64(unsigned char *p, uint64_t v) {
+	put32(p, v >> 32);
+	put32(p+4, v);
+}
+
+/** @brief loads a 16 bit big endian value
+    @param p is the source
+    @return the value
+*/
+static uint16_t get16(const unsigned char *p) {
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/** @brief loads a 32 bit big endian value
+    @param p is the source
+    @return the value
+*/
+static uint32_t get32(const unsigned char *p) {
+	return (uint32_t)get16(p) << 16 | get16(p+2);
+}
+
+/** @brief loads a 64 bit big endian value
+    @param p is the source
+    @return the value
+*/
+static uint64_t get64(const unsigned char *p) {
+	return (uint64_t)get32(p) << 32 | get32(p+4);
+}
+
+int64_t proto_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+void proto_peer_init(struct proto_peer *peer) {
+	memset(peer, 0, sizeof(*peer));
+}
+
+void proto_encode(const struct proto_msg *msg, unsigned char *buf) {
+	put16(buf, PROTO_MAGIC);
+	buf[2] = PROTO_VERSION;
+	buf[3] = 0;
+	put32(buf+4, msg->seq);
+	put64(buf+8, msg->timestamp_ns);
+	put64(buf+16, msg->echo_ns);
+	put32(buf+24, msg->hold_us);
+	put32(buf+28, msg->target);
+	put32(buf+32, msg->position);
+	put32(buf+36, msg->velocity);
+}
+
+int proto_decode(const unsigned char *buf, struct proto_msg *msg) {
+	if (get16(buf) != PROTO_MAGIC || buf[2] != PROTO_VERSION) return -1;
+	msg->seq = get32(buf+4);
+	msg->timestamp_ns = get64(buf+8);
+	msg->echo_ns = get64(buf+16);
+	msg->hold_us = get32(buf+24);
+	msg->target = get32(buf+28);
+	msg->position = get32(buf+32);
+	msg->velocity = get32(buf+36);
+	return 0;
+}
+
+void proto_pack(struct proto_peer *peer, int32_t target, int32_t position, int32_t velocity,
+                unsigned char *buf) {
+	struct proto_msg msg;
+	struct proto_echo echo;
+
+	mailbox_get(&peer->echo, &echo, sizeof(echo));
+	msg.seq = peer->tx_seq++;
+	msg.timestamp_ns = proto_now();
+	msg.echo_ns = echo.peer_ts;
+	msg.hold_us = echo.peer_ts ? (msg.timestamp_ns-echo.peer_rx_ns)/1000 : 0;
+	msg.target = target;
+	msg.position = position;
+	msg.velocity = velocity;
+	proto_encode(&msg, buf);
+}
+
+int proto_send(int fd, struct proto_peer *peer, int32_t target, int32_t position, int32_t velocity) {
+	unsigned char buf[PROTO_MSG_SIZE];
+	size_t sent = 0;
+	ssize_t n;
+
+	proto_pack(peer, target, position, velocity, buf);
+	while (sent < PROTO_MSG_SIZE) {
+		n = send(fd, buf+sent, PROTO_MSG_SIZE-sent, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		sent += n;
+	}
+	return 0;
+}
+
+/** @brief updates the timing state for an accepted message
+    @param peer is the connection
+    @param msg is the accepted message
+*/
+static void proto_accept(struct proto_peer *peer, const struct proto_msg *msg) {
+	int64_t now = proto_now();
+	struct proto_echo echo = { msg->timestamp_ns, now };
+
+	if (msg->echo_ns)
+		peer->rtt_ns = now-msg->echo_ns-(int64_t)msg->hold_us*1000;
+	if (peer->rx_count && now-peer->peer_rx_ns > peer->rx_gap_max_ns)
+		peer->rx_gap_max_ns = now-peer->peer_rx_ns;
+	peer->peer_ts = msg->timestamp_ns;
+	peer->peer_rx_ns = now;
+	peer->rx_seq = msg->seq;
+	peer->rx_count++;
+	mailbox_put(&peer->echo, &echo, sizeof(echo));
+}
+
+int proto_recv(int fd, struct proto_peer *peer, struct proto_msg *msg) {
+	ssize_t n;
+
+	while (1) {
+		if (peer->rx_len == PROTO_MSG_SIZE) {
+			if (proto_decode(peer->rx_buf, msg) == 0) {
+				peer->rx_len = 0;
+				break;
+			}
+			// not a header: drop one byte and look for the next magic
+			memmove(peer->rx_buf, peer->rx_buf+1, PROTO_MSG_SIZE-1);
+			peer->rx_len--;
+			peer->rx_skipped++;
+		}
+		n = recv(fd, peer->rx_buf+peer->rx_len, PROTO_MSG_SIZE-peer->rx_len, MSG_DONTWAIT);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+		if (n <= 0) return -1;
+		peer->rx_len += n;
+	}
+
+	proto_accept(peer, msg);
+	return 1;
+}
+
+int proto_accept_dgram(struct proto_peer *peer, const unsigned char *buf, size_t len,
+                       struct proto_msg *msg) {
+	int32_t ahead;
+
+	if (len != PROTO_MSG_SIZE || proto_decode(buf, msg) < 0) {
+		peer->rx_skipped += len;
+		return 0;
+	}
+	if (peer->rx_count) {
+		ahead = (int32_t)(msg->seq-peer->rx_seq);
+		if (ahead <= 0) {
+			peer->reordered++;
+			if (peer->lost) peer->lost--;
+			return 0;
+		}
+		peer->lost += ahead-1;
+	}
+	proto_accept(peer, msg);
+	return 1;
+}
+
+int proto_recv_dgram(int fd, struct proto_peer *peer, struct proto_msg *msg) {
+	// one spare byte tells oversized datagrams apart
+	unsigned char buf[PROTO_MSG_SIZE+1];
+	ssize_t n;
+
+	while (1) {
+		n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n < 0 && errno == EINTR) continue;
+		// a connected UDP socket reports ICMP port unreachable here while the
+		// peer is not up yet
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED)) return 0;
+		if (n < 0) return -1;
+		if (proto_accept_dgram(peer, buf, n, msg)) return 1;
+	}
+}
+
+void proto_report(const char *name, struct proto_peer *peer) {
+	int64_t now = proto_now();
+
+	if (now-peer->report_ns < 1000000000LL) return;
+	peer->report_ns = now;
+	printf("%s: rx %lu, lost %lu, reordered %lu, skipped %lu bytes, gap max %lld us, rtt %lld us\n",
+	       name, peer->rx_count, peer->lost, peer->reordered, peer->rx_skipped,
+	       (long long)peer->rx_gap_max_ns/1000, (long long)peer->rtt_ns/1000);
+	peer->rx_gap_max_ns = 0;
+}
+
+int proto_predict(const struct proto_peer *peer, const struct proto_msg *msg) {
+	int64_t delay_ns = peer->rtt_ns > 0 ? peer->rtt_ns/2 : 0;
+	int pos;
+
+	// time since the message arrived counts as delay too
+	delay_ns += proto_now()-peer->peer_rx_ns;
+	pos = msg->position+(int)((int64_t)msg->velocity*delay_ns/1000000000LL);
+	pos %= FULLROUND;
+	if (pos < 0) pos += FULLROUND;
+	return pos;
+}
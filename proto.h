@@ -0,0 +1,200 @@
+/**
+ * @file   proto.h
+ *
+ * @brief  binary wire format between server.c and client.c
+ *
+ * Every message is PROTO_MSG_SIZE bytes, fields in network byte order:
+ *
+ *   offset  size  field
+ *        0     2  magic, PROTO_MAGIC
+ *        2     1  version, PROTO_VERSION
+ *        3     1  flags, 0
+ *        4     4  sequence number
+ *        8     8  sender CLOCK_MONOTONIC time in ns
+ *       16     8  last sender time received from the peer, echoed back
+ *       24     4  time the echoed timestamp was held before sending, in us
+ *       28     4  sender target position in degrees
+ *       32     4  sender measured position in degrees
+ *       36     4  sender velocity in degrees per second
+ *
+ * The echoed timestamp lets each side measure the round trip time with its
+ * own clock, so the two boards need no clock synchronisation.
+ *
+ * The same message is used over TCP and over UDP. Over TCP the stream is
+ * reassembled with proto_recv; over UDP every datagram is one message and
+ * proto_recv_dgram uses the sequence number to drop stale datagrams and count
+ * lost and reordered ones.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _PROTO_H_
+#define _PROTO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mailbox.h"
+
+/** @brief first two bytes of every message */
+#define PROTO_MAGIC 0x4c34
+/** @brief current wire format version */
+#define PROTO_VERSION 1
+/** @brief size of one message on the wire */
+#define PROTO_MSG_SIZE 40
+
+/** @brief one decoded message */
+struct proto_msg {
+	/** @brief sequence number */
+	uint32_t seq;
+	/** @brief sender CLOCK_MONOTONIC time in ns */
+	int64_t timestamp_ns;
+	/** @brief echoed peer timestamp, 0 if none received yet */
+	int64_t echo_ns;
+	/** @brief time the echoed timestamp was held, in us */
+	uint32_t hold_us;
+	/** @brief target position in degrees */
+	int32_t target;
+	/** @brief measured position in degrees */
+	int32_t position;
+	/** @brief velocity in degrees per second */
+	int32_t velocity;
+};
+
+/** @brief framing and timing state of one connection
+ *
+ *  proto_send only touches tx_seq and echo, everything else belongs to the
+ *  receive side, so one thread may send while another receives.
+ */
+struct proto_peer {
+	/** @brief bytes of a partially received message */
+	unsigned char rx_buf[PROTO_MSG_SIZE];
+	/** @brief number of valid bytes in rx_buf */
+	size_t rx_len;
+	/** @brief sequence number of the next message sent */
+	uint32_t tx_seq;
+	/** @brief timestamp of the latest message received from the peer */
+	int64_t peer_ts;
+	/** @brief local time the latest message was received */
+	int64_t peer_rx_ns;
+	/** @brief latest round trip time estimate in ns, 0 if unknown */
+	int64_t rtt_ns;
+	/** @brief bytes skipped while resynchronising on a bad header */
+	unsigned long rx_skipped;
+	/** @brief sequence number of the newest message accepted */
+	uint32_t rx_seq;
+	/** @brief number of messages accepted */
+	unsigned long rx_count;
+	/** @brief sequence numbers skipped and not seen since */
+	unsigned long lost;
+	/** @brief datagrams that arrived after a newer one and were dropped */
+	unsigned long reordered;
+	/** @brief longest time between two accepted messages since the last
+	           report, in ns */
+	int64_t rx_gap_max_ns;
+	/** @brief time of the last proto_report output */
+	int64_t report_ns;
+	/** @brief peer_ts and peer_rx_ns handed from the receive side to the
+	           send side */
+	struct mailbox echo;
+};
+
+/** @brief returns the CLOCK_MONOTONIC time in ns
+    @return the time in ns
+*/
+int64_t proto_now(void);
+
+/** @brief resets the state of a connection
+    @param peer is the connection
+*/
+void proto_peer_init(struct proto_peer *peer);
+
+/** @brief fills in the header and timing fields of one message and packs
+           it into its wire format
+    @param peer is the connection
+    @param target is the target position in degrees
+    @param position is the measured position in degrees
+    @param velocity is the velocity in degrees per second
+    @param buf receives PROTO_MSG_SIZE bytes
+*/
+void proto_pack(struct proto_peer *peer, int32_t target, int32_t position, int32_t velocity,
+                unsigned char *buf);
+
+/** @brief fills in the header and timing fields and sends one message,
+           retrying on partial writes
+    @param fd is the connected socket
+    @param peer is the connection
+    @param target is the target position in degrees
+    @param position is the measured position in degrees
+    @param velocity is the velocity in degrees per second
+    @return 0 on success, -1 on error
+*/
+int proto_send(int fd, struct proto_peer *peer, int32_t target, int32_t position, int32_t velocity);
+
+/** @brief receives at most one message without blocking
+ *
+ *  Partial messages are buffered in the peer until the rest arrives. Bytes
+ *  that do not start a valid header are skipped to resynchronise.
+ *
+    @param fd is the connected socket
+    @param peer is the connection
+    @param msg receives the message
+    @return 1 if msg was filled, 0 if no complete message is available yet,
+            -1 on error or when the peer closed the connection
+*/
+int proto_recv(int fd, struct proto_peer *peer, struct proto_msg *msg);
+
+/** @brief receives the newest message on a datagram socket without blocking
+ *
+ *  Datagrams of the wrong size or with a bad header are skipped. A datagram
+ *  whose sequence number is not newer than the last accepted one is stale and
+ *  dropped; gaps in the sequence are counted as lost until the missing
+ *  datagram shows up late.
+ *
+    @param fd is the connected datagram socket
+    @param peer is the connection
+    @param msg receives the message
+    @return 1 if msg was filled, 0 if no new message is available, -1 on error
+*/
+int proto_recv_dgram(int fd, struct proto_peer *peer, struct proto_msg *msg);
+
+/** @brief checks a datagram received some other way, like an io_uring
+           completion, the way proto_recv_dgram checks its own
+    @param peer is the connection
+    @param buf is the datagram
+    @param len is its length
+    @param msg receives the message
+    @return 1 if msg was filled, 0 if the datagram was dropped
+*/
+int proto_accept_dgram(struct proto_peer *peer, const unsigned char *buf, size_t len,
+                       struct proto_msg *msg);
+
+/** @brief prints the receive counters about once per second
+    @param name tags the output line
+    @param peer is the connection, its gap maximum is reset after printing
+*/
+void proto_report(const char *name, struct proto_peer *peer);
+
+/** @brief packs a message into its wire format
+    @param msg is the message
+    @param buf receives PROTO_MSG_SIZE bytes
+*/
+void proto_encode(const struct proto_msg *msg, unsigned char *buf);
+
+/** @brief unpacks a message from its wire format
+    @param buf holds PROTO_MSG_SIZE bytes
+    @param msg receives the message
+    @return 0 on success, -1 if magic or version do not match
+*/
+int proto_decode(const unsigned char *buf, struct proto_msg *msg);
+
+/** @brief extrapolates the peer position to now using its velocity and half
+           the round trip time
+    @param peer is the connection, for the round trip time
+    @param msg is the latest message from the peer
+    @return the predicted peer position in degrees, 0 to 359
+*/
+int proto_predict(const struct proto_peer *peer, const struct proto_msg *msg);
+
+#endif /* _PROTO_H_ */
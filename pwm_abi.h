@@ -0,0 +1,122 @@
+/**
+ * @file   pwm_abi.h
+ *
+ * @brief  ioctl interface of the pwm driver, shared by the LKM driver and
+ *         the user programs
+ *
+ * Each /dev/motor_pwm* node is one channel with its own period. Settings
+ * are staged and take effect at the channel's next period boundary. read()
+ * returns the staged setting as text, "period_ns duty_ns".
+ *
+ * A channel can also play a queue of segments on its own: PWM_IOC_QUEUE
+ * appends a batch of them in one call and the driver switches from one to
+ * the next at period boundaries. When the queue runs dry the last segment
+ * is held and an underrun is counted. PWM_IOC_SET or a text write replaces
+ * whatever is queued.
+ *
+ * PWM_IOC_MOTOR sets the H-bridge direction and the duty in one call. Both
+ * change together at the next period boundary, so the motor never runs the
+ * new direction with the old duty. Writing "period_ns speed_ns" as text,
+ * the two fields of struct pwm_motor_cmd, does the same without the ioctl.
+ * The direction is switched from the pwm timer, so it needs motor_driver
+ * loaded first with its register backend; otherwise PWM_IOC_MOTOR and
+ * segments with a direction fail with EOPNOTSUPP.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _PWM_ABI_H_
+#define _PWM_ABI_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/** @brief shortest period accepted, bounds the timer interrupt rate */
+#define PWM_PERIOD_MIN_NS 20000
+/** @brief longest period accepted */
+#define PWM_PERIOD_MAX_NS 1000000000
+/** @brief period a channel starts with, 1 kHz */
+#define PWM_PERIOD_DEFAULT_NS 1000000
+
+/** @brief one channel setting */
+struct pwm_setting {
+	/** @brief period in ns, PWM_PERIOD_MIN_NS to PWM_PERIOD_MAX_NS */
+	__u32 period_ns;
+	/** @brief high time in ns, 0 to period_ns */
+	__u32 duty_ns;
+};
+
+/** @brief number of segments a channel queue holds */
+#define PWM_QUEUE_LEN 64
+/** @brief segment direction that leaves the motor direction alone */
+#define PWM_DIR_KEEP (-1)
+/** @brief PWM_IOC_QUEUE flag: drop the queued segments first */
+#define PWM_QUEUE_REPLACE 1
+
+/** @brief one queued segment */
+struct pwm_segment {
+	/** @brief how long the segment plays, in ns; it ends at the first
+	           period boundary at or after that */
+	__u32 duration_ns;
+	/** @brief period in ns, PWM_PERIOD_MIN_NS to PWM_PERIOD_MAX_NS */
+	__u32 period_ns;
+	/** @brief high time in ns, 0 to period_ns */
+	__u32 duty_ns;
+	/** @brief motor direction applied when the segment starts, MOTOR_STOP,
+	           MOTOR_CLOCKWISE, MOTOR_COUNTERCLOCK, MOTOR_BRAKE or
+	           PWM_DIR_KEEP */
+	__s32 dir;
+};
+
+/** @brief argument of PWM_IOC_QUEUE */
+struct pwm_queue {
+	/** @brief user pointer to the segments */
+	__u64 segments;
+	/** @brief number of segments, at most PWM_QUEUE_LEN */
+	__u32 count;
+	/** @brief PWM_QUEUE_REPLACE or 0 */
+	__u32 flags;
+};
+
+/** @brief argument of PWM_IOC_QUEUE_STATUS */
+struct pwm_queue_status {
+	/** @brief segments waiting, not counting the one playing */
+	__u32 depth;
+	/** @brief times the queue ran dry while playing */
+	__u32 underruns;
+	/** @brief segments started since load */
+	__u64 played;
+};
+
+/** @brief PWM_IOC_MOTOR flag: at zero speed short the motor instead of
+           letting it coast */
+#define PWM_MOTOR_BRAKE 1
+
+/** @brief argument of PWM_IOC_MOTOR */
+struct pwm_motor_cmd {
+	/** @brief period in ns, PWM_PERIOD_MIN_NS to PWM_PERIOD_MAX_NS */
+	__u32 period_ns;
+	/** @brief signed high time in ns: positive turns clockwise, negative
+	           counterclockwise, at most period_ns either way */
+	__s32 speed_ns;
+	/** @brief PWM_MOTOR_BRAKE or 0 */
+	__u32 flags;
+};
+
+/** @brief ioctl magic number of the pwm driver */
+#define PWM_IOC_MAGIC 'w'
+/** @brief stages a new setting, EINVAL if it is out of range */
+#define PWM_IOC_SET _IOW(PWM_IOC_MAGIC, 1, struct pwm_setting)
+/** @brief returns the most recently staged setting */
+#define PWM_IOC_GET _IOR(PWM_IOC_MAGIC, 2, struct pwm_setting)
+/** @brief appends segments to the queue, returns how many fit, EINVAL if
+           one of them is out of range */
+#define PWM_IOC_QUEUE _IOW(PWM_IOC_MAGIC, 3, struct pwm_queue)
+/** @brief returns the queue depth and counters */
+#define PWM_IOC_QUEUE_STATUS _IOR(PWM_IOC_MAGIC, 4, struct pwm_queue_status)
+/** @brief stages direction and duty together, EINVAL if out of range,
+           EOPNOTSUPP if the driver cannot switch the direction */
+#define PWM_IOC_MOTOR _IOW(PWM_IOC_MAGIC, 5, struct pwm_motor_cmd)
+
+#endif /* _PWM_ABI_H_ */
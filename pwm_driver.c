@@ -3,6 +3,50 @@
  *
  * @brief  LKM driver for the RPi motor pwm
  *
+ * The pwm is generated by one hrtimer that runs on absolute expiries: every
+ * edge is scheduled relative to the start of its period, never relative to
+ * when the callback happened to run, so callback latency does not add up to
+ * drift. New duty and period settings are staged and only taken over at the
+ * next period boundary, which keeps every period whole. At 0% and 100% duty
+ * the pin is set once and the timer stops until the duty changes again.
+ *
+ * One timer drives up to PWM_MAX_CHANNELS channels, one device node per
+ * channel: motor_pwm for the first, motor_pwm1, motor_pwm2, ... for the
+ * others. Every channel has its own period and keeps the absolute time of
+ * its next edge; the timer is armed for the earliest of them and each
+ * callback switches every channel that is due, so channels whose edges
+ * coincide share one interrupt. A channel that starts while another one
+ * runs with the same period is aligned to that channel's period boundary,
+ * which makes their rising edges coincide. The timer then fires once per
+ * distinct edge time rather than twice per channel.
+ *
+ * Settings are written in ns through the PWM_IOC_SET ioctl, see pwm_abi.h.
+ * Writing a duty cycle in percent as text still works, and writing
+ * "period_ns speed_ns" as text does what PWM_IOC_MOTOR does, for callers
+ * that can only write, like an io_uring submission. PWM_IOC_QUEUE loads
+ * a batch of segments that the timer plays back by itself, switching at
+ * period boundaries; a channel with a queue keeps the timer running at 0%
+ * and 100% duty so its segments still end on time.
+ *
+ * PWM_IOC_MOTOR stages a direction for motor_driver along with the duty and
+ * applies both at the same period boundary. The direction is switched from
+ * the timer callback, in hard interrupt context, so this only works with
+ * motor_driver loaded before pwm_driver and writing its pins through the
+ * registers. Otherwise directions fail with EOPNOTSUPP and the duty alone
+ * can still be set; pwm_driver does not need motor_driver to load.
+ *
+ * The pins are written through gpio_fast.h: by default every edge time is
+ * one store to GPCLR0 for the channels going low and one to GPSET0 for
+ * those going high, whatever the number of channels. gpio_mmio=0 switches
+ * to gpiolib. gpiolib chips that can sleep, gpio-sim for one, must not be
+ * written from the timer; if any pin is on one, the timer hands the edges
+ * to a SCHED_FIFO kernel thread that writes them, so the edges lag the
+ * timer by the thread's wakeup latency.
+ *
+ * Edge latency and period error are collected in
+ * /sys/kernel/debug/motor_pwm/stats, writing to the file clears them.
+ * Timer fires and staged settings are also traced, see motor_trace.h.
+ *
  * @author David Dong haochend@andrew.cmu.edu
  */
 #include <linux/init.h>   // Macros used to mark up functions e.g. __init __exit
@@ -16,9 +60,23 @@
 #include <linux/interrupt.h> // Required for the IRQ code
 #include <linux/hrtimer.h> // Required for hrtimer
 #include <linux/ktime.h>  // Required for ktime
+#include <linux/spinlock.h> // Required for the staged settings lock
+#include <linux/debugfs.h> // Required for the jitter statistics
+#include <linux/seq_file.h> // Required for the jitter statistics
+#include <linux/math64.h> // Required for 64 bit division on 32 bit ARM
+#include <linux/slab.h>   // Required for the segment batch buffer
+#include <linux/kthread.h> // Required for the pin writer of sleeping chips
+#include <linux/sched.h>  // Required for the pin writer of sleeping chips
+
+#include "driver_exports.h"
+#include "gpio_fast.h"
+#include "pwm_abi.h"
+#include "motor_trace.h"
 
 /** @brief the pwm pin number */
 #define gpioPWM 12
+/** @brief the max number of channels */
+#define PWM_MAX_CHANNELS 8
 /** @brief the name of the device */
 #define NAME "motor_pwm"
 /** @brief Module info: license */
@@ -30,32 +88,117 @@ MODULE_DESCRIPTION("A simple Linux motor driver for the RPi motor");
 /** @brief Module info: version */
 MODULE_VERSION("0.1");
 
+/** @brief one pwm channel */
+struct pwm_channel {
+  /** @brief the gpio pin */
+  int pin;
+  /** @brief channel number, its bit in running_mask */
+  int index;
+  /** @brief setting taken over at the next period boundary */
+  struct pwm_setting pending;
+  /** @brief motor direction applied at the next period boundary, or
+             PWM_DIR_KEEP */
+  int pending_dir;
+  /** @brief period of the current period, in ns */
+  u32 period_ns;
+  /** @brief high time of the current period, in ns */
+  u32 on_ns;
+  /** @brief absolute start of the current period, or of the next one once
+             the falling edge is done */
+  ktime_t period_start;
+  /** @brief absolute time of the next edge */
+  ktime_t next;
+  /** @brief true if the next edge is a falling edge */
+  bool falling;
+  /** @brief time the current period actually started, 0 if none */
+  ktime_t last_rise;
+  /** @brief queued segments */
+  struct pwm_segment queue[PWM_QUEUE_LEN];
+  /** @brief index of the next segment to play, free running */
+  u32 q_head;
+  /** @brief index of the next free slot, free running */
+  u32 q_tail;
+  /** @brief true while a queued segment is playing */
+  bool playing;
+  /** @brief absolute end of the playing segment */
+  ktime_t seg_end;
+  /** @brief times the queue ran dry while playing */
+  u32 underruns;
+  /** @brief segments started */
+  u64 played;
+};
+
+/** @brief edge timing statistics, exported through debugfs */
+struct pwm_stats {
+  /** @brief timer callbacks, each generates one or more edges */
+  u64 fires;
+  /** @brief summed lateness of the timer callback in ns */
+  u64 late_sum_ns;
+  /** @brief largest lateness of the timer callback in ns */
+  s64 late_max_ns;
+  /** @brief periods measured between two period starts */
+  u64 periods;
+  /** @brief largest difference of a measured period to its setting in ns */
+  s64 period_err_max_ns;
+  /** @brief periods skipped because the callback ran more than a period late */
+  u64 missed;
+  /** @brief edges dropped because the pin writer had not caught up */
+  u64 collapsed;
+};
+
+/** @brief gpio pins of the channels */
+static int pins[PWM_MAX_CHANNELS] = { gpioPWM };
+/** @brief number of channels */
+static int npins = 1;
+module_param_array(pins, int, &npins, 0444);
+MODULE_PARM_DESC(pins, "gpio pins of the pwm channels, one device node each");
+
+/** @brief write the pins through the GPIO registers, or through gpiolib if
+           false */
+static bool gpio_mmio = true;
+module_param(gpio_mmio, bool, 0444);
+MODULE_PARM_DESC(gpio_mmio, "write the pins straight to the GPIO registers (default) or use gpiolib");
+
+/** @brief access to the pins */
+static struct gpio_fast gpio;
+/** @brief writes the pins when one of them can sleep, NULL otherwise */
+static struct task_struct *writer;
+/** @brief channels the writer has to raise, protected by pwm_lock */
+static u32 write_rise;
+/** @brief channels the writer has to lower, protected by pwm_lock */
+static u32 write_fall;
+/** @brief motor_set_dir of motor_driver, NULL if directions cannot be
+           switched from the timer */
+static void (*set_dir)(int dir);
+
 /** @brief the hr timer struct */
 static struct hrtimer hr_timer;
-/** @brief the ktime struct */
-static ktime_t ktime;
-/** @brief time interval */
+/** @brief default period in ns */
 unsigned long timer_interval_ns = 1e6;
-/** @brief time interval for off */
-static unsigned long off;
-/** @brief time interval for duty cycle on */
-static unsigned long on;
 /** @brief device major number */
 static int major_number;
-/** @brief number of cycles */
-static int cycle = 0;
-/** @brief on/off indicator of duty cycle */
-static bool onOrOff = false;
+/** @brief protects everything below, taken by the timer callback */
+static DEFINE_SPINLOCK(pwm_lock);
+/** @brief the channels */
+static struct pwm_channel channels[PWM_MAX_CHANNELS];
+/** @brief channels that need the timer, one bit per channel; the timer is
+           stopped while it is 0, when all channels sit at 0% or 100% duty */
+static u32 running_mask;
+/** @brief edge timing statistics */
+static struct pwm_stats stats;
+/** @brief debugfs directory */
+static struct dentry *debug_dir;
 /** @brief class struct pointer */
 static struct class*  this_class  = NULL; 
-/** @brief device struct pointer */
-static struct device* this_device = NULL;
+/** @brief device struct pointers, one per channel */
+static struct device* this_device[PWM_MAX_CHANNELS];
 
 
 static int driver_open(struct inode *inodep, struct file *filep);
 static int driver_release(struct inode *inodep, struct file *filep);
-static ssize_t driver_read(struct file *filep, char *buffer, size_t len, loff_t *offset);
-static ssize_t driver_write(struct file *filep, const char *buffer, size_t len, loff_t *offset);
+static ssize_t driver_read(struct file *filep, char __user *buffer, size_t len, loff_t *offset);
+static ssize_t driver_write(struct file *filep, const char __user *buffer, size_t len, loff_t *offset);
+static long driver_ioctl(struct file *filep, unsigned int cmd, unsigned long arg);
 
 /** @brief The file operations structure lists the
  *         callback functions that you can associate with the file operations.
@@ -64,65 +207,496 @@ static struct file_operations fops ={
   .open = driver_open,
   .read = driver_read,
   .write = driver_write,
+  .unlocked_ioctl = driver_ioctl,
   .release = driver_release,
 };
 
+/** @brief records the lateness of a timer callback. Called with pwm_lock
+ *         held.
+    @param timer is the pwm timer
+    @param now is the current time
+*/
+static void pwm_account(struct hrtimer *timer, ktime_t now) {
+  s64 late = ktime_to_ns(ktime_sub(now, hrtimer_get_expires(timer)));
+
+  trace_motor_timer_fire(NAME, late);
+  stats.fires++;
+  stats.late_sum_ns += late;
+  if (late > stats.late_max_ns) stats.late_max_ns = late;
+}
+
+/** @brief returns the pins of several channels
+ *  @param mask selects the channels, one bit per channel
+ *  @return the pins, one bit per gpio
+ */
+static u64 pwm_pins(u32 mask) {
+  u64 pins_mask = 0;
+  int i;
+
+  for (i = 0; mask; i++, mask >>= 1)
+    if (mask & 1) pins_mask |= BIT_ULL(channels[i].pin);
+  return pins_mask;
+}
+
+/** @brief drives the pins of several channels together. Called with
+ *         pwm_lock held.
+ *  @param rise selects the channels to raise, one bit per channel
+ *  @param fall selects the channels to lower
+ */
+static void pwm_write(u32 rise, u32 fall) {
+  int i;
+
+  if (gpio.regs) {
+    gpio_fast_write(&gpio, pwm_pins(rise), pwm_pins(fall));
+    return;
+  }
+  if (writer) {
+    // a pulse the writer missed collapses into the level it ended with
+    if ((write_rise & fall) | (write_fall & rise)) stats.collapsed++;
+    write_rise = (write_rise & ~fall) | rise;
+    write_fall = (write_fall & ~rise) | fall;
+    wake_up_process(writer);
+    return;
+  }
+  // gpiolib takes any gpio number, also the ones of gpio-sim above 63
+  for (i = 0; rise | fall; i++, rise >>= 1, fall >>= 1)
+    if ((rise | fall) & 1) gpio_set_value(channels[i].pin, rise & 1);
+}
+
+/** @brief writes the edges the timer hands over, for pins that can sleep
+ *  @param data is unused
+ *  @return 0 once stopped
+ */
+static int pwm_writer(void *data) {
+  unsigned long flags;
+  u32 rise, fall;
+  int i;
+
+  while (!kthread_should_stop()) {
+    // set before taking the edges, so a wakeup in between is not lost
+    set_current_state(TASK_INTERRUPTIBLE);
+    spin_lock_irqsave(&pwm_lock, flags);
+    rise = write_rise;
+    fall = write_fall;
+    write_rise = write_fall = 0;
+    spin_unlock_irqrestore(&pwm_lock, flags);
+    if (!(rise | fall)) {
+      schedule();
+      continue;
+    }
+    __set_current_state(TASK_RUNNING);
+    for (i = 0; rise | fall; i++, rise >>= 1, fall >>= 1)
+      if ((rise | fall) & 1) gpio_set_value_cansleep(channels[i].pin, rise & 1);
+  }
+  __set_current_state(TASK_RUNNING);
+  return 0;
+}
+
+/** @brief moves the start of the next period of a channel one period past
+ *         ch->period_start, skipping periods a late callback missed. Called
+ *         with pwm_lock held.
+ *  @param ch is the channel
+ *  @param now is the current time
+ */
+static void pwm_next_period(struct pwm_channel *ch, ktime_t now) {
+  ktime_t next = ktime_add_ns(ch->period_start, ch->period_ns);
+
+  while (ktime_before(next, now)) {
+    next = ktime_add_ns(next, ch->period_ns);
+    stats.missed++;
+  }
+  ch->period_start = next;
+  ch->next = next;
+}
+
+/** @brief switches to the next queued segment once the playing one is over.
+ *         Called at a period boundary with pwm_lock held.
+ *  @param ch is the channel
+ */
+static void pwm_queue_advance(struct pwm_channel *ch) {
+  struct pwm_segment *seg;
+
+  if (ch->playing && ktime_before(ch->period_start, ch->seg_end)) return;
+  if (ch->q_head == ch->q_tail) {
+    // hold the last segment
+    if (ch->playing) ch->underruns++;
+    ch->playing = false;
+    return;
+  }
+  seg = &ch->queue[ch->q_head++ % PWM_QUEUE_LEN];
+  ch->pending.period_ns = seg->period_ns;
+  ch->pending.duty_ns = seg->duty_ns;
+  ch->seg_end = ktime_add_ns(ch->period_start, seg->duration_ns);
+  if (seg->dir != PWM_DIR_KEEP) ch->pending_dir = seg->dir;
+  trace_motor_pwm_update(ch->index, seg->period_ns, seg->duty_ns, seg->dir);
+  ch->playing = true;
+  ch->played++;
+}
+
+/** @brief starts a new period of a channel at ch->period_start: takes over
+ *         the staged setting and schedules the falling edge. Called with
+ *         pwm_lock held.
+ *  @param ch is the channel
+ *  @param now is the current time
+ *  @param rise collects the channels to raise
+ *  @param fall collects the channels to lower
+ */
+static void pwm_period_begin(struct pwm_channel *ch, ktime_t now, u32 *rise, u32 *fall) {
+  s64 err;
+
+  if (ktime_to_ns(ch->last_rise)) {
+    err = ktime_to_ns(ktime_sub(now, ch->last_rise)) - ch->period_ns;
+    if (err < 0) err = -err;
+    stats.periods++;
+    if (err > stats.period_err_max_ns) stats.period_err_max_ns = err;
+  }
+
+  pwm_queue_advance(ch);
+  if (ch->pending_dir != PWM_DIR_KEEP) {
+    set_dir(ch->pending_dir);
+    ch->pending_dir = PWM_DIR_KEEP;
+  }
+  ch->period_ns = ch->pending.period_ns;
+  ch->on_ns = ch->pending.duty_ns;
+  if (ch->on_ns == 0 || ch->on_ns == ch->period_ns) {
+    *(ch->on_ns ? rise : fall) |= BIT(ch->index);
+    ch->last_rise = ktime_set(0, 0);
+    if (ch->playing) {
+      // no edges, but the segment still has to end on time
+      running_mask |= BIT(ch->index);
+      ch->falling = false;
+      pwm_next_period(ch, now);
+      return;
+    }
+    // nothing to time, the pin stays put until the next setting
+    running_mask &= ~BIT(ch->index);
+    return;
+  }
+  *rise |= BIT(ch->index);
+  running_mask |= BIT(ch->index);
+  ch->last_rise = now;
+  ch->falling = true;
+  ch->next = ktime_add_ns(ch->period_start, ch->on_ns);
+}
+
+/** @brief generates the due edge of a channel and schedules the next one.
+ *         Called with pwm_lock held.
+ *  @param ch is the channel
+ *  @param now is the current time
+ *  @param rise collects the channels to raise
+ *  @param fall collects the channels to lower
+ */
+static void pwm_channel_edge(struct pwm_channel *ch, ktime_t now, u32 *rise, u32 *fall) {
+  if (!ch->falling) {
+    pwm_period_begin(ch, now, rise, fall);
+    return;
+  }
+  *fall |= BIT(ch->index);
+  ch->falling = false;
+  pwm_next_period(ch, now);
+}
+
+/** @brief returns the earliest edge of all running channels. Called with
+ *         pwm_lock held and running_mask non-zero.
+ *  @return the absolute time of the edge
+ */
+static ktime_t pwm_next_expiry(void) {
+  ktime_t next = ktime_set(KTIME_SEC_MAX, 0);
+  int i;
+
+  for (i = 0; i < npins; i++)
+    if ((running_mask & BIT(i)) && ktime_before(channels[i].next, next))
+      next = channels[i].next;
+  return next;
+}
+
 /** @brief this function iscalled when a hr timer reaches 0 
     @param timer is the hrtimer that is currently used 
 */
 enum hrtimer_restart my_hrtimer_callback(struct hrtimer *timer){
-  ktime_t waitTime, now;
+  enum hrtimer_restart ret = HRTIMER_NORESTART;
+  u32 rise = 0, fall = 0;
+  ktime_t now;
+  int i;
+
+  spin_lock(&pwm_lock);
   now = ktime_get();
+  pwm_account(timer, now);
 
-  if (onOrOff) {
-    waitTime = ktime_set(0, on);
-    gpio_set_value(gpioPWM, onOrOff);
-    onOrOff = !onOrOff;
+  // every channel that is due, also ones a late callback overtook
+  for (i = 0; i < npins; i++)
+    if ((running_mask & BIT(i)) && !ktime_after(channels[i].next, now))
+      pwm_channel_edge(&channels[i], now, &rise, &fall);
+  pwm_write(rise, fall);
+
+  if (running_mask) {
+    hrtimer_set_expires(timer, pwm_next_expiry());
+    ret = HRTIMER_RESTART;
+  }
+  spin_unlock(&pwm_lock);
+  return ret;
+}
+
+/** @brief starts a stopped channel with its pending setting or its queue.
+ *         Called with pwm_lock held.
+ *  @param ch is the channel
+ */
+static void pwm_start(struct pwm_channel *ch) {
+  struct pwm_setting *set = &ch->pending;
+  u32 rise = 0, fall = 0;
+  ktime_t now = ktime_get();
+  int i;
+
+  if (running_mask & BIT(ch->index)) return;
+  ch->period_start = now;
+  ch->last_rise = ktime_set(0, 0);
+  // share period boundaries with a running channel of the same period,
+  // a static level or a queue is applied right away
+  for (i = 0; i < npins && set->duty_ns && set->duty_ns < set->period_ns &&
+              ch->q_head == ch->q_tail; i++) {
+    if (!(running_mask & BIT(i)) || channels[i].period_ns != set->period_ns) continue;
+    ch->period_start = channels[i].falling ? ktime_add_ns(channels[i].period_start, set->period_ns)
+                                           : channels[i].period_start;
+    break;
+  }
+  if (ktime_after(ch->period_start, now)) {
+    // the pin keeps its static level until the shared boundary
+    ch->falling = false;
+    ch->next = ch->period_start;
+    running_mask |= BIT(ch->index);
   } else {
-    waitTime = ktime_set(0, off);
-    gpio_set_value(gpioPWM, onOrOff);
-    onOrOff = !onOrOff;
+    pwm_period_begin(ch, now, &rise, &fall);
+    pwm_write(rise, fall);
+  }
+  if (running_mask & BIT(ch->index))
+    hrtimer_start(&hr_timer, pwm_next_expiry(), HRTIMER_MODE_ABS);
+}
+
+/** @brief stages a new setting of one channel for its next period boundary,
+ *         dropping its queue and starting the channel if it is stopped
+ *  @param ch is the channel
+ *  @param set is the setting, already validated
+ *  @param dir is the motor direction to apply with it, or PWM_DIR_KEEP to
+ *         leave the direction staged so far
+ */
+static void pwm_stage(struct pwm_channel *ch, const struct pwm_setting *set, int dir) {
+  unsigned long flags;
+
+  trace_motor_pwm_update(ch->index, set->period_ns, set->duty_ns, dir);
+  spin_lock_irqsave(&pwm_lock, flags);
+  ch->pending = *set;
+  // a reversal staged for the same boundary must survive a duty-only update
+  if (dir != PWM_DIR_KEEP) ch->pending_dir = dir;
+  ch->q_head = ch->q_tail;
+  ch->playing = false;
+  pwm_start(ch);
+  spin_unlock_irqrestore(&pwm_lock, flags);
+}
+
+/** @brief appends segments to the queue of a channel and starts playback if
+ *         the channel is stopped
+ *  @param ch is the channel
+ *  @param segs are the segments, already validated
+ *  @param count is the number of segments
+ *  @param replace drops the queued segments first
+ *  @return the number of segments that fit into the queue
+ */
+static int pwm_enqueue(struct pwm_channel *ch, const struct pwm_segment *segs, u32 count, bool replace) {
+  unsigned long flags;
+  u32 i;
+
+  spin_lock_irqsave(&pwm_lock, flags);
+  if (replace) ch->q_head = ch->q_tail;
+  for (i = 0; i < count && ch->q_tail - ch->q_head < PWM_QUEUE_LEN; i++)
+    ch->queue[ch->q_tail++ % PWM_QUEUE_LEN] = segs[i];
+  pwm_start(ch);
+  spin_unlock_irqrestore(&pwm_lock, flags);
+  return i;
+}
+
+/** @brief prints the edge timing statistics
+ *  @param m is the seq_file
+ *  @param v is unused
+ *  @return 0
+ */
+static int pwm_stats_show(struct seq_file *m, void *v) {
+  // the queues make whole channels too big to copy onto the stack
+  struct {
+    u32 period_ns, on_ns, queued, underruns;
+  } ch[PWM_MAX_CHANNELS];
+  struct pwm_stats snap;
+  unsigned long flags;
+  u32 running;
+  int i;
+
+  spin_lock_irqsave(&pwm_lock, flags);
+  snap = stats;
+  running = running_mask;
+  for (i = 0; i < npins; i++) {
+    ch[i].period_ns = channels[i].period_ns;
+    ch[i].on_ns = channels[i].on_ns;
+    ch[i].queued = channels[i].q_tail - channels[i].q_head;
+    ch[i].underruns = channels[i].underruns;
   }
-  hrtimer_forward(timer, now, waitTime);
-  return HRTIMER_RESTART;
+  spin_unlock_irqrestore(&pwm_lock, flags);
+
+  for (i = 0; i < npins; i++)
+    seq_printf(m, "channel%d: gpio %d period_ns %u on_ns %u running %d queued %u underruns %u\n",
+               i, channels[i].pin, ch[i].period_ns, ch[i].on_ns, !!(running & BIT(i)),
+               ch[i].queued, ch[i].underruns);
+  seq_printf(m, "timer_fires: %llu\nfire_late_avg_ns: %llu\nfire_late_max_ns: %lld\n",
+             snap.fires, snap.fires ? div64_u64(snap.late_sum_ns, snap.fires) : 0,
+             snap.late_max_ns);
+  seq_printf(m, "periods: %llu\nperiod_err_max_ns: %lld\nmissed: %llu\ncollapsed: %llu\n",
+             snap.periods, snap.period_err_max_ns, snap.missed, snap.collapsed);
+  return 0;
+}
+
+/** @brief opens the statistics file
+ *  @param inode is the debugfs inode
+ *  @param file is the file
+ *  @return 0 on success
+ */
+static int pwm_stats_open(struct inode *inode, struct file *file) {
+  return single_open(file, pwm_stats_show, NULL);
+}
+
+/** @brief clears the statistics on any write
+ *  @param file is the file
+ *  @param buf is ignored
+ *  @param len is the length written
+ *  @param ppos is ignored
+ *  @return len
+ */
+static ssize_t pwm_stats_write(struct file *file, const char __user *buf, size_t len, loff_t *ppos) {
+  unsigned long flags;
+
+  spin_lock_irqsave(&pwm_lock, flags);
+  memset(&stats, 0, sizeof(stats));
+  spin_unlock_irqrestore(&pwm_lock, flags);
+  return len;
+}
+
+/** @brief file operations of the debugfs statistics file */
+static const struct file_operations stats_fops = {
+  .owner = THIS_MODULE,
+  .open = pwm_stats_open,
+  .read = seq_read,
+  .write = pwm_stats_write,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
+
+/** @brief starts the pin writer if a pin is on a gpiolib chip that can
+ *         sleep
+ *  @return 0 on success, negative errno if the thread cannot be started
+ */
+static int __init pwm_writer_init(void) {
+  bool can_sleep = false;
+  int i;
+
+  for (i = 0; i < npins && !gpio.regs; i++)
+    if (gpio_cansleep(pins[i])) can_sleep = true;
+  if (!can_sleep) return 0;
+  writer = kthread_run(pwm_writer, NULL, NAME);
+  if (IS_ERR(writer)) {
+    int err = PTR_ERR(writer);
+
+    writer = NULL;
+    return err;
+  }
+  sched_set_fifo(writer);
+  return 0;
+}
+
+/** @brief looks up motor_set_dir, which the timer may only call if
+ *         motor_driver writes its pins through the registers
+ */
+static void __init pwm_dir_init(void) {
+  bool (*mmio)(void) = symbol_get(motor_dir_mmio);
+
+  if (mmio && mmio()) set_dir = symbol_get(motor_set_dir);
+  if (mmio) symbol_put(motor_dir_mmio);
+  if (!set_dir)
+    printk(KERN_INFO "pwm_driver: no register access to the motor direction pins, directions disabled\n");
 }
 
 /** @brief Called when the module is loaded with insmod
  *  @return 0 on failure or a non-zero value on success
  */
 static int __init pwm_init(void) {
+  int i, ret;
+
+  if (npins < 1 || npins > PWM_MAX_CHANNELS) return -EINVAL;
+  // the registers hold gpio 0 to 53 only, other chips go through gpiolib
+  for (i = 0; i < npins; i++)
+    if (pins[i] > 53) gpio_mmio = false;
+  if (gpio_fast_init(&gpio, gpio_mmio))
+    printk(KERN_WARNING "pwm_driver: cannot map the GPIO registers, using gpiolib\n");
+  ret = pwm_writer_init();
+  if (ret) {
+    printk(KERN_ERR "pwm_driver: cannot start the pin writer\n");
+    return ret;
+  }
+  pwm_dir_init();
 
   major_number = register_chrdev(0, NAME, &fops);
 
   this_class = class_create(THIS_MODULE, NAME);
 
-  this_device = device_create(this_class, NULL, MKDEV(major_number, 0), NULL, NAME);
-
-  gpio_request(gpioPWM, "gpioPWM");
-  gpio_direction_output(gpioPWM, false);
+  for (i = 0; i < npins; i++) {
+    channels[i].pin = pins[i];
+    channels[i].index = i;
+    channels[i].pending_dir = PWM_DIR_KEEP;
+    channels[i].pending.period_ns = channels[i].period_ns = timer_interval_ns;
+    gpio_request(pins[i], "gpioPWM");
+    gpio_direction_output(pins[i], false);
+    // the first channel keeps the original node name
+    if (i == 0)
+      this_device[i] = device_create(this_class, NULL, MKDEV(major_number, i), NULL, NAME);
+    else
+      this_device[i] = device_create(this_class, NULL, MKDEV(major_number, i), NULL, NAME "%d", i);
+  }
 
-  ktime = ktime_set(0, timer_interval_ns);
-  hrtimer_init(&hr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  // the timer only runs once a duty between 0% and 100% is set
+  hrtimer_init(&hr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
   hr_timer.function = &my_hrtimer_callback;
-  hrtimer_start(&hr_timer, ktime, HRTIMER_MODE_REL);
+
+  debug_dir = debugfs_create_dir(NAME, NULL);
+  debugfs_create_file("stats", 0644, debug_dir, NULL, &stats_fops);
   printk(KERN_INFO "sucessfully inited! \n");
   return 0;
 }
 
 /** @brief Called when the module is unloaded with rmmod */
 static void __exit pwm_exit(void) {
-  device_destroy(this_class, MKDEV(major_number,0));
+  int i;
+
+  for (i = 0; i < npins; i++)
+    device_destroy(this_class, MKDEV(major_number, i));
   class_unregister(this_class);
   class_destroy(this_class);
   unregister_chrdev(major_number, NAME);
+  debugfs_remove_recursive(debug_dir);
   hrtimer_cancel(&hr_timer);
+  if (writer) kthread_stop(writer);
+  for (i = 0; i < npins; i++) {
+    gpio_set_value_cansleep(pins[i], false);
+    gpio_free(pins[i]);
+  }
+  gpio_fast_exit(&gpio);
+  if (set_dir) symbol_put(motor_set_dir);
 }
 /** @brief The device open function that is called each time the device is opened
- *  This will only increment the numberOpens counter in this case.
+ *  This binds the file to the channel of the device node.
  *  @param inodep A pointer to an inode object (defined in linux/fs.h)
  *  @param filep A pointer to a file object (defined in linux/fs.h)
  */
 static int driver_open(struct inode *inodep, struct file *filep) {
+  unsigned int minor = iminor(inodep);
+
+  if (minor >= npins) return -ENODEV;
+  filep->private_data = &channels[minor];
   return 0;
 }
 /** @brief The device release function that is called whenever the device is closed/released by
@@ -133,51 +707,182 @@ static int driver_open(struct inode *inodep, struct file *filep) {
 static int driver_release(struct inode *inodep, struct file *filep) {
   return 0;
 }
-/** @brief This function is called whenever device is being read from user space
+/** @brief This function is called whenever device is being read from user space,
+ *  returns the staged setting of the channel as "period_ns duty_ns\n". Each open
+ *  file reads from its own offset, so a logger and the controller do not
+ *  interfere; seek back to 0 to sample again.
  *  @param filep A pointer to a file object (defined in linux/fs.h)
  *  @param buffer The pointer to the buffer to which this function writes the data
  *  @param len The length of the b
  *  @param offset The offset if required
+ *  @return the number of bytes copied, 0 at the end
+ */
+static ssize_t driver_read(struct file *filep, char __user *buffer, size_t len, loff_t *offset) {
+  struct pwm_channel *ch = filep->private_data;
+  struct pwm_setting set;
+  unsigned long flags;
+  char text[24];
+  int n;
+
+  spin_lock_irqsave(&pwm_lock, flags);
+  set = ch->pending;
+  spin_unlock_irqrestore(&pwm_lock, flags);
+  n = scnprintf(text, sizeof(text), "%u %u\n", set.period_ns, set.duty_ns);
+  return simple_read_from_buffer(buffer, len, offset, text, n);
+}
+/** @brief checks a setting against the limits of the driver
+ *  @param set is the setting
+ *  @return true if it can be staged
+ */
+static bool pwm_setting_valid(const struct pwm_setting *set) {
+  return set->period_ns >= PWM_PERIOD_MIN_NS && set->period_ns <= PWM_PERIOD_MAX_NS &&
+         set->duty_ns <= set->period_ns;
+}
+
+/** @brief updates the duty cycle of a channel in percent, keeping its
+ *         period. Takes effect at the next period boundary.
+ *  @param ch is the channel
+ *  @param cycle_in the duty cycle in percent, clamped to 0 to 100
+ *  @param dir is the motor direction to apply with it, or PWM_DIR_KEEP
+ */
+static void pwm_channel_set_duty(struct pwm_channel *ch, int cycle_in, int dir) {
+  struct pwm_setting set;
+
+  if (cycle_in < 0) cycle_in = 0;
+  if (cycle_in > 100) cycle_in = 100;
+  set.period_ns = READ_ONCE(ch->pending.period_ns);
+  set.duty_ns = div_u64((u64)cycle_in*set.period_ns, 100);
+  pwm_stage(ch, &set, dir);
+}
+
+/** @brief updates the duty cycle of the first channel, exported for the
+ *         in-kernel controller
+ *  @param cycle_in the duty cycle in percent, clamped to 0 to 100
  */
-static ssize_t driver_read(struct file *filep, char *buffer, size_t len, loff_t *offset) {
+void pwm_set_duty(int cycle_in) {
+  pwm_channel_set_duty(&channels[0], cycle_in, PWM_DIR_KEEP);
+}
+EXPORT_SYMBOL(pwm_set_duty);
+
+/** @brief stages the direction and the duty of a PWM_IOC_MOTOR command
+ *  @param ch is the channel
+ *  @param cmd is the command
+ *  @return 0 on success, -EINVAL if it is out of range, -EOPNOTSUPP if the
+ *          direction cannot be switched from the timer
+ */
+static int pwm_stage_motor(struct pwm_channel *ch, const struct pwm_motor_cmd *cmd) {
+  struct pwm_setting set;
+  int dir;
+
+  if (!set_dir) return -EOPNOTSUPP;
+  set.period_ns = cmd->period_ns;
+  set.duty_ns = cmd->speed_ns < 0 ? -(s64)cmd->speed_ns : cmd->speed_ns;
+  if (!pwm_setting_valid(&set)) return -EINVAL;
+  if (cmd->speed_ns > 0) dir = MOTOR_CLOCKWISE;
+  else if (cmd->speed_ns < 0) dir = MOTOR_COUNTERCLOCK;
+  else if (cmd->flags & PWM_MOTOR_BRAKE) {
+    // braking needs the enable high, a coasting motor gets it low
+    dir = MOTOR_BRAKE;
+    set.duty_ns = set.period_ns;
+  } else dir = MOTOR_STOP;
+  pwm_stage(ch, &set, dir);
   return 0;
 }
-/** @brief This function parses an interger from the input char
- *  @param s the string
- *  @param len the length of desired number
+
+/** @brief stages a PWM_IOC_MOTOR command on the first channel, exported for
+ *         the in-kernel controller
+ *  @param cmd is the command
+ *  @return 0 on success, -EINVAL if it is out of range, -EOPNOTSUPP if the
+ *          direction cannot be switched from the timer
  */
-static int parseInt(const char* s, int len) {
-  int i, result;
-  result = 0;
-  for (i = 0; i < len; i++) {
-    result = result*10+(s[i]-'0');
-  }
-  return result;
+int pwm_set_motor(const struct pwm_motor_cmd *cmd) {
+  return pwm_stage_motor(&channels[0], cmd);
 }
- 
+EXPORT_SYMBOL(pwm_set_motor);
+
 /** @brief This function is called whenever the device is being written to from user space
  *  @param filep A pointer to a file object
- *  @param buffer The buffer to that contains the string to write to the device
+ *  @param buffer The buffer to that contains the duty cycle in percent as text, or
+ *         "period_ns speed_ns" to set the motor like PWM_IOC_MOTOR
  *  @param len The length of the array of data that is being passed in the const char buffer
  *  @param offset The offset if required
  */
-static ssize_t driver_write(struct file *filep, const char *buffer, size_t len, loff_t *offset) {
-  hrtimer_cancel(&hr_timer);
+static ssize_t driver_write(struct file *filep, const char __user *buffer, size_t len, loff_t *offset) {
+  struct pwm_motor_cmd cmd = { 0 };
+  char text[32] = {0};
+  int duty, ret;
 
-  cycle = parseInt(buffer, len-1);
+  if (copy_from_user(text, buffer, min(len, sizeof(text)-1))) return -EFAULT;
+  if (sscanf(text, "%u %d", &cmd.period_ns, &cmd.speed_ns) == 2) {
+    trace_motor_dev_write(NAME, cmd.speed_ns);
+    ret = pwm_stage_motor(filep->private_data, &cmd);
+    return ret ? ret : len;
+  }
+  if (kstrtoint(text, 10, &duty)) return -EINVAL;
+  trace_motor_dev_write(NAME, duty);
+  pwm_channel_set_duty(filep->private_data, duty, PWM_DIR_KEEP);
 
-  printk(KERN_INFO "pwn driver: the duty cycle is: %d", cycle);
-  
-  off = (100-cycle)*timer_interval_ns/100;
-  on = cycle*timer_interval_ns/100;
+  return len;
+}
 
-  onOrOff = false;
-  ktime = ktime_set(0, on);
-  hrtimer_init(&hr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-  hr_timer.function = &my_hrtimer_callback;
-  hrtimer_start(&hr_timer, ktime, HRTIMER_MODE_REL);
+/** @brief handles the PWM_IOC_* requests from pwm_abi.h
+ *  @param filep A pointer to a file object
+ *  @param cmd is the request
+ *  @param arg points to the struct of the request in user space
+ *  @return 0 on success, negative errno on failure
+ */
+static long driver_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+  struct pwm_channel *ch = filep->private_data;
+  struct pwm_queue_status qs;
+  struct pwm_setting set;
+  struct pwm_segment *segs;
+  struct pwm_motor_cmd cmd;
+  struct pwm_queue q;
+  unsigned long flags;
+  long ret;
+  u32 i;
 
-  return len;
+  switch (cmd) {
+  case PWM_IOC_SET:
+    if (copy_from_user(&set, (void __user *)arg, sizeof(set))) return -EFAULT;
+    if (!pwm_setting_valid(&set)) return -EINVAL;
+    pwm_stage(ch, &set, PWM_DIR_KEEP);
+    return 0;
+  case PWM_IOC_MOTOR:
+    if (copy_from_user(&cmd, (void __user *)arg, sizeof(cmd))) return -EFAULT;
+    return pwm_stage_motor(ch, &cmd);
+  case PWM_IOC_GET:
+    spin_lock_irqsave(&pwm_lock, flags);
+    set = ch->pending;
+    spin_unlock_irqrestore(&pwm_lock, flags);
+    return copy_to_user((void __user *)arg, &set, sizeof(set)) ? -EFAULT : 0;
+  case PWM_IOC_QUEUE:
+    if (copy_from_user(&q, (void __user *)arg, sizeof(q))) return -EFAULT;
+    if (q.count == 0 || q.count > PWM_QUEUE_LEN) return -EINVAL;
+    segs = kmalloc_array(q.count, sizeof(*segs), GFP_KERNEL);
+    if (!segs) return -ENOMEM;
+    ret = 0;
+    if (copy_from_user(segs, u64_to_user_ptr(q.segments), q.count*sizeof(*segs))) ret = -EFAULT;
+    for (i = 0; i < q.count && ret == 0; i++) {
+      set.period_ns = segs[i].period_ns;
+      set.duty_ns = segs[i].duty_ns;
+      if (!pwm_setting_valid(&set) || segs[i].duration_ns == 0 ||
+          segs[i].dir < PWM_DIR_KEEP || segs[i].dir > MOTOR_BRAKE) ret = -EINVAL;
+      else if (segs[i].dir != PWM_DIR_KEEP && !set_dir) ret = -EOPNOTSUPP;
+    }
+    if (ret == 0) ret = pwm_enqueue(ch, segs, q.count, q.flags & PWM_QUEUE_REPLACE);
+    kfree(segs);
+    return ret;
+  case PWM_IOC_QUEUE_STATUS:
+    spin_lock_irqsave(&pwm_lock, flags);
+    qs.depth = ch->q_tail - ch->q_head;
+    qs.underruns = ch->underruns;
+    qs.played = ch->played;
+    spin_unlock_irqrestore(&pwm_lock, flags);
+    return copy_to_user((void __user *)arg, &qs, sizeof(qs)) ? -EFAULT : 0;
+  default:
+    return -ENOTTY;
+  }
 }
 
 /** @brief Registering the module init function with the kernel
@@ -0,0 +1,135 @@
+# Measures the duty cycle the pwm driver delivers on one gpio line, see
+# pwm_sim.sh, which loads the driver on a gpio-sim line.
+#
+# The duty is stepped in sub-1% steps through PWM_IOC_SET. At each step the
+# gpio_value events gpiolib emits for the line are recorded for a while,
+# and the high time of every period is taken from the timestamps of its
+# rising and falling edge. The trace prints them to the us; the mean over
+# thousands of periods resolves them finer. It must match the staged
+# duty within MAX_ERR_NS, and must grow with every step.
+#
+#   python pwm_resolution.py <pwm device> <gpio number>
+#
+# Needs root and tracefs. Exits with 1 if a check fails.
+#
+# Author: David Dong haochend@andrew.cmu.edu
+#         Yanying Zhu yanyingz@andrew.cmu.edu
+from __future__ import print_function
+
+import fcntl
+import os
+import re
+import struct
+import sys
+import time
+
+# PWM_IOC_SET of pwm_abi.h: _IOW('w', 1, struct pwm_setting)
+PWM_IOC_SET = (1 << 30) | (8 << 16) | (ord('w') << 8) | 1
+
+# 1 kHz, so one step of STEP_NS is 0.2% of the period
+PERIOD_NS = 1000000
+FIRST_NS = 100000
+STEP_NS = 2000
+STEPS = 6
+# time recorded per step, 5000 periods, enough to average out the
+# wakeup jitter of the pin writer
+RECORD_S = 5.0
+# time for the staged setting to reach a period boundary
+SETTLE_S = 0.1
+# largest error of the mean high time
+MAX_ERR_NS = 1000
+
+# timestamp in seconds, gpio number, level
+EVENT = re.compile(r'\s(\d+\.\d+):\s+gpio_value:\s+(\d+)\s+set\s+(\d)')
+
+
+def tracing_dir():
+    """Return the tracefs mount point."""
+    for path in ('/sys/kernel/tracing', '/sys/kernel/debug/tracing'):
+        if os.path.exists(os.path.join(path, 'trace')):
+            return path
+    sys.exit('tracefs is not mounted')
+
+
+def tracefs(root, name, value):
+    """Write one tracefs control file."""
+    with open(os.path.join(root, name), 'w') as f:
+        f.write(value)
+
+
+def high_times(root, gpio):
+    """Yield the high time in ns of every whole period in the trace."""
+    rise = None
+    with open(os.path.join(root, 'trace')) as f:
+        for line in f:
+            m = EVENT.search(line)
+            if m is None or int(m.group(2)) != gpio:
+                continue
+            ts = int(round(float(m.group(1)) * 1e9))
+            if m.group(3) == '1':
+                rise = ts
+            elif rise is not None:
+                yield ts - rise
+                rise = None
+
+
+def measure(root, fd, gpio, duty_ns):
+    """Stage one duty and return the high times recorded with it."""
+    fcntl.ioctl(fd, PWM_IOC_SET, struct.pack('II', PERIOD_NS, duty_ns))
+    time.sleep(SETTLE_S)
+    tracefs(root, 'trace', '')
+    tracefs(root, 'tracing_on', '1')
+    time.sleep(RECORD_S)
+    tracefs(root, 'tracing_on', '0')
+    return list(high_times(root, gpio))
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: %s <pwm device> <gpio number>' % sys.argv[0])
+    gpio = int(sys.argv[2])
+    root = tracing_dir()
+    event = 'events/gpio/gpio_value/'
+    fd = os.open(sys.argv[1], os.O_RDWR)
+    failed = False
+    last = None
+
+    tracefs(root, 'tracing_on', '0')
+    tracefs(root, 'buffer_size_kb', '8192')
+    tracefs(root, event + 'filter', 'gpio == %d' % gpio)
+    tracefs(root, event + 'enable', '1')
+    try:
+        for i in range(STEPS):
+            duty_ns = FIRST_NS + i * STEP_NS
+            samples = measure(root, fd, gpio, duty_ns)
+            if not samples:
+                print('duty %d ns: no edges on gpio %d' % (duty_ns, gpio))
+                failed = True
+                continue
+            samples.sort()
+            mean = float(sum(samples)) / len(samples)
+            print('duty %d ns (%.1f%%): %d periods, high mean %.1f ns, '
+                  'error %+.1f ns, median %d ns, min %d ns, max %d ns' %
+                  (duty_ns, duty_ns * 100.0 / PERIOD_NS, len(samples), mean,
+                   mean - duty_ns, samples[len(samples) // 2], samples[0],
+                   samples[-1]))
+            if abs(mean - duty_ns) > MAX_ERR_NS:
+                print('  off by more than %d ns' % MAX_ERR_NS)
+                failed = True
+            if last is not None and mean <= last:
+                print('  no longer than the step before')
+                failed = True
+            last = mean
+    finally:
+        tracefs(root, event + 'enable', '0')
+        tracefs(root, event + 'filter', '0')
+        os.close(fd)
+
+    if failed:
+        sys.exit(1)
+    print('pwm: %d steps of %.1f%% delivered' %
+          (STEPS, STEP_NS * 100.0 / PERIOD_NS))
+
+
+if __name__ == '__main__':
+    main()
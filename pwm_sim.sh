@@ -0,0 +1,40 @@
+#! /bin/bash
+# Loads pwm_driver on the line of a gpio-sim chip and measures the duty it
+# delivers at sub-1% steps with pwm_resolution.py, so the duty resolution
+# of the gpiolib path is tested on any Linux host without the Pi.
+# gpio-sim lines can sleep, so the driver writes them from its pin writer
+# thread; the timing statistics are printed at the end. motor_driver is
+# not needed, the test only stages duties.
+#
+# Needs root, configfs, tracefs, a kernel with CONFIG_GPIO_SIM and
+# CONFIG_GPIO_SYSFS, debugfs, and pwm_driver built for the running kernel.
+#   sudo ./pwm_sim.sh [pwm_driver module]
+#
+# Author: David Dong haochend@andrew.cmu.edu
+#         Yanying Zhu yanyingz@andrew.cmu.edu
+set -e
+MODULE=${1:-./pwm_driver.ko}
+LABEL=pwm-sim
+CFG=/sys/kernel/config/gpio-sim/pwm
+
+modprobe gpio-sim
+mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+mkdir $CFG $CFG/bank0
+trap 'rmmod pwm_driver 2> /dev/null; echo 0 > $CFG/live; rmdir $CFG/bank0 $CFG' EXIT
+echo 1 > $CFG/bank0/num_lines
+echo $LABEL > $CFG/bank0/label
+echo 1 > $CFG/live
+
+# pwm_driver takes global gpio numbers, line 0 is the base of the chip
+gpio=
+for chip in /sys/class/gpio/gpiochip*; do
+	[ "$(cat $chip/label)" = $LABEL ] && gpio=$(cat $chip/base)
+done
+if [ -z "$gpio" ]; then
+	echo "gpio-sim: no chip labelled $LABEL in /sys/class/gpio"
+	exit 1
+fi
+
+insmod $MODULE pins=$gpio gpio_mmio=0
+python3 "$(dirname "$0")/pwm_resolution.py" /dev/motor_pwm $gpio
+cat /sys/kernel/debug/motor_pwm/stats
@@ -0,0 +1,269 @@
+/**
+ * @file   quadrature.h
+ *
+ * @brief  4x quadrature decoder shared by the encoder LKM drivers and the
+ *         user programs
+ *
+ * The two channels form a 2 bit state, A in bit 1 and B in bit 0. Clockwise
+ * rotation walks 00 -> 10 -> 11 -> 01 -> 00, so every edge of either channel
+ * is one step. The previous and the current state index a 16 entry table that
+ * gives the step directly; a change of both bits at once means an edge was
+ * missed and cannot be decoded.
+ *
+ * Velocity is estimated with the M/T method on every edge: the steps counted
+ * since a reference edge are divided by the time between the two edges. The
+ * reference moves forward once it is QUAD_VEL_WINDOW_NS old, so fast motion
+ * averages many steps over a short window. Slow motion degrades to the time
+ * of a single step. Between edges the estimate is bounded by one step per
+ * time since the last edge, and it drops to zero after QUAD_VEL_TIMEOUT_NS
+ * without one.
+ *
+ * Noise is handled before decoding. An edge that comes less than a minimum
+ * pulse width after the previous edge of the same channel is rejected, and
+ * the decoder picks up the level once the channel has been quiet that long,
+ * so a bouncing contact costs no step and a spike at most a step forth and
+ * back. Edges of both channels are also counted per window; more than the
+ * rate limit allows is an interrupt storm, and the caller stops taking
+ * edges and samples the levels instead for QUAD_STORM_HOLD_NS. The window
+ * is sized from the rate limit to hold a whole number of edges at exactly
+ * that rate, so any limit is kept to the edge, not only multiples of the
+ * edges per QUAD_RATE_WINDOW_NS.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _QUADRATURE_H_
+#define _QUADRATURE_H_
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/math64.h>
+#else
+#include <stdint.h>
+#endif
+
+/** @brief table entry of a transition that skipped a state */
+#define QUAD_INVALID 2
+/** @brief shortest time the velocity is averaged over, in ns */
+#define QUAD_VEL_WINDOW_NS  2000000
+/** @brief time without an edge after which the velocity is zero, in ns,
+           must stay below 2^31 */
+#define QUAD_VEL_TIMEOUT_NS 200000000
+
+/** @brief window the edge rate is counted over in ns, shortened to the
+           whole number of edges it holds at the rate limit; below one edge
+           per window it is the time of one edge at the limit */
+#define QUAD_RATE_WINDOW_NS 1000000
+/** @brief time a storm keeps the edges off before they are tried again,
+           in ns */
+#define QUAD_STORM_HOLD_NS  100000000
+
+/** @brief glitch filter and rate limiter state, zero-initialise before use */
+struct quad_filter {
+	/** @brief time of the latest edge of channel A and B in ns, accepted
+	           or not */
+	int64_t last_ns[2];
+	/** @brief start of the current rate window in ns */
+	int64_t window_ns;
+	/** @brief edges seen in the current rate window */
+	uint32_t window_edges;
+	/** @brief rate limit the window is sized for, 0 before the first edge */
+	uint32_t window_rate;
+	/** @brief edges allowed per window */
+	uint32_t window_limit;
+	/** @brief length of the window in ns, window_limit edges at
+	           window_rate */
+	int64_t window_len_ns;
+	/** @brief edges rejected as shorter than the minimum pulse width */
+	uint32_t rejected;
+	/** @brief times the rate limit was exceeded */
+	uint32_t storms;
+};
+
+/** @brief M/T velocity estimator state, zero-initialise before use */
+struct quad_velocity {
+	/** @brief time of the reference edge in ns */
+	int64_t ref_ns;
+	/** @brief step count at the reference edge */
+	int32_t ref_count;
+	/** @brief step count at the next reference edge */
+	int32_t mid_count;
+	/** @brief time of the next reference edge in ns */
+	int64_t mid_ns;
+	/** @brief time of the latest edge in ns, 0 before the first one */
+	int64_t last_ns;
+	/** @brief direction of the latest edge, +1 or -1 */
+	int32_t last_step;
+	/** @brief latest estimate in steps per second */
+	int32_t velocity;
+};
+
+/** @brief step of every transition, indexed by previous state << 2 | state */
+static const int8_t quad_table[16] = {
+	/* from 00 */ 0, -1, 1, QUAD_INVALID,
+	/* from 01 */ 1, 0, QUAD_INVALID, -1,
+	/* from 10 */ -1, QUAD_INVALID, 0, 1,
+	/* from 11 */ QUAD_INVALID, 1, -1, 0,
+};
+
+/** @brief packs the channel levels into a decoder state
+    @param a is the level of channel A
+    @param b is the level of channel B
+    @return the state, 0 to 3
+*/
+static inline unsigned int quad_state(int a, int b) {
+	return (a ? 2 : 0) | (b ? 1 : 0);
+}
+
+/** @brief decodes one transition and remembers the new state
+    @param prev holds the previous state and receives the new one
+    @param cur is the new state
+    @return +1 clockwise, -1 counterclockwise, 0 if nothing changed or
+            QUAD_INVALID if both channels changed
+*/
+static inline int quad_decode(unsigned int *prev, unsigned int cur) {
+	int step = quad_table[(*prev << 2 | cur) & 15];
+
+	*prev = cur;
+	return step;
+}
+
+/** @brief divides a 64 bit value, 32 bit ARM kernels have no native
+           64 bit division
+    @param n is the dividend
+    @param d is the divisor, positive
+    @return the quotient
+*/
+static inline int64_t quad_div(int64_t n, int32_t d) {
+#ifdef __KERNEL__
+	return div_s64(n, d);
+#else
+	return n / d;
+#endif
+}
+
+/** @brief updates the velocity estimate on an edge
+    @param v is the estimator
+    @param count is the step count after the edge
+    @param step is the direction of the edge, +1 or -1
+    @param now is the time of the edge in ns
+*/
+static inline void quad_vel_edge(struct quad_velocity *v, int32_t count, int step, int64_t now) {
+	if (v->last_ns == 0 || step != v->last_step || now-v->last_ns > QUAD_VEL_TIMEOUT_NS) {
+		// first edge after a stop or a reversal, nothing to time it against
+		v->ref_ns = v->mid_ns = now;
+		v->ref_count = v->mid_count = count;
+		v->velocity = 0;
+	} else if (now > v->ref_ns) {
+		if (now-v->mid_ns >= QUAD_VEL_WINDOW_NS) {
+			v->ref_ns = v->mid_ns;
+			v->ref_count = v->mid_count;
+			v->mid_ns = now;
+			v->mid_count = count;
+		}
+		v->velocity = (int32_t)quad_div((int64_t)(count-v->ref_count)*1000000000LL,
+		                                (int32_t)(now-v->ref_ns));
+	}
+	v->last_ns = now;
+	v->last_step = step;
+}
+
+/** @brief bounds a velocity by the time since the last edge: the motion is
+           slower than one step per that time once the next edge is overdue
+    @param velocity is the estimate at the last edge, in steps per second
+    @param last_ns is the time of the last edge in ns, 0 if none
+    @param now is the current time in ns
+    @return the bounded velocity, 0 after QUAD_VEL_TIMEOUT_NS
+*/
+static inline int32_t quad_vel_bound(int32_t velocity, int64_t last_ns, int64_t now) {
+	int64_t idle = now-last_ns;
+	int32_t limit;
+
+	if (last_ns == 0 || idle > QUAD_VEL_TIMEOUT_NS) return 0;
+	if (idle <= 0 || (int64_t)(velocity < 0 ? -velocity : velocity)*idle <= 1000000000LL)
+		return velocity;
+	limit = (int32_t)quad_div(1000000000LL, (int32_t)idle);
+	return velocity < 0 ? -limit : limit;
+}
+
+/** @brief tells whether the encoder stopped. A zero velocity alone does not
+           say so: right after a reversal the estimate is 0 until a second
+           edge times the motion.
+    @param v is the estimator
+    @param now is the current time in ns
+    @return 1 if no edge came within QUAD_VEL_TIMEOUT_NS, or none ever
+*/
+static inline int quad_vel_stalled(const struct quad_velocity *v, int64_t now) {
+	return v->last_ns == 0 || now-v->last_ns > QUAD_VEL_TIMEOUT_NS;
+}
+
+/** @brief returns the current velocity estimate
+    @param v is the estimator
+    @param now is the current time in ns
+    @return the velocity in steps per second
+*/
+static inline int32_t quad_vel_read(const struct quad_velocity *v, int64_t now) {
+	return quad_vel_bound(v->velocity, v->last_ns, now);
+}
+
+/** @brief checks the pulse an edge ends against the minimum pulse width
+    @param f is the filter
+    @param channel is the channel of the edge, 0 for A or 1 for B
+    @param now is the time of the edge in ns
+    @param min_pulse_ns is the minimum pulse width in ns, 0 accepts all
+    @return 1 to decode the edge, 0 if it was rejected
+*/
+static inline int quad_filter_pulse(struct quad_filter *f, unsigned int channel, int64_t now,
+                                    int64_t min_pulse_ns) {
+	int64_t prev = f->last_ns[channel & 1];
+
+	f->last_ns[channel & 1] = now;
+	if (prev == 0 || now-prev >= min_pulse_ns) return 1;
+	f->rejected++;
+	return 0;
+}
+
+/** @brief tells whether a channel has been quiet for the minimum pulse
+           width, so its level can be decoded after rejected edges
+    @param f is the filter
+    @param channel is the channel, 0 for A or 1 for B
+    @param now is the current time in ns
+    @param min_pulse_ns is the minimum pulse width in ns
+    @return 1 if the channel is settled
+*/
+static inline int quad_filter_settled(const struct quad_filter *f, unsigned int channel, int64_t now,
+                                      int64_t min_pulse_ns) {
+	return now-f->last_ns[channel & 1] >= min_pulse_ns;
+}
+
+/** @brief counts an edge against the rate limit
+    @param f is the filter
+    @param now is the time of the edge in ns
+    @param max_rate is the limit in edges per second, 0 for none
+    @return 1 if the edge started a storm, 0 otherwise
+*/
+static inline int quad_filter_storm(struct quad_filter *f, int64_t now, uint32_t max_rate) {
+	if (max_rate == 0) return 0;
+	if (max_rate > 0x7fffffff) max_rate = 0x7fffffff;
+	if (max_rate != f->window_rate) {
+		// the whole edges that fit QUAD_RATE_WINDOW_NS, at least one, and
+		// the time they take at max_rate; a new limit starts a new window
+		f->window_limit = max_rate/(1000000000/QUAD_RATE_WINDOW_NS);
+		if (f->window_limit == 0) f->window_limit = 1;
+		f->window_len_ns = quad_div((int64_t)f->window_limit*1000000000, (int32_t)max_rate);
+		f->window_rate = max_rate;
+		f->window_ns = now;
+		f->window_edges = 0;
+	}
+	if (now-f->window_ns >= f->window_len_ns) {
+		f->window_ns = now;
+		f->window_edges = 0;
+	}
+	if (++f->window_edges <= f->window_limit) return 0;
+	f->window_edges = 0;
+	f->storms++;
+	return 1;
+}
+
+#endif /* _QUADRATURE_H_ */
@@ -3,14 +3,23 @@
  *
  * @brief  the user program that runs the server rpi
  *
+ * The server is the leader of any number of followers, up to
+ * MAX_FOLLOWERS, that run client.c: one network thread serves them all from
+ * one epoll loop on non-blocking sockets and sends the wheel position to
+ * every follower in one pass. A follower that falls behind loses samples
+ * instead of delaying the others, and the earliest follower still there
+ * steers the leader's wheel.
+ *
  * @author David Dong haochend@andrew.cmu.edu
  *         Yanying Zhu yanyingz@andrew.cmu.edu
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <sys/types.h> 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <string.h>
 #include <stdlib.h>
@@ -18,100 +27,608 @@
 #include <errno.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+
+#include "periodic.h"
+#include "encoder.h"
+#include "pid.h"
+#include "proto.h"
+#include "mailbox.h"
+#include "motor.h"
+#include "pwm_abi.h"
+#include "uring.h"
 
 /** @brief port number for network */
 #define PORT 5000
-/** @brief define clockwise direction */
-#define CLOCKWISE 1
-/** @brief define counterclockwise direction */
-#define COUNTERCLOCK 2
 /** @brief define speed max */
 #define SPEED 50
-/** @brief define write buffer length */
-#define writeLen 4
-/** @brief define read buffer length */
-#define readLen 64
-/** @brief define the time interval */
-#define FREQ    5000000
-/** @brief define the mox speed */
-#define SHIGH   70
-/** @brief define the low speed upper bound */
-#define SLOW1   20
-/** @brief define the low speed lower bound */
-#define SLOW2   5
-/** @brief define the full round degree */
-#define FULLROUND 360
-/** @brief define the half round degree */
-#define HALFROUND 180
-/** @brief define the buffer size */
-#define BUFFSIZE 32
-
-/** @brief write buffer */
-static char writeString[writeLen];
-/** @brief read buffer */
-static char readString[readLen] = {0};
-/** @brief define Kp */
-static float Kp = 0.23;
-/** @brief define Kd */
-static float Kd = 0.1;
-/** @brief define ki */
-static float Ki = 0.0001;
-/** @brief global varible for received target position */
-static int target_pos = 0;
-/** @brief global varible for sending motor position */
-static int motor_pos = 0;
-
-/** @brief prototype for device write function 
-    @param fd is the file descripture of the target device
-    @param num is the number of bits write
-*/
-void writeToDevice(int fd, int num) {
-	memset(writeString, 0, writeLen);
-	sprintf(writeString, "%d", num);
-	write(fd, writeString, strlen(writeString)+1);
-}
-
-/** @brief readEncoder reads results from a encoder
-    @param fd is the file descriptor of the device
-    @return number of bytes read
-*/
-int readEncoder(int fd) {
-	memset(readString, 0, readLen);
-	read(fd, readString, readLen);
-	return atoi(readString);
+/** @brief define the default control loop rate in Hz */
+#define CONTROL_HZ 100
+/** @brief define the default network heartbeat rate in Hz */
+#define NET_HZ     50
+/** @brief define the number of encoder edges that trigger a position send */
+#define NET_EDGES  10
+/** @brief define the max number of epoll events handled per wakeup */
+#define MAX_EVENTS 16
+/** @brief define the max number of followers served at once */
+#define MAX_FOLLOWERS 64
+/** @brief define the silence after which a datagram follower is dropped,
+           in ns */
+#define FOLLOWER_TIMEOUT_NS 2000000000LL
+/** @brief epoll tag of the listening socket, followers use their index */
+#define EV_LISTEN MAX_FOLLOWERS
+/** @brief epoll tag of the wheel encoder */
+#define EV_WHEEL (MAX_FOLLOWERS+1)
+/** @brief define the io_uring operations the motor loop may have in flight */
+#define URING_ENTRIES 8
+/** @brief define the io_uring operations the datagram loop may have in
+           flight: a send per follower, the receive and the timeout */
+#define NET_URING_ENTRIES (2*MAX_FOLLOWERS)
+/** @brief io_uring tag of the datagram receive */
+#define NET_TAG_RX 1
+/** @brief io_uring tag of a datagram send, the follower index is above
+           NET_TAG_SHIFT */
+#define NET_TAG_TX 2
+/** @brief io_uring tag of the heartbeat timeout */
+#define NET_TAG_TICK 3
+/** @brief bits of an io_uring tag that hold its kind */
+#define NET_TAG_MASK 0xff
+/** @brief shift of the follower index in an io_uring tag */
+#define NET_TAG_SHIFT 8
+
+/** @brief one follower, a board that mirrors this one */
+struct follower {
+	/** @brief 1 if the slot is taken */
+	int used;
+	/** @brief the connected TCP socket, -1 for a datagram follower */
+	int fd;
+	/** @brief address of a datagram follower */
+	struct sockaddr_in addr;
+	/** @brief protocol state */
+	struct proto_peer peer;
+	/** @brief message being sent: the rest of a TCP message cut short, or
+	           the datagram handed to sendmmsg or io_uring */
+	unsigned char out[PROTO_MSG_SIZE];
+	/** @brief bytes of out a TCP follower still has to get */
+	size_t out_left;
+	/** @brief order of joining, the smallest steers */
+	unsigned long joined;
+	/** @brief samples this follower had no room for and lost */
+	unsigned long stale;
+	/** @brief time of its last datagram in ns */
+	int64_t seen_ns;
+	/** @brief 1 while an io_uring send of out is in flight */
+	int tx_busy;
+	/** @brief io_uring sendmsg of out */
+	struct msghdr tx_msg;
+	/** @brief data of tx_msg */
+	struct iovec tx_iov;
+	/** @brief tags its output lines */
+	char name[24];
+};
+
+/** @brief target position received from the peer, written by the network
+           receive path and read by the motor thread and the send path */
+static struct mailbox target_box;
+/** @brief wheel position published by the motor thread, read by the send
+           path when the wheel encoder is on gpio lines */
+static struct mailbox position_box;
+/** @brief network heartbeat rate in Hz */
+static unsigned int net_hz = NET_HZ;
+/** @brief control loop rate in Hz */
+static unsigned int control_hz = CONTROL_HZ;
+/** @brief 1 to run the motor and datagram loops on io_uring */
+static int use_uring;
+/** @brief the followers, only touched by the network thread */
+static struct follower followers[MAX_FOLLOWERS];
+/** @brief number of followers */
+static unsigned int nfollowers;
+/** @brief followers that ever joined, numbers their joins */
+static unsigned long joins;
+/** @brief time of the last followersReport output */
+static int64_t report_ns;
+
+/** @brief returns the newest target position from the network
+    @return the target position in degrees
+*/
+static int getTarget(void) {
+	int32_t target = 0;
+
+	mailbox_get(&target_box, &target, sizeof(target));
+	return target;
+}
+
+/** @brief hands a new target position to the motor thread
+    @param target is the target position in degrees
+*/
+static void setTarget(int32_t target) {
+	mailbox_put(&target_box, &target, sizeof(target));
+}
+
+/** @brief angle and velocity of the wheel */
+struct wheel_position {
+	/** @brief angle in degrees */
+	int32_t degree;
+	/** @brief velocity in degrees per second */
+	int32_t velocity;
+};
+
+/** @brief opens the wheel encoder for the send path. Gpio lines can only be
+           requested once and belong to the motor thread, the send path then
+           reads position_box instead
+    @param enc is the encoder to set up
+    @param mode is the encoder mode
+    @return the file descriptor, -1 in gpio mode
+*/
+static int openWheel(struct encoder *enc, int mode) {
+	const char *path = gpio_device("WHEEL_ENCODER", "/dev/wheel_encoder");
+
+	enc->fd = -1;
+	enc->velocity = 0;
+	if (gpio_is_spec(path)) return -1;
+	return encoder_open(enc, path, WHEEL_COUNTS, mode);
+}
+
+/** @brief reads the wheel for the send path
+    @param enc is the encoder opened by openWheel, its velocity is updated
+    @return the angle in degrees
+*/
+static int readWheel(struct encoder *enc) {
+	struct wheel_position pos = { 0, 0 };
+
+	if (enc->fd >= 0) return encoder_read_degree(enc);
+	mailbox_get(&position_box, &pos, sizeof(pos));
+	enc->velocity = pos.velocity;
+	return pos.degree;
+}
+
+/** @brief returns the follower that steers the leader: the one connected
+           the longest, so two boards still mirror each other
+    @return the follower, NULL if there is none
+*/
+static struct follower *steering(void) {
+	struct follower *f, *first = NULL;
+
+	for (f = followers; f < followers+MAX_FOLLOWERS; f++)
+		if (f->used && (first == NULL || f->joined < first->joined)) first = f;
+	return first;
+}
+
+/** @brief takes a free slot for a new follower
+    @param fd is its TCP socket, -1 for a datagram follower
+    @param addr is the address of a datagram follower, NULL for TCP
+    @return the follower, NULL if all slots are taken
+*/
+static struct follower *followerAdd(int fd, const struct sockaddr_in *addr) {
+	struct follower *f;
+
+	for (f = followers; f < followers+MAX_FOLLOWERS && f->used; f++);
+	if (f == followers+MAX_FOLLOWERS) return NULL;
+	memset(f, 0, sizeof(*f));
+	f->used = 1;
+	f->fd = fd;
+	if (addr) f->addr = *addr;
+	f->joined = ++joins;
+	f->seen_ns = proto_now();
+	proto_peer_init(&f->peer);
+	snprintf(f->name, sizeof(f->name), "%s %d", fd < 0 ? "udp" : "tcp", (int)(f-followers));
+	printf("%s: joined, %u followers\n", f->name, ++nfollowers);
+	return f;
+}
+
+/** @brief frees the slot of a follower that left, closing its socket
+    @param f is the follower
+*/
+static void followerDrop(struct follower *f) {
+	if (f->fd >= 0) close(f->fd);
+	f->used = 0;
+	printf("%s: left after %lu stale samples, %u followers\n", f->name, f->stale, --nfollowers);
+}
+
+/** @brief hands a message of a follower to the motor thread if that
+           follower steers
+    @param f is the follower
+    @param msg is the accepted message
+*/
+static void followerSteer(struct follower *f, const struct proto_msg *msg) {
+	if (f == steering()) setTarget(proto_predict(&f->peer, msg));
+}
+
+/** @brief prints the receive counters of the steering follower and the
+           stale samples of all followers about once per second
+*/
+static void followersReport(void) {
+	struct follower *f, *steer = steering();
+	unsigned long stale = 0;
+	int64_t now = proto_now();
+
+	if (steer) proto_report(steer->name, &steer->peer);
+	if (now-report_ns < 1000000000LL) return;
+	report_ns = now;
+	for (f = followers; f < followers+MAX_FOLLOWERS; f++)
+		if (f->used) stale += f->stale;
+	printf("followers: %u, stale samples dropped %lu\n", nfollowers, stale);
+}
+
+/** @brief accepts every pending TCP connection as a follower
+    @param sockfd is the listening socket
+    @param epfd is the epoll set the followers are watched in
+*/
+static void followersAccept(int sockfd, int epfd) {
+	struct epoll_event ev;
+	struct follower *f;
+	int fd, one = 1;
+
+	while ((fd = accept4(sockfd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) >= 0) {
+		f = followerAdd(fd, NULL);
+		if (f == NULL) {
+			close(fd);
+			continue;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		ev.events = EPOLLIN;
+		ev.data.u64 = f-followers;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	}
+}
+
+/** @brief sends the position to every TCP follower in one pass, one
+           gathering sendmsg each
+ *
+ *  A follower that cannot take a whole message loses this sample rather
+ *  than queueing it behind older ones. Only the rest of a message already
+ *  cut short is kept, it goes first in the next call so the stream stays
+ *  framed.
+ *
+    @param target is the target position in degrees
+    @param position is the wheel position in degrees
+    @param velocity is the wheel velocity in degrees per second
+*/
+static void broadcastTcp(int32_t target, int32_t position, int32_t velocity) {
+	unsigned char buf[PROTO_MSG_SIZE];
+	struct iovec iov[2];
+	struct msghdr mh;
+	struct follower *f;
+	size_t sent;
+	ssize_t n;
+
+	memset(&mh, 0, sizeof(mh));
+	iov[1].iov_base = buf;
+	iov[1].iov_len = PROTO_MSG_SIZE;
+	for (f = followers; f < followers+MAX_FOLLOWERS; f++) {
+		if (!f->used || f->fd < 0) continue;
+		proto_pack(&f->peer, target, position, velocity, buf);
+		iov[0].iov_base = f->out+PROTO_MSG_SIZE-f->out_left;
+		iov[0].iov_len = f->out_left;
+		mh.msg_iov = f->out_left ? iov : iov+1;
+		mh.msg_iovlen = f->out_left ? 2 : 1;
+		n = sendmsg(f->fd, &mh, MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			followerDrop(f);
+			continue;
+		}
+		sent = n < 0 ? 0 : n;
+		if (sent < f->out_left) {
+			f->out_left -= sent;
+			f->stale++;
+			continue;
+		}
+		sent -= f->out_left;
+		f->out_left = 0;
+		if (sent == 0) {
+			f->stale++;
+		} else if (sent < PROTO_MSG_SIZE) {
+			memcpy(f->out, buf, PROTO_MSG_SIZE);
+			f->out_left = PROTO_MSG_SIZE-sent;
+		}
+	}
 }
 
 /** @brief the server function that is being run on one thread
            receive and send motor position over network
+
+    The server leads any number of followers: one epoll loop accepts them,
+    receives from all of them and sends the motor position to all of them
+    whenever the wheel moved NET_EDGES steps, or at the heartbeat rate when
+    it stands still. A follower that leaves only frees its slot.
 */
 void *serverFun(void *var) {
-	int sockfd, newSockfd, len, i;
-	char sendBuffer[BUFFSIZE] = {0}, receiveBuffer[BUFFSIZE] = {0};
+	int sockfd, epfd, n, i, rc, moved, one = 1;
+	int64_t now, beat_ns = 1000000000LL/net_hz, next_beat;
+	struct encoder wheel_encoder;
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct proto_msg msg;
+	struct follower *f;
+	struct sockaddr_in server_addr;
 
-	struct sockaddr_in server_addr, client_addr;
-	len = sizeof(client_addr);
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = INADDR_ANY;
+	server_addr.sin_port = htons(PORT);
+
+	sockfd = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	// restarting must not wait for the old connection to leave TIME_WAIT
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+	listen(sockfd, MAX_FOLLOWERS);
+
+	epfd = epoll_create1(0);
+	ev.events = EPOLLIN;
+	ev.data.u64 = EV_LISTEN;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev);
+	if (openWheel(&wheel_encoder, ENC_MODE_TEXT) >= 0) {
+		encoder_set_wakeup(&wheel_encoder, NET_EDGES);
+		fcntl(wheel_encoder.fd, F_SETFL, O_NONBLOCK);
+		ev.data.u64 = EV_WHEEL;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, wheel_encoder.fd, &ev);
+	}
+
+	next_beat = proto_now();
+	while(1) {
+		now = proto_now();
+		n = epoll_wait(epfd, events, MAX_EVENTS,
+		               next_beat > now ? (int)((next_beat-now+999999)/1000000) : 0);
+		moved = 0;
+		for (i = 0; i < n; i++) {
+			if (events[i].data.u64 == EV_LISTEN) {
+				followersAccept(sockfd, epfd);
+				continue;
+			}
+			if (events[i].data.u64 == EV_WHEEL) {
+				moved = 1;
+				continue;
+			}
+			f = &followers[events[i].data.u64];
+			if (!f->used) continue;
+			while ((rc = proto_recv(f->fd, &f->peer, &msg)) > 0) followerSteer(f, &msg);
+			if (rc < 0) followerDrop(f);
+		}
+
+		// woken by the encoder or by the heartbeat, either way send
+		now = proto_now();
+		if (moved || now >= next_beat) {
+			broadcastTcp(getTarget(), readWheel(&wheel_encoder), wheel_encoder.velocity);
+			next_beat = now+beat_ns;
+		}
+		followersReport();
+	}
+}
+
+/** @brief finds the datagram follower sending from an address
+    @param addr is the address
+    @return the follower, NULL if none
+*/
+static struct follower *followerFind(const struct sockaddr_in *addr) {
+	struct follower *f;
+
+	for (f = followers; f < followers+MAX_FOLLOWERS; f++)
+		if (f->used && f->fd < 0 && f->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+		    f->addr.sin_port == addr->sin_port) return f;
+	return NULL;
+}
+
+/** @brief handles one datagram: a valid message from a new address makes
+           its sender a follower
+    @param from is the sender
+    @param buf is the datagram
+    @param len is its length
+*/
+static void followerDatagram(const struct sockaddr_in *from, const unsigned char *buf, size_t len) {
+	struct follower *f = followerFind(from);
+	struct proto_msg msg;
+
+	if (f == NULL && (len != PROTO_MSG_SIZE || proto_decode(buf, &msg) < 0)) return;
+	if (f == NULL && (f = followerAdd(-1, from)) == NULL) return;
+	f->seen_ns = proto_now();
+	if (proto_accept_dgram(&f->peer, buf, len, &msg)) followerSteer(f, &msg);
+}
+
+/** @brief drops the datagram followers that went quiet, there is no
+           connection whose end would tell
+    @param now is the current time in ns
+*/
+static void followersExpire(int64_t now) {
+	struct follower *f;
+
+	for (f = followers; f < followers+MAX_FOLLOWERS; f++)
+		if (f->used && f->fd < 0 && !f->tx_busy && now-f->seen_ns > FOLLOWER_TIMEOUT_NS)
+			followerDrop(f);
+}
+
+/** @brief sends the position to every datagram follower, normally in a
+           single sendmmsg. Datagrams the socket has no room for are stale
+           by the next heartbeat and dropped.
+    @param sockfd is the datagram socket
+    @param target is the target position in degrees
+    @param position is the wheel position in degrees
+    @param velocity is the wheel velocity in degrees per second
+*/
+static void broadcastUdp(int sockfd, int32_t target, int32_t position, int32_t velocity) {
+	struct mmsghdr msgs[MAX_FOLLOWERS];
+	struct iovec iov[MAX_FOLLOWERS];
+	struct follower *f, *to[MAX_FOLLOWERS];
+	int n = 0, i = 0, sent;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (f = followers; f < followers+MAX_FOLLOWERS; f++) {
+		if (!f->used || f->fd >= 0) continue;
+		proto_pack(&f->peer, target, position, velocity, f->out);
+		iov[n].iov_base = f->out;
+		iov[n].iov_len = PROTO_MSG_SIZE;
+		msgs[n].msg_hdr.msg_name = &f->addr;
+		msgs[n].msg_hdr.msg_namelen = sizeof(f->addr);
+		msgs[n].msg_hdr.msg_iov = &iov[n];
+		msgs[n].msg_hdr.msg_iovlen = 1;
+		to[n++] = f;
+	}
+	while (i < n) {
+		sent = sendmmsg(sockfd, msgs+i, n-i, MSG_DONTWAIT);
+		if (sent > 0) {
+			i += sent;
+			continue;
+		}
+		if (errno == EINTR) continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+		// an error of this one follower must not hold up the others
+		to[i++]->stale++;
+	}
+	for (; i < n; i++) to[i]->stale++;
+}
+
+/** @brief the datagram loop on io_uring: a sendmsg to every follower, the
+           timeout of the next heartbeat and a receive kept armed all go to
+           the kernel in one uring_enter
+    @param sockfd is the datagram socket
+    @param wheel_encoder is the wheel as opened by openWheel
+    @return -1 if io_uring is not available or fails, never returns
+            otherwise
+*/
+static int udpUringLoop(int sockfd, struct encoder *wheel_encoder) {
+	unsigned char rx[PROTO_MSG_SIZE+1];
+	struct iovec rx_iov = { rx, sizeof(rx) };
+	struct msghdr rx_msg;
+	struct sockaddr_in from;
+	struct uring_done done[MAX_EVENTS];
+	struct periodic_task task;
+	struct follower *f;
+	struct uring ring;
+	int n, i, due, tick, rx_armed = 0;
+	int32_t target, position;
+
+	if (uring_init(&ring, NET_URING_ENTRIES) < 0) return -1;
+	periodic_init(&task, "udp", net_hz);
+	memset(&rx_msg, 0, sizeof(rx_msg));
+	rx_msg.msg_name = &from;
+	rx_msg.msg_iov = &rx_iov;
+	rx_msg.msg_iovlen = 1;
+
+	while(1) {
+		if (!rx_armed) {
+			rx_msg.msg_namelen = sizeof(from);
+			rx_armed = uring_recvmsg(&ring, sockfd, &rx_msg, NET_TAG_RX) == 0;
+		}
+		due = periodic_next(&task);
+		tick = !due || uring_timeout(&ring, &task.next, NET_TAG_TICK) < 0;
+		while (!tick) {
+			if (uring_enter(&ring, 1) < 0) {
+				uring_exit(&ring);
+				return -1;
+			}
+			while ((n = uring_reap(&ring, done, MAX_EVENTS)) > 0) {
+				for (i = 0; i < n; i++) {
+					if (done[i].tag == NET_TAG_TICK) {
+						tick = 1;
+					} else if ((done[i].tag & NET_TAG_MASK) == NET_TAG_TX) {
+						f = &followers[done[i].tag >> NET_TAG_SHIFT];
+						f->tx_busy = 0;
+						if (done[i].res < 0) f->stale++;
+					} else if (done[i].res >= 0) {
+						// rearmed right away, errors wait for the next tick
+						followerDatagram(&from, rx, done[i].res);
+						rx_msg.msg_namelen = sizeof(from);
+						rx_armed = uring_recvmsg(&ring, sockfd, &rx_msg, NET_TAG_RX) == 0;
+					} else {
+						rx_armed = 0;
+					}
+				}
+			}
+		}
+		if (due) periodic_released(&task);
+
+		// the sends go out with the next timeout
+		followersExpire(proto_now());
+		target = getTarget();
+		position = readWheel(wheel_encoder);
+		for (f = followers; f < followers+MAX_FOLLOWERS; f++) {
+			if (!f->used || f->fd >= 0) continue;
+			// a send still in flight keeps its buffer, this sample is stale
+			if (f->tx_busy) {
+				f->stale++;
+				continue;
+			}
+			proto_pack(&f->peer, target, position, wheel_encoder->velocity, f->out);
+			f->tx_iov.iov_base = f->out;
+			f->tx_iov.iov_len = PROTO_MSG_SIZE;
+			memset(&f->tx_msg, 0, sizeof(f->tx_msg));
+			f->tx_msg.msg_name = &f->addr;
+			f->tx_msg.msg_namelen = sizeof(f->addr);
+			f->tx_msg.msg_iov = &f->tx_iov;
+			f->tx_msg.msg_iovlen = 1;
+			f->tx_busy = uring_sendmsg(&ring, sockfd, &f->tx_msg,
+			                           (uint64_t)(f-followers) << NET_TAG_SHIFT | NET_TAG_TX) == 0;
+			if (!f->tx_busy) f->stale++;
+		}
+		followersReport();
+	}
+}
+
+/** @brief the server function for the datagram transport, run on one thread
+           instead of serverFun
+
+    The position is sent over UDP at exactly net_hz from a timerfd to every
+    follower, whether or not anything arrives from them. A follower joins
+    with its first valid datagram and is dropped after FOLLOWER_TIMEOUT_NS
+    of silence. Only the newest datagram matters, so stale and duplicate
+    ones are dropped by proto_accept_dgram and a lost one is simply
+    superseded by the next.
+*/
+void *serverUdpFun(void *var) {
+	int sockfd, epfd, tfd, n, i;
+	uint64_t ticks;
+	ssize_t len;
+	struct itimerspec period;
+	struct encoder wheel_encoder;
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct sockaddr_in server_addr, from;
+	socklen_t from_len;
+	// one spare byte tells oversized datagrams apart
+	unsigned char buf[PROTO_MSG_SIZE+1];
 
 	memset(&server_addr, 0, sizeof(server_addr));
-    
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(PORT);
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = INADDR_ANY;
+	server_addr.sin_port = htons(PORT);
 
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
 	bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
-	listen(sockfd, 1);
+	openWheel(&wheel_encoder, ENC_MODE_MMAP);
+
+	if (use_uring && udpUringLoop(sockfd, &wheel_encoder) < 0)
+		perror("io_uring, using epoll");
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	period.it_value.tv_sec = period.it_interval.tv_sec = 1/net_hz;
+	period.it_value.tv_nsec = period.it_interval.tv_nsec = 1000000000L/net_hz%1000000000L;
+	timerfd_settime(tfd, 0, &period, NULL);
+
+	epfd = epoll_create1(0);
+	ev.events = EPOLLIN;
+	ev.data.fd = sockfd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev);
+	ev.data.fd = tfd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
 
 	while(1) {
-		newSockfd = accept(sockfd, (struct sockaddr *)&client_addr, (socklen_t *)&len);
-		while(1) {
-			memset(sendBuffer, 0, BUFFSIZE);
-			memset(receiveBuffer, 0 , BUFFSIZE);
-			read(newSockfd, receiveBuffer, BUFFSIZE);
-			target_pos = atoi(receiveBuffer);
-			sprintf(sendBuffer, "%d", motor_pos);
-			send(newSockfd, sendBuffer, strlen(sendBuffer)+1, 0);
-
-			for (i = 0; i < FREQ*2; i++);
+		n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == tfd) {
+				read(tfd, &ticks, sizeof(ticks));
+				followersExpire(proto_now());
+				broadcastUdp(sockfd, getTarget(), readWheel(&wheel_encoder),
+				             wheel_encoder.velocity);
+				followersReport();
+				continue;
+			}
+			while (1) {
+				from_len = sizeof(from);
+				len = recvfrom(sockfd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from,
+				               &from_len);
+				if (len < 0 && errno == EINTR) continue;
+				if (len < 0) break;
+				followerDatagram(&from, buf, len);
+			}
 		}
 	}
 }
@@ -120,54 +637,61 @@ void *serverFun(void *var) {
            on one thread
 */
 void *motorFun(void *var) {
-	int fd_motor, fd_pwm, fd_wheel_encoder, i, err, speed;
-	int err_sum = 0, last_err = 0, dir = 0;
+	int motor_pos;
+	struct motor motor;
+	struct wheel_position pos;
+	struct pid_ctrl pid;
+	q16_t out;
+	struct periodic_task task;
+	struct encoder wheel_encoder;
+	struct uring ring;
+	int uring;
+
+	motor_open(&motor, gpio_device("MOTOR_DIR", "/dev/motor_char"),
+	           gpio_device("MOTOR_PWM", "/dev/motor_pwm"), PWM_PERIOD_DEFAULT_NS);
+	encoder_open(&wheel_encoder, gpio_device("WHEEL_ENCODER", "/dev/wheel_encoder"), WHEEL_COUNTS,
+	             ENC_MODE_MMAP);
+	encoder_set_filter(&wheel_encoder, WHEEL_MIN_PULSE_NS, WHEEL_MAX_RATE);
 
-	fd_motor = open("/dev/motor_char", O_RDWR);
-	fd_pwm = open("/dev/motor_pwm", O_RDWR);
-	fd_wheel_encoder = open("/dev/wheel_encoder", O_RDWR);
+	pid_init(&pid, PID_KP_DEFAULT, PID_KI_DEFAULT, PID_KD_DEFAULT, Q16_FROM_INT(PID_FULLROUND));
+	periodic_init(&task, "motor", control_hz);
+	uring = use_uring && uring_init(&ring, URING_ENTRIES) == 0;
 
 	while (1) {
-		motor_pos = readEncoder(fd_wheel_encoder);
-		
-		err = target_pos-motor_pos;
-
-		if (err < 0 && err >= -HALFROUND) {
-			dir = COUNTERCLOCK;
-		} else if (err < -HALFROUND) {
-			dir = CLOCKWISE;
-			err = -FULLROUND-err;
-		} else if (err >= 0 && err < HALFROUND) {
-			dir = CLOCKWISE;
+		motor_pos = encoder_read_degree(&wheel_encoder);
+		pos.degree = motor_pos;
+		pos.velocity = wheel_encoder.velocity;
+		mailbox_put(&position_box, &pos, sizeof(pos));
+		out = pid_update(&pid, Q16_FROM_INT(getTarget()), Q16_FROM_INT(motor_pos));
+		if (uring) {
+			motor_queue(&motor, &ring, pid_motor_speed(out, motor.period_ns));
+			uring_periodic_wait(&ring, &task);
 		} else {
-			dir = COUNTERCLOCK;
-			err = FULLROUND-err;
+			motor_set(&motor, pid_motor_speed(out, motor.period_ns));
+			periodic_wait(&task);
 		}
-
-		speed = (int)(Kp*err+Kd*(err-last_err)+Ki*err_sum);
-
-		
-		if (speed < 0) speed = -speed;
-		if (speed > SHIGH) speed = SHIGH;
-        else if (speed < SLOW1 && speed >= SLOW2) speed = SLOW1;
-
-        last_err = err;
-		err_sum += err;
-
-		writeToDevice(fd_motor, dir);
-		writeToDevice(fd_pwm, speed);
-
-		for (i = 0; i < FREQ; i++);
+		periodic_report(&task);
 	}
 }
 
 /** @brief creates two threads and run the server function
            and motor function concurrently
+    @param argc is the number of arguments
+    @param argv optionally holds the control and network loop rates in Hz
+           and the transport for all followers, "tcp" (default) or "udp",
+           then "uring" to run the motor loop and the udp loop on io_uring
 */
-int main() {
+int main(int argc, char **argv) {
 	pthread_t tid1, tid2;
 
-	pthread_create(&tid1, NULL, serverFun, NULL);
+	control_hz = periodic_parse_hz(argc > 1 ? argv[1] : NULL, CONTROL_HZ);
+	net_hz = periodic_parse_hz(argc > 2 ? argv[2] : NULL, NET_HZ);
+	use_uring = argc > 4 && strcmp(argv[4], "uring") == 0;
+
+	if (argc > 3 && strcmp(argv[3], "udp") == 0)
+		pthread_create(&tid1, NULL, serverUdpFun, NULL);
+	else
+		pthread_create(&tid1, NULL, serverFun, NULL);
 	pthread_create(&tid2, NULL, motorFun, NULL);
 
 	pthread_join(tid1, NULL);
@@ -0,0 +1,900 @@
+/**
+ * @file   sim_shim.c
+ *
+ * @brief  LD_PRELOAD plant simulator standing in for the motor and encoder
+ *         devices, so the control programs run unchanged on any Linux host
+ *
+ * The shim intercepts open/read/write/ioctl/mmap/close on /dev/motor_char,
+ * /dev/motor_pwm, /dev/wheel_encoder and /dev/rot_encoder. A background
+ * thread integrates a first order DC motor model at SIM_HZ and feeds a
+ * 2400 count wheel encoder. The rotary knob (96 counts) jumps from 0 to
+ * SIM_TARGET degrees SIM_STEP_MS after start, which gives PID_control a step
+ * response to follow. When SIM_DURATION_MS elapses the shim prints settling
+ * time, overshoot, steady-state error and a histogram of the control loop
+ * period (measured between pwm writes) to stderr and exits.
+ *
+ * send(), sendmsg() and sendmmsg() are intercepted as well so the TCP and
+ * UDP transports of server and client can be compared on a lossy link: a
+ * lost UDP datagram is dropped, a reordered one is held back and sent after
+ * the next, and a lost TCP segment stalls the sender for one retransmission
+ * timeout, like head-of-line blocking does. Sends that server and client
+ * submit through io_uring, their "uring" mode, reach the kernel without
+ * passing the shim and see a perfect link.
+ *
+ * The motor devices are socket pairs rather than eventfds: writes that a
+ * program submits through io_uring reach the kernel without passing the
+ * interposers, so an io thread applies whatever arrives at the other end.
+ * System calls of the control loop thread, the one that opened
+ * /dev/motor_pwm, are counted as they pass the shim, io_uring_enter made
+ * through syscall() included, and reported per loop period. Calls libc
+ * makes internally, like the stdio flushes, never pass it.
+ *
+ * Environment:
+ *   SIM_TARGET       step target in degrees (default 90)
+ *   SIM_STEP_MS      time of the step in ms (default 200)
+ *   SIM_DURATION_MS  run time in ms, 0 runs forever (default 0)
+ *   SIM_NET_LOSS     percentage of sends lost (default 0)
+ *   SIM_NET_REORDER  percentage of UDP sends reordered (default 0)
+ *   SIM_NET_RTO_MS   TCP retransmission timeout in ms (default 200)
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "encoder.h"
+#include "quadrature.h"
+#include "pwm_abi.h"
+#include "periodic.h"
+
+/** @brief plant integration rate in Hz */
+#define SIM_HZ 10000
+/** @brief largest fd the shim can track */
+#define SIM_MAX_FD 1024
+/** @brief motor speed at 100% duty in degrees per second */
+#define SIM_MAX_SPEED 720.0
+/** @brief motor time constant in seconds */
+#define SIM_TAU 0.05
+/** @brief duty fraction below which static friction holds the motor */
+#define SIM_STICTION 0.08
+/** @brief band around the target counted as settled, in degrees */
+#define SIM_BAND 2.0
+/** @brief width of a loop period histogram bin in ns */
+#define SIM_BIN_NS 100000
+/** @brief number of loop period histogram bins, the last one is overflow */
+#define SIM_BINS 200
+/** @brief fraction of the run at the end used for the steady-state error */
+#define SIM_TAIL 0.2
+/** @brief largest datagram that can be held back for reordering */
+#define SIM_NET_HOLD 256
+/** @brief epoll events the io thread handles per wakeup */
+#define SIM_IO_EVENTS 4
+
+/** @brief kinds of simulated devices */
+enum sim_kind {
+	SIM_NONE = 0,
+	SIM_MOTOR,
+	SIM_PWM,
+	SIM_WHEEL,
+	SIM_ROT,
+};
+
+/** @brief state of one simulated encoder */
+struct sim_encoder {
+	/** @brief counts per revolution */
+	int counts;
+	/** @brief absolute step count */
+	int count;
+	/** @brief edges since start */
+	unsigned int edges;
+	/** @brief state page handed out through mmap */
+	struct enc_state *state;
+	/** @brief edge-timed velocity, as the drivers estimate it */
+	struct quad_velocity vel;
+};
+
+/** @brief per-fd state of an open simulated device */
+struct sim_file {
+	/** @brief which device the fd stands for */
+	int kind;
+	/** @brief edges needed before the fd becomes readable, 0 never blocks */
+	unsigned int wakeup;
+	/** @brief encoder edges at the last read */
+	unsigned int seen;
+	/** @brief true while the backing eventfd is signalled */
+	int signalled;
+	/** @brief other end of a motor device's socket pair, -1 if none */
+	int peer;
+};
+
+/** @brief real libc entry points */
+static int (*real_open)(const char *, int, ...);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static ssize_t (*real_send)(int, const void *, size_t, int);
+static ssize_t (*real_sendmsg)(int, const struct msghdr *, int);
+static int (*real_sendmmsg)(int, struct mmsghdr *, unsigned int, int);
+static int (*real_clock_nanosleep)(clockid_t, int, const struct timespec *, struct timespec *);
+
+/** @brief open simulated devices, indexed by fd */
+static struct sim_file files[SIM_MAX_FD];
+/** @brief protects everything below */
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+/** @brief signalled whenever an encoder moves */
+static pthread_cond_t sim_moved = PTHREAD_COND_INITIALIZER;
+/** @brief makes sure the shim is set up once */
+static pthread_once_t sim_once = PTHREAD_ONCE_INIT;
+/** @brief makes sure the plant thread is started once */
+static pthread_once_t sim_start_once = PTHREAD_ONCE_INIT;
+
+/** @brief H-bridge direction written to /dev/motor_char */
+static int motor_dir;
+/** @brief duty written to /dev/motor_pwm, 0 to 1 */
+static double motor_duty;
+/** @brief motor speed in degrees per second */
+static double omega;
+/** @brief unwrapped wheel angle in degrees */
+static double wheel_angle;
+/** @brief the wheel encoder */
+static struct sim_encoder wheel = { WHEEL_COUNTS };
+/** @brief the rotary encoder */
+static struct sim_encoder rot = { ROT_COUNTS };
+
+/** @brief step target in degrees */
+static int target_deg;
+/** @brief step time in ns since start */
+static long long step_ns;
+/** @brief run time in ns, 0 runs forever */
+static long long duration_ns;
+/** @brief CLOCK_MONOTONIC time the shim started */
+static long long start_ns;
+
+/** @brief true once the program opened the rotary encoder */
+static int rot_used;
+/** @brief sign of the error right after the step */
+static int step_sign;
+/** @brief largest excursion past the target, in degrees */
+static double overshoot;
+/** @brief last time the error was outside SIM_BAND, ns since start */
+static long long unsettled_ns;
+/** @brief summed absolute error over the tail of the run */
+static double tail_err_sum;
+/** @brief number of samples in tail_err_sum */
+static long tail_samples;
+
+/** @brief protects the network state below, separate from sim_lock so a
+           stalled TCP send does not stop the plant */
+static pthread_mutex_t net_lock = PTHREAD_MUTEX_INITIALIZER;
+/** @brief percentage of sends lost */
+static int net_loss;
+/** @brief percentage of UDP sends reordered */
+static int net_reorder;
+/** @brief TCP retransmission timeout in ns */
+static long long net_rto_ns;
+/** @brief random state for the link model */
+static unsigned int net_seed = 349;
+/** @brief datagram held back to be sent after the next one */
+static unsigned char net_held[SIM_NET_HOLD];
+/** @brief length of the held datagram */
+static size_t net_held_len;
+/** @brief destination of the held datagram */
+static struct sockaddr_storage net_held_addr;
+/** @brief length of net_held_addr, 0 on a connected socket */
+static socklen_t net_held_addr_len;
+/** @brief socket of the held datagram, -1 if none */
+static int net_held_fd = -1;
+/** @brief UDP datagrams dropped */
+static unsigned long net_dropped;
+/** @brief UDP datagrams reordered */
+static unsigned long net_swapped;
+/** @brief TCP sends stalled by a retransmission */
+static unsigned long net_stalled;
+
+/** @brief epoll set of the motor socket pairs, read by the io thread */
+static int sim_epfd = -1;
+/** @brief true on the control loop thread */
+static __thread int sim_control;
+/** @brief system calls of the control loop thread */
+static unsigned long sim_syscalls;
+
+/** @brief time of the previous pwm write, 0 before the first */
+static long long last_loop_ns;
+/** @brief loop period histogram */
+static unsigned long loop_bins[SIM_BINS];
+/** @brief number of measured loop periods */
+static unsigned long loop_count;
+/** @brief summed loop periods in ns */
+static double loop_sum;
+/** @brief summed squared loop periods in ns^2 */
+static double loop_sq_sum;
+/** @brief shortest loop period in ns */
+static long long loop_min;
+/** @brief longest loop period in ns */
+static long long loop_max;
+
+/** @brief returns the CLOCK_MONOTONIC time in ns
+    @return the time in ns
+*/
+static long long sim_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+/** @brief makes a system call without going through libc, so neither the
+           interposers below nor a sanitizer runtime see it. The shim runs
+           on the x86-64 build host.
+    @param nr is the system call number
+    @return the result, -1 with errno set on error
+*/
+static long sim_syscall(long nr, long a1, long a2, long a3, long a4, long a5, long a6) {
+	register long r10 __asm__("r10") = a4;
+	register long r8 __asm__("r8") = a5;
+	register long r9 __asm__("r9") = a6;
+	long ret;
+
+	__asm__ volatile ("syscall" : "=a"(ret)
+	                  : "a"(nr), "D"(a1), "S"(a2), "d"(a3), "r"(r10), "r"(r8), "r"(r9)
+	                  : "rcx", "r11", "memory");
+	if (ret < 0 && ret > -4096) {
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+/** @brief maps memory without going through the mmap interposer
+    @return the mapping, MAP_FAILED on error
+*/
+static void *sim_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off) {
+	return (void *)sim_syscall(SYS_mmap, (long)addr, len, prot, flags, fd, off);
+}
+
+/** @brief counts a system call if the control loop thread makes it */
+static void sim_count(void) {
+	if (sim_control) __atomic_fetch_add(&sim_syscalls, 1, __ATOMIC_RELAXED);
+}
+
+/** @brief reads an integer from the environment
+    @param name is the variable name
+    @param def is the value used if it is not set
+    @return the value
+*/
+static long env_long(const char *name, long def) {
+	const char *v = getenv(name);
+	return v ? atol(v) : def;
+}
+
+/** @brief moves an encoder to a new count and republishes its state page.
+           Called with sim_lock held.
+    @param enc is the encoder
+    @param count is the new absolute count
+    @param now is the current time in ns
+*/
+static void sim_encoder_set(struct sim_encoder *enc, int count, long long now) {
+	struct enc_state *st = enc->state;
+	int delta = count-enc->count;
+	int angle;
+
+	if (delta == 0) return;
+	enc->edges += delta < 0 ? -delta : delta;
+	enc->count = count;
+	angle = count % enc->counts;
+	if (angle < 0) angle += enc->counts;
+
+	__atomic_store_n(&st->seq, st->seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	st->angle = angle;
+	st->count = count;
+	st->dir = delta > 0 ? 1 : -1;
+	st->last_edge_ns = now;
+	quad_vel_edge(&enc->vel, count, st->dir, now);
+	st->velocity = enc->vel.velocity;
+	__atomic_store_n(&st->seq, st->seq+1, __ATOMIC_RELEASE);
+}
+
+/** @brief signals the eventfd of every encoder fd that became readable.
+           Called with sim_lock held.
+*/
+static void sim_notify(void) {
+	uint64_t one = 1;
+	struct sim_encoder *enc;
+	int fd;
+
+	for (fd = 0; fd < SIM_MAX_FD; fd++) {
+		if (files[fd].kind != SIM_WHEEL && files[fd].kind != SIM_ROT) continue;
+		if (files[fd].wakeup == 0 || files[fd].signalled) continue;
+		enc = files[fd].kind == SIM_WHEEL ? &wheel : &rot;
+		if (enc->edges-files[fd].seen >= files[fd].wakeup) {
+			real_write(fd, &one, sizeof(one));
+			files[fd].signalled = 1;
+		}
+	}
+	pthread_cond_broadcast(&sim_moved);
+}
+
+/** @brief applies a new pwm duty, one per control iteration, which marks
+           the loop period. Called with sim_lock held.
+    @param duty is the duty, 0 to 1
+*/
+static void sim_set_duty(double duty) {
+	long long now = sim_now(), period;
+	int bin;
+
+	motor_duty = duty;
+	if (last_loop_ns) {
+		period = now-last_loop_ns;
+		bin = period/SIM_BIN_NS;
+		loop_bins[bin < SIM_BINS ? bin : SIM_BINS-1]++;
+		loop_count++;
+		loop_sum += period;
+		loop_sq_sum += (double)period*period;
+		if (loop_min < 0 || period < loop_min) loop_min = period;
+		if (period > loop_max) loop_max = period;
+	}
+	last_loop_ns = now;
+}
+
+/** @brief sets direction and duty together, like PWM_IOC_MOTOR. Called
+           with sim_lock held.
+    @param period_ns is the pwm period
+    @param speed_ns is the signed high time
+    @return 0 on success, -1 with errno set if out of range
+*/
+static int sim_set_motor(uint32_t period_ns, int32_t speed_ns) {
+	if (period_ns < PWM_PERIOD_MIN_NS || period_ns > PWM_PERIOD_MAX_NS ||
+	    llabs(speed_ns) > period_ns) {
+		errno = EINVAL;
+		return -1;
+	}
+	// a braked motor is modelled like a coasting one
+	motor_dir = speed_ns > 0 ? 1 : (speed_ns < 0 ? 2 : 0);
+	sim_set_duty((double)llabs(speed_ns)/period_ns);
+	return 0;
+}
+
+/** @brief applies a text write to a motor device, the direction to
+           /dev/motor_char, the duty in percent or "period_ns speed_ns" to
+           /dev/motor_pwm. Called with sim_lock held.
+    @param kind is the device
+    @param input is the text
+    @return 0 on success, -1 with errno set if out of range
+*/
+static int sim_apply(int kind, const char *input) {
+	unsigned int period_ns;
+	int speed_ns;
+
+	if (kind == SIM_MOTOR) {
+		motor_dir = atoi(input);
+	} else if (kind == SIM_PWM) {
+		if (sscanf(input, "%u %d", &period_ns, &speed_ns) == 2)
+			return sim_set_motor(period_ns, speed_ns);
+		sim_set_duty(atoi(input)/100.0);
+	}
+	return 0;
+}
+
+/** @brief prints the step response and loop timing report to stderr */
+static void sim_report(void) {
+	double mean, var;
+	int i;
+
+	if (!rot_used) {
+		fprintf(stderr, "sim: rotary encoder unused, no step response\n");
+		goto loop_timing;
+	}
+	fprintf(stderr, "sim: step 0 -> %d deg at %lld ms\n", target_deg, step_ns/1000000);
+	if (unsettled_ns >= duration_ns-duration_ns/100)
+		fprintf(stderr, "sim: settling time: not settled within +-%.1f deg\n", SIM_BAND);
+	else
+		fprintf(stderr, "sim: settling time: %.1f ms (+-%.1f deg)\n",
+		        (unsettled_ns-step_ns)/1e6, SIM_BAND);
+	fprintf(stderr, "sim: overshoot: %.2f deg\n", overshoot);
+	fprintf(stderr, "sim: steady-state error: %.2f deg\n",
+	        tail_samples ? tail_err_sum/tail_samples : 0.0);
+
+loop_timing:
+	if (net_loss || net_reorder)
+		fprintf(stderr, "sim: net: %lu datagrams dropped, %lu reordered, %lu tcp stalls\n",
+		        net_dropped, net_swapped, net_stalled);
+	if (loop_count == 0) {
+		fprintf(stderr, "sim: no pwm writes, no loop timing\n");
+		return;
+	}
+	fprintf(stderr, "sim: control thread: %lu system calls, %.2f per loop period\n",
+	        __atomic_load_n(&sim_syscalls, __ATOMIC_RELAXED),
+	        (double)__atomic_load_n(&sim_syscalls, __ATOMIC_RELAXED)/loop_count);
+	mean = loop_sum/loop_count;
+	var = loop_sq_sum/loop_count-mean*mean;
+	fprintf(stderr, "sim: loop period: %lu samples, mean %.1f us (%.1f Hz), "
+	        "jitter %.1f us, min %.1f us, max %.1f us\n",
+	        loop_count, mean/1e3, 1e9/mean, sqrt(var > 0 ? var : 0)/1e3,
+	        loop_min/1e3, loop_max/1e3);
+	for (i = 0; i < SIM_BINS; i++) {
+		if (loop_bins[i] == 0) continue;
+		if (i == SIM_BINS-1)
+			fprintf(stderr, "sim:   >= %5.1f ms: %lu\n", i*SIM_BIN_NS/1e6, loop_bins[i]);
+		else
+			fprintf(stderr, "sim:   %5.1f-%5.1f ms: %lu\n", i*SIM_BIN_NS/1e6,
+			        (i+1)*SIM_BIN_NS/1e6, loop_bins[i]);
+	}
+}
+
+/** @brief advances the plant by one step and records the step response.
+           Called with sim_lock held.
+    @param now is the current time in ns since start
+*/
+static void sim_step(long long now) {
+	double dt = 1.0/SIM_HZ, u, goal, err;
+	int target = now >= step_ns ? target_deg : 0;
+
+	u = motor_duty*(motor_dir == 1 ? 1 : (motor_dir == 2 ? -1 : 0));
+	goal = fabs(u) < SIM_STICTION ? 0 : u*SIM_MAX_SPEED;
+	omega += (goal-omega)*dt/SIM_TAU;
+	wheel_angle += omega*dt;
+
+	sim_encoder_set(&wheel, (int)floor(wheel_angle*wheel.counts/360.0), start_ns+now);
+	sim_encoder_set(&rot, target*rot.counts/360, start_ns+now);
+	sim_notify();
+
+	if (now < step_ns) return;
+	err = fmod(target-wheel_angle, 360.0);
+	if (err < -180) err += 360;
+	else if (err >= 180) err -= 360;
+	if (step_sign == 0) step_sign = err < 0 ? -1 : 1;
+	if (-step_sign*err > overshoot) overshoot = -step_sign*err;
+	if (fabs(err) > SIM_BAND) unsettled_ns = now;
+	if (duration_ns && now >= duration_ns-(long long)(duration_ns*SIM_TAIL)) {
+		tail_err_sum += fabs(err);
+		tail_samples++;
+	}
+}
+
+/** @brief the plant thread, runs at SIM_HZ until the duration elapses
+    @param arg is unused
+    @return never returns when a duration is set
+*/
+static void *sim_thread(void *arg) {
+	struct periodic_task task;
+	long long now;
+
+	periodic_init(&task, "sim", SIM_HZ);
+	while (1) {
+		now = sim_now()-start_ns;
+		pthread_mutex_lock(&sim_lock);
+		sim_step(now);
+		if (duration_ns && now >= duration_ns) {
+			sim_report();
+			fflush(NULL);
+			_exit(0);
+		}
+		pthread_mutex_unlock(&sim_lock);
+		periodic_wait(&task);
+	}
+	return NULL;
+}
+
+/** @brief the io thread, applies what arrives on the motor socket pairs
+    @param arg is unused
+    @return never returns
+*/
+static void *sim_io_thread(void *arg) {
+	struct epoll_event ev[SIM_IO_EVENTS];
+	char input[32];
+	ssize_t len;
+	int n, i, fd;
+
+	while (1) {
+		n = epoll_wait(sim_epfd, ev, SIM_IO_EVENTS, -1);
+		for (i = 0; i < n; i++) {
+			fd = (int)(uint32_t)ev[i].data.u64;
+			while ((len = recv(fd, input, sizeof(input)-1, MSG_DONTWAIT)) > 0) {
+				input[len] = 0;
+				pthread_mutex_lock(&sim_lock);
+				sim_apply(ev[i].data.u64 >> 32, input);
+				pthread_mutex_unlock(&sim_lock);
+			}
+		}
+	}
+	return NULL;
+}
+
+/** @brief resolves the real libc functions and sets up the plant */
+static void sim_init(void) {
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_send = dlsym(RTLD_NEXT, "send");
+	real_sendmsg = dlsym(RTLD_NEXT, "sendmsg");
+	real_sendmmsg = dlsym(RTLD_NEXT, "sendmmsg");
+	real_clock_nanosleep = dlsym(RTLD_NEXT, "clock_nanosleep");
+
+	target_deg = env_long("SIM_TARGET", 90);
+	step_ns = env_long("SIM_STEP_MS", 200)*1000000LL;
+	duration_ns = env_long("SIM_DURATION_MS", 0)*1000000LL;
+	net_loss = env_long("SIM_NET_LOSS", 0);
+	net_reorder = env_long("SIM_NET_REORDER", 0);
+	net_rto_ns = env_long("SIM_NET_RTO_MS", 200)*1000000LL;
+	loop_min = -1;
+	unsettled_ns = step_ns;
+
+	wheel.state = sim_mmap(NULL, sizeof(struct enc_state), PROT_READ|PROT_WRITE,
+	                        MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	rot.state = sim_mmap(NULL, sizeof(struct enc_state), PROT_READ|PROT_WRITE,
+	                      MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	wheel.state->counts_per_rev = wheel.counts;
+	rot.state->counts_per_rev = rot.counts;
+}
+
+/** @brief starts the plant and io threads. Deferred to the first simulated open
+           because libc calls made while a sanitizer runtime initialises
+           already go through the shim, before threads may be created.
+*/
+static void sim_start(void) {
+	pthread_t tid;
+
+	start_ns = sim_now();
+	pthread_create(&tid, NULL, sim_thread, NULL);
+	sim_epfd = epoll_create1(EPOLL_CLOEXEC);
+	pthread_create(&tid, NULL, sim_io_thread, NULL);
+}
+
+/** @brief returns the simulated device behind a path
+    @param path is the path passed to open
+    @return the device kind, SIM_NONE for real files
+*/
+static int sim_kind_of(const char *path) {
+	if (strcmp(path, "/dev/motor_char") == 0) return SIM_MOTOR;
+	if (strcmp(path, "/dev/motor_pwm") == 0) return SIM_PWM;
+	if (strcmp(path, "/dev/wheel_encoder") == 0) return SIM_WHEEL;
+	if (strcmp(path, "/dev/rot_encoder") == 0) return SIM_ROT;
+	return SIM_NONE;
+}
+
+/** @brief returns the simulated file behind an fd
+    @param fd is the file descriptor
+    @return the file, NULL for real files
+*/
+static struct sim_file *sim_file_of(int fd) {
+	pthread_once(&sim_once, sim_init);
+	if (fd < 0 || fd >= SIM_MAX_FD || files[fd].kind == SIM_NONE) return NULL;
+	return &files[fd];
+}
+
+int open(const char *path, int flags, ...) {
+	struct epoll_event ev;
+	mode_t mode = 0;
+	va_list ap;
+	int kind, fd, sv[2] = { -1, -1 };
+
+	pthread_once(&sim_once, sim_init);
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	kind = sim_kind_of(path);
+	if (kind == SIM_NONE) return real_open(path, flags, mode);
+	pthread_once(&sim_start_once, sim_start);
+
+	// an eventfd gives each device a real, pollable descriptor, a socket
+	// pair also lets writes that bypass the shim reach the io thread
+	if (kind == SIM_MOTOR || kind == SIM_PWM) {
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) < 0) return -1;
+		fd = sv[0];
+	} else {
+		fd = eventfd(0, EFD_CLOEXEC);
+	}
+	if (fd < 0 || fd >= SIM_MAX_FD) {
+		if (fd >= 0) real_close(fd);
+		if (sv[1] >= 0) real_close(sv[1]);
+		errno = EMFILE;
+		return -1;
+	}
+	if (sv[1] >= 0) {
+		ev.events = EPOLLIN;
+		ev.data.u64 = (uint64_t)kind << 32 | (uint32_t)sv[1];
+		epoll_ctl(sim_epfd, EPOLL_CTL_ADD, sv[1], &ev);
+	}
+	if (kind == SIM_PWM) sim_control = 1;
+	pthread_mutex_lock(&sim_lock);
+	memset(&files[fd], 0, sizeof(files[fd]));
+	files[fd].kind = kind;
+	files[fd].peer = sv[1];
+	if (kind == SIM_ROT) rot_used = 1;
+	pthread_mutex_unlock(&sim_lock);
+	return fd;
+}
+
+int open64(const char *path, int flags, ...) {
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	return open(path, flags, mode);
+}
+
+ssize_t read(int fd, void *buf, size_t len) {
+	struct sim_file *f = sim_file_of(fd);
+	struct sim_encoder *enc;
+	char output[64] = {0};
+	uint64_t drain;
+
+	if (f == NULL) return real_read(fd, buf, len);
+	sim_count();
+	if (f->kind != SIM_WHEEL && f->kind != SIM_ROT) return 0;
+	enc = f->kind == SIM_WHEEL ? &wheel : &rot;
+
+	pthread_mutex_lock(&sim_lock);
+	while (f->wakeup && !(fcntl(fd, F_GETFL) & O_NONBLOCK) && enc->edges-f->seen < f->wakeup)
+		pthread_cond_wait(&sim_moved, &sim_lock);
+	f->seen = enc->edges;
+	if (f->signalled) {
+		real_read(fd, &drain, sizeof(drain));
+		f->signalled = 0;
+	}
+	snprintf(output, sizeof(output), "%d %d", enc->state->angle*360/enc->counts,
+	         (int)((long long)quad_vel_read(&enc->vel, sim_now())*360/enc->counts));
+	pthread_mutex_unlock(&sim_lock);
+
+	// like the driver: copy the whole text buffer and report 0 bytes
+	memcpy(buf, output, len < sizeof(output) ? len : sizeof(output));
+	return 0;
+}
+
+ssize_t write(int fd, const void *buf, size_t len) {
+	struct sim_file *f = sim_file_of(fd);
+	char input[32] = {0};
+	int rc;
+
+	if (f == NULL) return real_write(fd, buf, len);
+	sim_count();
+	memcpy(input, buf, len < sizeof(input)-1 ? len : sizeof(input)-1);
+
+	pthread_mutex_lock(&sim_lock);
+	rc = sim_apply(f->kind, input);
+	pthread_mutex_unlock(&sim_lock);
+	return rc < 0 ? -1 : (ssize_t)len;
+}
+
+int close(int fd) {
+	struct sim_file *f = sim_file_of(fd);
+	int peer = -1;
+
+	if (f != NULL) {
+		pthread_mutex_lock(&sim_lock);
+		f->kind = SIM_NONE;
+		peer = f->peer;
+		pthread_mutex_unlock(&sim_lock);
+	}
+	if (peer >= 0) real_close(peer);
+	return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...) {
+	struct sim_file *f = sim_file_of(fd);
+	struct pwm_setting *set;
+	struct pwm_motor_cmd *cmd;
+	va_list ap;
+	void *arg;
+	int rc;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (f == NULL) return real_ioctl(fd, request, arg);
+	sim_count();
+	if (request == ENC_IOC_SET_WAKEUP && (f->kind == SIM_WHEEL || f->kind == SIM_ROT)) {
+		pthread_mutex_lock(&sim_lock);
+		f->wakeup = *(unsigned int *)arg;
+		pthread_mutex_unlock(&sim_lock);
+		return 0;
+	}
+	if (request == PWM_IOC_SET && f->kind == SIM_PWM) {
+		set = arg;
+		if (set->period_ns < PWM_PERIOD_MIN_NS || set->period_ns > PWM_PERIOD_MAX_NS ||
+		    set->duty_ns > set->period_ns) {
+			errno = EINVAL;
+			return -1;
+		}
+		pthread_mutex_lock(&sim_lock);
+		sim_set_duty((double)set->duty_ns/set->period_ns);
+		pthread_mutex_unlock(&sim_lock);
+		return 0;
+	}
+	if (request == PWM_IOC_MOTOR && f->kind == SIM_PWM) {
+		cmd = arg;
+		pthread_mutex_lock(&sim_lock);
+		rc = sim_set_motor(cmd->period_ns, cmd->speed_ns);
+		pthread_mutex_unlock(&sim_lock);
+		return rc;
+	}
+	// binary mode is not simulated, encoder.c falls back to text mode
+	errno = ENOTTY;
+	return -1;
+}
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off) {
+	struct sim_file *f;
+
+	// anonymous maps come from allocators, possibly a sanitizer runtime that
+	// is not initialised yet, so they must not trigger sim_init
+	if (fd < 0) return sim_mmap(addr, len, prot, flags, fd, off);
+	f = sim_file_of(fd);
+	if (f == NULL) return sim_mmap(addr, len, prot, flags, fd, off);
+	if ((f->kind != SIM_WHEEL && f->kind != SIM_ROT) || off != 0 || len > sizeof(struct enc_state)) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+	if (prot & PROT_WRITE) {
+		errno = EPERM;
+		return MAP_FAILED;
+	}
+	return f->kind == SIM_WHEEL ? wheel.state : rot.state;
+}
+
+int munmap(void *addr, size_t len) {
+	// the state pages stay alive for the plant thread
+	if (addr == wheel.state || addr == rot.state) return 0;
+	return sim_syscall(SYS_munmap, (long)addr, len, 0, 0, 0, 0);
+}
+
+int clock_nanosleep(clockid_t clock, int flags, const struct timespec *req, struct timespec *rem) {
+	pthread_once(&sim_once, sim_init);
+	sim_count();
+	return real_clock_nanosleep(clock, flags, req, rem);
+}
+
+long syscall(long nr, ...) {
+	long a[6];
+	va_list ap;
+	int i;
+
+	// like the libc one, takes as many arguments as any system call has
+	va_start(ap, nr);
+	for (i = 0; i < 6; i++) a[i] = va_arg(ap, long);
+	va_end(ap);
+	sim_count();
+	return sim_syscall(nr, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+/** @brief rolls the link model dice. Called with net_lock held.
+    @param percent is the chance in percent
+    @return non-zero with the given chance
+*/
+static int net_chance(int percent) {
+	return percent > 0 && (int)(rand_r(&net_seed) % 100) < percent;
+}
+
+/** @brief passes one message through the link model, shared by send,
+           sendmsg and sendmmsg
+    @param fd is the socket
+    @param mh is the message
+    @param flags are the send flags
+    @return what sendmsg returns, the full length for a dropped or held
+            datagram
+*/
+static ssize_t net_sendmsg(int fd, const struct msghdr *mh, int flags) {
+	struct msghdr held;
+	struct iovec iov;
+	struct timespec rto;
+	socklen_t type_len = sizeof(int);
+	size_t len = 0, i;
+	int type, stall;
+	ssize_t n;
+
+	if ((net_loss == 0 && net_reorder == 0) ||
+	    getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len) < 0)
+		return real_sendmsg(fd, mh, flags);
+
+	pthread_mutex_lock(&net_lock);
+	if (type == SOCK_STREAM) {
+		// the stream cannot lose data, a lost segment delays it and
+		// everything queued behind it until the retransmission
+		stall = net_chance(net_loss);
+		if (stall) net_stalled++;
+		pthread_mutex_unlock(&net_lock);
+		if (stall) {
+			rto.tv_sec = net_rto_ns/1000000000LL;
+			rto.tv_nsec = net_rto_ns%1000000000LL;
+			nanosleep(&rto, NULL);
+		}
+		return real_sendmsg(fd, mh, flags);
+	}
+
+	for (i = 0; i < mh->msg_iovlen; i++) len += mh->msg_iov[i].iov_len;
+	if (net_chance(net_loss)) {
+		net_dropped++;
+		pthread_mutex_unlock(&net_lock);
+		return len;
+	}
+	if (net_held_fd < 0 && len <= sizeof(net_held) && mh->msg_namelen <= sizeof(net_held_addr) &&
+	    net_chance(net_reorder)) {
+		for (net_held_len = 0, i = 0; i < mh->msg_iovlen; i++) {
+			memcpy(net_held+net_held_len, mh->msg_iov[i].iov_base, mh->msg_iov[i].iov_len);
+			net_held_len += mh->msg_iov[i].iov_len;
+		}
+		// a follower of an unconnected socket is named per datagram
+		net_held_addr_len = mh->msg_name ? mh->msg_namelen : 0;
+		if (net_held_addr_len) memcpy(&net_held_addr, mh->msg_name, net_held_addr_len);
+		net_held_fd = fd;
+		net_swapped++;
+		pthread_mutex_unlock(&net_lock);
+		return len;
+	}
+	n = real_sendmsg(fd, mh, flags);
+	if (net_held_fd == fd) {
+		memset(&held, 0, sizeof(held));
+		iov.iov_base = net_held;
+		iov.iov_len = net_held_len;
+		held.msg_name = net_held_addr_len ? &net_held_addr : NULL;
+		held.msg_namelen = net_held_addr_len;
+		held.msg_iov = &iov;
+		held.msg_iovlen = 1;
+		real_sendmsg(fd, &held, flags);
+		net_held_fd = -1;
+	}
+	pthread_mutex_unlock(&net_lock);
+	return n;
+}
+
+ssize_t send(int fd, const void *buf, size_t len, int flags) {
+	struct iovec iov = { (void *)buf, len };
+	struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	pthread_once(&sim_once, sim_init);
+	sim_count();
+	if (net_loss == 0 && net_reorder == 0) return real_send(fd, buf, len, flags);
+	return net_sendmsg(fd, &mh, flags);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *mh, int flags) {
+	pthread_once(&sim_once, sim_init);
+	sim_count();
+	return net_sendmsg(fd, mh, flags);
+}
+
+int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags) {
+	unsigned int i;
+	ssize_t n;
+
+	pthread_once(&sim_once, sim_init);
+	sim_count();
+	if (net_loss == 0 && net_reorder == 0) return real_sendmmsg(fd, msgs, vlen, flags);
+	// one datagram at a time, each rolls the dice on its own
+	for (i = 0; i < vlen; i++) {
+		n = net_sendmsg(fd, &msgs[i].msg_hdr, flags);
+		if (n < 0) return i ? (int)i : -1;
+		msgs[i].msg_len = n;
+	}
+	return vlen;
+}
@@ -0,0 +1,104 @@
+# Summarises a capture of the motor tracepoints, see motor_trace.h
+#
+# Record on the Pi with
+#   trace-cmd record -e motor -e irq:irq_handler_entry
+# then run
+#   trace-cmd report | python trace_report.py
+# or feed it a plain ftrace buffer, /sys/kernel/debug/tracing/trace.
+#
+# Prints histograms of
+#   - encoder IRQ latency: irq_handler_entry to the decoded edge on that CPU,
+#     the encoder interrupts carry the device name
+#   - hrtimer lateness: motor_timer_fire, per driver
+#   - loop period: time between updates of the same pwm channel or writes to
+#     the same device, which is the period of the loop driving it
+#
+# Author: David Dong haochend@andrew.cmu.edu
+#         Yanying Zhu yanyingz@andrew.cmu.edu
+from __future__ import print_function
+
+import re
+import sys
+from collections import defaultdict
+
+# cpu, timestamp in seconds, event name, event fields
+LINE = re.compile(r'\[(\d+)\]\s+(?:\S+\s+)?(\d+\.\d+):\s+(\w+):\s*(.*)$')
+FIELD = re.compile(r'(\w+)=(\S+)')
+
+# widest bar printed
+BAR_WIDTH = 40
+
+
+def parse(lines):
+    """Yield (cpu, time in ns, event, fields) for every trace line."""
+    for line in lines:
+        m = LINE.search(line)
+        if m is None:
+            continue
+        fields = dict(FIELD.findall(m.group(4)))
+        ts = int(round(float(m.group(2)) * 1e9))
+        yield int(m.group(1)), ts, m.group(3), fields
+
+
+def bucket(ns):
+    """Return the power of two microsecond bucket of a duration."""
+    us = max(ns, 0) // 1000
+    b = 1
+    while b <= us:
+        b *= 2
+    return b
+
+
+def histogram(title, samples):
+    """Print a log2 histogram of durations in ns."""
+    if not samples:
+        return
+    samples.sort()
+    n = len(samples)
+    print('%s: %d samples, min %.1f us, median %.1f us, p99 %.1f us, '
+          'max %.1f us' % (title, n, samples[0] / 1e3,
+                           samples[n // 2] / 1e3,
+                           samples[min(n - 1, n * 99 // 100)] / 1e3,
+                           samples[-1] / 1e3))
+    counts = defaultdict(int)
+    for s in samples:
+        counts[bucket(s)] += 1
+    top = max(counts.values())
+    for b in sorted(counts):
+        bar = '#' * max(1, counts[b] * BAR_WIDTH // top)
+        print('  < %8d us %8d %s' % (b, counts[b], bar))
+    print()
+
+
+def main():
+    irq_entry = {}
+    irq_latency = []
+    late = defaultdict(list)
+    period = defaultdict(list)
+    last = {}
+
+    for cpu, ts, event, f in parse(sys.stdin):
+        if event == 'irq_handler_entry':
+            irq_entry[cpu] = (f.get('name'), ts)
+        elif event == 'motor_enc_edge':
+            name, entry = irq_entry.pop(cpu, (None, 0))
+            if name == f.get('dev'):
+                irq_latency.append(ts - entry)
+        elif event == 'motor_timer_fire':
+            late[f.get('dev')].append(int(f.get('late_ns', 0)))
+        elif event in ('motor_pwm_update', 'motor_dev_write'):
+            key = 'pwm channel ' + f['channel'] if 'channel' in f \
+                else f.get('dev')
+            if key in last:
+                period[key].append(ts - last[key])
+            last[key] = ts
+
+    histogram('encoder irq latency', irq_latency)
+    for dev in sorted(late):
+        histogram('timer lateness ' + dev, late[dev])
+    for key in sorted(period):
+        histogram('loop period ' + key, period[key])
+
+
+if __name__ == '__main__':
+    main()
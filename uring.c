@@ -0,0 +1,283 @@
+/**
+ * @file   uring.c
+ *
+ * @brief  minimal io_uring access through the raw system calls, for loops
+ *         that submit all their I/O of one period in a single system call
+ *
+ * liburing is not part of the Raspbian toolchain, so the rings are set up
+ * and mapped here by hand. No submission queue thread is used: submissions
+ * only reach the kernel in uring_enter, which keeps the count of system
+ * calls per period exact.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "uring.h"
+
+/** @brief completions reaped in one go by uring_periodic_wait */
+#define URING_REAP 16
+/** @brief tag of the period timeout queued by uring_periodic_wait */
+#define URING_TAG_PERIOD UINT64_MAX
+
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup)
+
+int uring_init(struct uring *r, unsigned int entries) {
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0) return -1;
+	// writes at the current position came with 5.6, like send and recv
+	if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+		close(r->fd);
+		r->fd = -1;
+		errno = ENOSYS;
+		return -1;
+	}
+
+	r->sq_ring_len = p.sq_off.array+p.sq_entries*sizeof(unsigned int);
+	r->cq_ring_len = p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_len > r->sq_ring_len) r->sq_ring_len = r->cq_ring_len;
+		r->cq_ring_len = 0;
+	}
+	r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd,
+	                  IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED) goto fail;
+	if (r->cq_ring_len) {
+		r->cq_ring = mmap(NULL, r->cq_ring_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+		                  r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ring == MAP_FAILED) goto fail;
+	}
+	r->sqes_len = p.sq_entries*sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd,
+	               IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) goto fail;
+
+	sq = r->sq_ring;
+	cq = r->cq_ring ? r->cq_ring : r->sq_ring;
+	r->sq_head = (unsigned int *)(sq+p.sq_off.head);
+	r->sq_tail = (unsigned int *)(sq+p.sq_off.tail);
+	r->sq_mask = *(unsigned int *)(sq+p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)(sq+p.sq_off.array);
+	r->cq_head = (unsigned int *)(cq+p.cq_off.head);
+	r->cq_tail = (unsigned int *)(cq+p.cq_off.tail);
+	r->cq_mask = *(unsigned int *)(cq+p.cq_off.ring_mask);
+	r->cqes = cq+p.cq_off.cqes;
+	return 0;
+
+fail:
+	if (r->sqes == MAP_FAILED) r->sqes = NULL;
+	if (r->cq_ring == MAP_FAILED) r->cq_ring = NULL;
+	if (r->sq_ring == MAP_FAILED) r->sq_ring = NULL;
+	uring_exit(r);
+	return -1;
+}
+
+/** @brief takes the next free submission entry and clears it. The tail is
+           published right away, the kernel only looks at it in
+           io_uring_enter.
+    @param r is the instance
+    @return the entry, NULL if the submission ring is full
+*/
+static struct io_uring_sqe *uring_get(struct uring *r) {
+	unsigned int tail = *r->sq_tail, index = tail & r->sq_mask;
+	struct io_uring_sqe *sqe;
+
+	if (tail-__atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) > r->sq_mask) return NULL;
+	sqe = (struct io_uring_sqe *)r->sqes+index;
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[index] = index;
+	__atomic_store_n(r->sq_tail, tail+1, __ATOMIC_RELEASE);
+	r->queued++;
+	return sqe;
+}
+
+/** @brief queues an operation on a buffer
+    @param r is the instance
+    @param op is the IORING_OP_* opcode
+    @param fd is the file
+    @param buf is the buffer, or the struct msghdr of a sendmsg or recvmsg
+    @param len is its size, 1 for a struct msghdr
+    @param off is the file offset
+    @param tag is returned with the completion
+    @return 0 on success, -1 if the submission ring is full
+*/
+static int uring_rw(struct uring *r, int op, int fd, const void *buf, size_t len, int64_t off,
+                    uint64_t tag) {
+	struct io_uring_sqe *sqe = uring_get(r);
+
+	if (sqe == NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->user_data = tag;
+	return 0;
+}
+
+int uring_write(struct uring *r, int fd, const void *buf, size_t len, int64_t off, uint64_t tag) {
+	return uring_rw(r, IORING_OP_WRITE, fd, buf, len, off, tag);
+}
+
+int uring_send(struct uring *r, int fd, const void *buf, size_t len, uint64_t tag) {
+	return uring_rw(r, IORING_OP_SEND, fd, buf, len, 0, tag);
+}
+
+int uring_recv(struct uring *r, int fd, void *buf, size_t len, uint64_t tag) {
+	return uring_rw(r, IORING_OP_RECV, fd, buf, len, 0, tag);
+}
+
+int uring_sendmsg(struct uring *r, int fd, const struct msghdr *msg, uint64_t tag) {
+	return uring_rw(r, IORING_OP_SENDMSG, fd, msg, 1, 0, tag);
+}
+
+int uring_recvmsg(struct uring *r, int fd, struct msghdr *msg, uint64_t tag) {
+	return uring_rw(r, IORING_OP_RECVMSG, fd, msg, 1, 0, tag);
+}
+
+int uring_timeout(struct uring *r, const struct timespec *at, uint64_t tag) {
+	struct io_uring_sqe *sqe = uring_get(r);
+
+	if (sqe == NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+	r->deadline[0] = at->tv_sec;
+	r->deadline[1] = at->tv_nsec;
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t)r->deadline;
+	sqe->len = 1;
+	sqe->timeout_flags = IORING_TIMEOUT_ABS;
+	sqe->user_data = tag;
+	return 0;
+}
+
+int uring_enter(struct uring *r, unsigned int wait_nr) {
+	long n;
+
+	do {
+		r->enters++;
+		n = syscall(__NR_io_uring_enter, r->fd, r->queued, wait_nr,
+		            wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (n > 0) {
+			r->queued -= n;
+			r->inflight += n;
+		}
+	} while (n < 0 && errno == EINTR);
+	return n < 0 ? -1 : 0;
+}
+
+int uring_reap(struct uring *r, struct uring_done *done, int max) {
+	unsigned int head = *r->cq_head, tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	struct io_uring_cqe *cqe;
+	int n = 0;
+
+	for (; head != tail && n < max; head++, n++) {
+		cqe = (struct io_uring_cqe *)r->cqes+(head & r->cq_mask);
+		done[n].tag = cqe->user_data;
+		done[n].res = cqe->res;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	r->inflight -= n;
+	return n;
+}
+
+void uring_exit(struct uring *r) {
+	if (r->sqes) munmap(r->sqes, r->sqes_len);
+	if (r->cq_ring) munmap(r->cq_ring, r->cq_ring_len);
+	if (r->sq_ring) munmap(r->sq_ring, r->sq_ring_len);
+	if (r->fd >= 0) close(r->fd);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+#else
+
+int uring_init(struct uring *r, unsigned int entries) {
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_write(struct uring *r, int fd, const void *buf, size_t len, int64_t off, uint64_t tag) {
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_send(struct uring *r, int fd, const void *buf, size_t len, uint64_t tag) {
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_recv(struct uring *r, int fd, void *buf, size_t len, uint64_t tag) {
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_sendmsg(struct uring *r, int fd, const struct msghdr *msg, uint64_t tag) {
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_recvmsg(struct uring *r, int fd, struct msghdr *msg, uint64_t tag) {
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_timeout(struct uring *r, const struct timespec *at, uint64_t tag) {
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_enter(struct uring *r, unsigned int wait_nr) {
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_reap(struct uring *r, struct uring_done *done, int max) {
+	return 0;
+}
+
+void uring_exit(struct uring *r) {
+	r->fd = -1;
+}
+
+#endif
+
+void uring_periodic_wait(struct uring *r, struct periodic_task *task) {
+	struct uring_done done[URING_REAP];
+	int due = periodic_next(task);
+
+	// an overrun still submits, and waits only for what was queued
+	if (due && uring_timeout(r, &task->next, URING_TAG_PERIOD) < 0) {
+		uring_enter(r, 0);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &task->next, NULL) == EINTR);
+	} else if (uring_enter(r, r->queued+r->inflight) < 0 && due) {
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &task->next, NULL) == EINTR);
+	}
+	while (uring_reap(r, done, URING_REAP) == URING_REAP);
+	if (due) periodic_released(task);
+}
@@ -0,0 +1,182 @@
+/**
+ * @file   uring.h
+ *
+ * @brief  minimal io_uring access through the raw system calls, for loops
+ *         that submit all their I/O of one period in a single system call
+ *
+ * Operations are queued with the uring_* helpers below and nothing reaches
+ * the kernel until uring_enter, which submits everything queued and waits
+ * for completions in the same call. An absolute timeout at the next
+ * release queued with them makes that call return at the deadline, so one
+ * loop iteration costs one system call however many devices and sockets
+ * it touches. The writes are not linked to the timeout: they start right
+ * away and only the caller waits for the period.
+ *
+ * Needs Linux 5.6 or later at run time. Toolchains whose kernel headers
+ * predate it build without io_uring, uring_init then fails with ENOSYS and
+ * the programs keep their blocking loops.
+ *
+ * @author David Dong haochend@andrew.cmu.edu
+ *         Yanying Zhu yanyingz@andrew.cmu.edu
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "periodic.h"
+
+/** @brief one completion */
+struct uring_done {
+	/** @brief tag given when the operation was queued */
+	uint64_t tag;
+	/** @brief result, as the system call would return it or -errno */
+	int32_t res;
+};
+
+/** @brief an io_uring instance and its mapped rings */
+struct uring {
+	/** @brief the ring fd, -1 if none */
+	int fd;
+	/** @brief submission ring head, advanced by the kernel */
+	unsigned int *sq_head;
+	/** @brief submission ring tail, advanced by uring_get */
+	unsigned int *sq_tail;
+	/** @brief submission ring index mask */
+	unsigned int sq_mask;
+	/** @brief submission ring slots, each the index of an entry */
+	unsigned int *sq_array;
+	/** @brief submission entries */
+	void *sqes;
+	/** @brief completion ring head, advanced by uring_reap */
+	unsigned int *cq_head;
+	/** @brief completion ring tail, advanced by the kernel */
+	unsigned int *cq_tail;
+	/** @brief completion ring index mask */
+	unsigned int cq_mask;
+	/** @brief completion entries */
+	void *cqes;
+	/** @brief the mapped submission ring */
+	void *sq_ring;
+	/** @brief size of sq_ring */
+	size_t sq_ring_len;
+	/** @brief the mapped completion ring, NULL if it shares sq_ring */
+	void *cq_ring;
+	/** @brief size of cq_ring */
+	size_t cq_ring_len;
+	/** @brief size of sqes */
+	size_t sqes_len;
+	/** @brief operations queued since the last uring_enter */
+	unsigned int queued;
+	/** @brief operations submitted whose completion was not reaped yet */
+	unsigned int inflight;
+	/** @brief deadline of the queued timeout as a struct __kernel_timespec,
+	           seconds then ns, which must outlive the submission */
+	int64_t deadline[2];
+	/** @brief number of io_uring_enter calls made */
+	unsigned long enters;
+};
+
+/** @brief sets up an io_uring instance
+    @param r is the instance to set up
+    @param entries is the number of operations one uring_enter may carry
+    @return 0 on success, -1 on failure
+*/
+int uring_init(struct uring *r, unsigned int entries);
+
+/** @brief queues a write
+    @param r is the instance
+    @param fd is the file to write
+    @param buf is the data, must stay valid until the completion is reaped
+    @param len is the number of bytes
+    @param off is the file offset, -1 for the current position
+    @param tag is returned with the completion
+    @return 0 on success, -1 if the submission ring is full
+*/
+int uring_write(struct uring *r, int fd, const void *buf, size_t len, int64_t off, uint64_t tag);
+
+/** @brief queues a send on a connected socket
+    @param r is the instance
+    @param fd is the socket
+    @param buf is the data, must stay valid until the completion is reaped
+    @param len is the number of bytes
+    @param tag is returned with the completion
+    @return 0 on success, -1 if the submission ring is full
+*/
+int uring_send(struct uring *r, int fd, const void *buf, size_t len, uint64_t tag);
+
+/** @brief queues a receive on a socket
+    @param r is the instance
+    @param fd is the socket
+    @param buf receives the data, must stay valid until the completion is
+           reaped
+    @param len is the size of buf
+    @param tag is returned with the completion
+    @return 0 on success, -1 if the submission ring is full
+*/
+int uring_recv(struct uring *r, int fd, void *buf, size_t len, uint64_t tag);
+
+/** @brief queues a sendmsg on a socket
+    @param r is the instance
+    @param fd is the socket
+    @param msg is the message, address and data, must stay valid until the
+           completion is reaped
+    @param tag is returned with the completion
+    @return 0 on success, -1 if the submission ring is full
+*/
+int uring_sendmsg(struct uring *r, int fd, const struct msghdr *msg, uint64_t tag);
+
+/** @brief queues a recvmsg on a socket
+    @param r is the instance
+    @param fd is the socket
+    @param msg receives the message and the sender's address, must stay
+           valid until the completion is reaped
+    @param tag is returned with the completion
+    @return 0 on success, -1 if the submission ring is full
+*/
+int uring_recvmsg(struct uring *r, int fd, struct msghdr *msg, uint64_t tag);
+
+/** @brief queues a timeout that completes with -ETIME at an absolute
+           CLOCK_MONOTONIC time. One may be in flight at a time.
+    @param r is the instance, holds the deadline until the completion
+    @param at is the deadline
+    @param tag is returned with the completion
+    @return 0 on success, -1 if the submission ring is full
+*/
+int uring_timeout(struct uring *r, const struct timespec *at, uint64_t tag);
+
+/** @brief submits everything queued and waits for completions, in one
+           system call
+    @param r is the instance
+    @param wait_nr is the number of completions to wait for
+    @return 0 on success, -1 on failure
+*/
+int uring_enter(struct uring *r, unsigned int wait_nr);
+
+/** @brief takes completions off the completion ring without a system call
+    @param r is the instance
+    @param done receives the completions
+    @param max is the size of done
+    @return the number of completions
+*/
+int uring_reap(struct uring *r, struct uring_done *done, int max);
+
+/** @brief ends a period of a periodic task: submits everything queued with
+           the timeout of the next release in one uring_enter, and returns
+           at the deadline with the completions of the queued operations
+           reaped and discarded. Replaces periodic_wait.
+    @param r is the instance, nothing else may be in flight
+    @param task is the periodic task
+*/
+void uring_periodic_wait(struct uring *r, struct periodic_task *task);
+
+/** @brief unmaps the rings and closes the instance
+    @param r is the instance
+*/
+void uring_exit(struct uring *r);
+
+#endif /* _URING_H_ */